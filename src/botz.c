@@ -3,6 +3,7 @@
 #include <malloc.h>
 #include <unistd.h>
 #include "botz.h"
+#include "botz_parse.h"
 #include "hash.h"
 #include "list.h"
 #include "n_buf.h"
@@ -43,6 +44,12 @@ static const char *botz_strstatus(int status)
     return "Method Not Allowed";
   case BOTZ_REQUEST_TIMEOUT:
     return "Request Timeout";
+  case BOTZ_REQUEST_ENTITY_TOO_LARGE:
+    return "Request Entity Too Large";
+  case BOTZ_REQUEST_URI_TOO_LONG:
+    return "Request-URI Too Long";
+  case BOTZ_UNSUPPORTED_MEDIA_TYPE:
+    return "Unsupported Media Type";
   case BOTZ_INTERVAL_SERVER_ERROR:
     return "Interval Server Error";
   case BOTZ_NOT_IMPLEMENTED:
@@ -77,9 +84,12 @@ static void bl_listen_cb(EV_P_ struct evx_listen *el, int fd,
 
   c->c_listen = bl;
   list_add(&c->c_listen_link, &bl->bl_conn_list);
+  bl->bl_nr_conn++;
 
   if (n_buf_init(&c->c_q_buf, bl->bl_q_buf_size) < 0)
     goto err;
+  if (n_buf_init(&c->c_q_arena, bl->bl_q_arena_size) < 0)
+    goto err;
   if (n_buf_init(&c->c_r_header, bl->bl_r_header_size) < 0)
     goto err;
   if (n_buf_init(&c->c_r_body, bl->bl_r_body_size) < 0)
@@ -117,8 +127,11 @@ int botz_listen_init(struct botz_listen *bl, size_t nr_entries)
   INIT_LIST_HEAD(&bl->bl_conn_list);
   bl->bl_conn_timeout = 60.0; /* XXX Hard constants. */
   bl->bl_q_buf_size = 1048576;
+  bl->bl_q_arena_size = 16384;
   bl->bl_r_header_size = 4096;
   bl->bl_r_body_size = 1048576;
+  bl->bl_q_body_max = 64 << 20;
+  bl->bl_r_encode_min = 1024;
 
   if (hash_table_init(&bl->bl_entry_table, nr_entries) < 0)
     return -1;
@@ -165,9 +178,13 @@ static void bc_close(EV_P_ struct botz_conn *c, int err)
   c->c_io_w.fd = -1;
 
   list_del(&c->c_listen_link);
+  c->c_listen->bl_nr_conn--;
   n_buf_destroy(&c->c_q_buf);
+  n_buf_destroy(&c->c_q_arena);
   n_buf_destroy(&c->c_r_header);
   n_buf_destroy(&c->c_r_body);
+  n_buf_destroy(&c->c_q_decode);
+  n_buf_destroy(&c->c_r_encode);
 
   free(c);
 }
@@ -200,6 +217,10 @@ static void br_write_header(struct botz_response *r, struct n_buf *nb)
                  strlen(r->r_body_type) != 0 ? r->r_body_type : "text/plain",
                  n_buf_length(&r->r_body));
 
+  if (r->r_encoding != 0)
+    n_buf_printf(nb, "Content-Encoding: %s\r\n" "Vary: Accept-Encoding\r\n",
+                 r->r_encoding == BOTZ_ENC_GZIP ? "gzip" : "deflate");
+
   if (r->r_status < 300)
     n_buf_printf(nb, "Access-Control-Allow-Origin: *\r\n");
 
@@ -209,20 +230,36 @@ static void br_write_header(struct botz_response *r, struct n_buf *nb)
   n_buf_printf(nb, "\r\n");
 }
 
-static void bx_read_start(EV_P_ struct botz_x *x, char *msg, size_t msg_len);
-
 static void bx_reset(EV_P_ struct botz_x *x)
 {
   struct botz_conn *c = container_of(x, struct botz_conn, c_x);
 
-  free(x->x_q.q_path);
-  free(x->x_q.q_query);
   memset(x, 0, sizeof(*x));
-  x->x_read_cb = &bx_read_start;
+  n_buf_clear(&c->c_q_arena);
   x->x_r.r_body = c->c_r_body;
   n_buf_clear(&x->x_r.r_body);
 }
 
+/* Copy s into the per-request arena.  Everything allocated here is
+   released at once by bx_reset(). */
+static char *bx_strndup(struct botz_x *x, const char *s, size_t n)
+{
+  struct n_buf *nb = &container_of(x, struct botz_conn, c_x)->c_q_arena;
+  char *d;
+
+  if (nb->nb_size - nb->nb_end < n + 1) {
+    errno = ENOBUFS;
+    return NULL;
+  }
+
+  d = nb->nb_buf + nb->nb_end;
+  memcpy(d, s, n);
+  d[n] = 0;
+  nb->nb_end += n + 1;
+
+  return d;
+}
+
 static void bx_error(struct botz_x *x, int status)
 {
   /* TODO If status < 0 then use errno. */
@@ -237,63 +274,6 @@ static void bx_error(struct botz_x *x, int status)
   x->x_q_ready = 1;
 }
 
-static void bq_set_cookie(struct botz_request *q, const char *cookie /*, ... */)
-{
-  /* ... */
-}
-
-static void bx_read_header(EV_P_ struct botz_x *x, char *msg, size_t msg_len)
-{
-  char *name, *value1 = NULL;
-
-  if (split(&msg, &name, &value1, (char **) NULL) == 0) {
-    if (x->x_q_body_len > 0)
-      x->x_q_body_wait = 1;
-    else
-      x->x_q_ready = 1;
-    return; /* End of headers. */
-  }
-
-  if (value1 == NULL)
-    value1 = name + strlen(name);
-
-  if (strcasecmp(name, "Connection:") == 0) {
-    if (strcasecmp(value1, "close") == 0)
-      x->x_close = 1;
-  } else if (strcasecmp(name, "Content-Length:") == 0) {
-    x->x_q_body_len = strtoul(value1, NULL, 10);
-  } else if (strcasecmp(name, "Cookie:") == 0) {
-    bq_set_cookie(&x->x_q, value1);
-  } else if (strcasecmp(name, "Expect:") == 0) {
-    if (strcasecmp(value1, "100-Continue") == 0)
-      x->x_expect_100 = 1;
-  }
-}
-
-static int bx_parse_method(struct botz_x *x, const char *method)
-{
-#define X(S)                                    \
-  if (strcmp(method, #S) == 0) {                \
-    x->x_q.q_method = BOTZ_ ## S;               \
-    return 0;                                   \
-  }
-  X(GET);
-  X(POST);
-  X(PUT);
-  X(DELETE);
-#undef X
-
-  if (strcmp(method, "CONNECT") == 0 ||
-      strcmp(method, "HEAD") == 0 ||
-      strcmp(method, "OPTIONS") == 0 ||
-      strcmp(method, "TRACE") == 0)
-    bx_error(x, BOTZ_METHOD_NOT_ALLOWED);
-  else
-    bx_error(x, BOTZ_NOT_IMPLEMENTED);
-
-  return -1;
-}
-
 struct botz_entry *
 botz_new_entry(const char *name, const struct botz_entry_ops *ops, void *data)
 {
@@ -314,7 +294,8 @@ botz_new_entry(const char *name, const struct botz_entry_ops *ops, void *data)
   return e;
 }
 
-static int bp_init(struct botz_lookup *p, struct botz_entry *e, const char *s)
+/* Tokenizes s in place. */
+static int bp_init(struct botz_lookup *p, struct botz_entry *e, char *s)
 {
   memset(p, 0, sizeof(*p));
 
@@ -323,10 +304,7 @@ static int bp_init(struct botz_lookup *p, struct botz_entry *e, const char *s)
     return -1;
   }
 
-  p->p_rest = p->p_save = strdup(s);
-  if (p->p_rest == NULL)
-    return -1;
-
+  p->p_rest = s;
   p->p_entry = e;
 
   return 0;
@@ -377,11 +355,15 @@ struct botz_entry *
 botz_lookup(struct botz_listen *bl, const char *path, int flags)
 {
   struct hash_table *t = &bl->bl_entry_table;
-  struct botz_lookup p;
+  struct botz_lookup p = { };
+  char *dup = NULL;
 
   /* Static lookup only; does not call any o_lookup() methods. */
 
-  if (bp_init(&p, bl->bl_root_entry, path) < 0)
+  if (path != NULL)
+    dup = strdup(path);
+
+  if (bp_init(&p, bl->bl_root_entry, dup) < 0)
     goto out;
 
   while (bp_walk(&p)) {
@@ -412,23 +394,24 @@ botz_lookup(struct botz_listen *bl, const char *path, int flags)
   TRACE_LOOKUP(p);
 
  out:
-  free(p.p_save);
+  free(dup);
 
   return p.p_entry;
 }
 
-static struct botz_entry *bx_lookup(EV_P_ struct botz_x *x)
+/* Dynamic lookup of path, which is tokenized in place.  Entries
+   returned by o_lookup() are hashed below so later requests for the
+   same path find them in the table.  Sets *ready if an o_lookup()
+   method answered the request itself. */
+static struct botz_entry *
+bl_lookup(EV_P_ struct botz_listen *bl, char *path, struct botz_request *q,
+          struct botz_response *r, int *ready)
 {
-  struct botz_listen *bl = container_of(x, struct botz_conn, c_x)->c_listen;
   struct hash_table *t = &bl->bl_entry_table;
-  struct botz_lookup p;
-
-  /* Dynamic lookup. */
+  struct botz_lookup p = { };
 
-  if (bp_init(&p, bl->bl_root_entry, x->x_q.q_path) < 0) {
-    bx_error(x, -1);
-    goto out;
-  }
+  if (bp_init(&p, bl->bl_root_entry, path) < 0)
+    return NULL;
 
   while (bp_walk(&p)) {
     struct botz_entry *e;
@@ -438,13 +421,13 @@ static struct botz_entry *bx_lookup(EV_P_ struct botz_x *x)
     e = bt_lookup_1(t, &p);
 
     if (e == NULL && p.p_entry->e_ops->o_lookup != NULL)
-      e = (*p.p_entry->e_ops->o_lookup)(EV_A_ &p, &x->x_q, &x->x_r);
+      e = (*p.p_entry->e_ops->o_lookup)(EV_A_ &p, q, r);
 
     if (e == NULL)
-      x->x_r.r_status = BOTZ_NOT_FOUND;
+      r->r_status = BOTZ_NOT_FOUND;
 
     if (e == BOTZ_RESPONSE_READY) {
-      x->x_r_ready = 1;
+      *ready = 1;
       e = NULL;
     }
 
@@ -461,19 +444,102 @@ static struct botz_entry *bx_lookup(EV_P_ struct botz_x *x)
 
   TRACE_LOOKUP(p);
 
- out:
-  free(p.p_save);
-
   return p.p_entry;
 }
 
+static struct botz_entry *bx_lookup(EV_P_ struct botz_x *x)
+{
+  struct botz_listen *bl = container_of(x, struct botz_conn, c_x)->c_listen;
+  struct botz_entry *e;
+  char *path = NULL;
+  int ready = 0;
+
+  if (x->x_q.q_path != NULL) {
+    path = bx_strndup(x, x->x_q.q_path, strlen(x->x_q.q_path));
+    if (path == NULL) {
+      bx_error(x, BOTZ_REQUEST_URI_TOO_LONG);
+      return NULL;
+    }
+  }
+
+  if (path == NULL) {
+    bx_error(x, -1);
+    return NULL;
+  }
+
+  e = bl_lookup(EV_A_ bl, path, &x->x_q, &x->x_r, &ready);
+  if (ready)
+    x->x_r_ready = 1;
+
+  return e;
+}
+
+/* Replace q_body with its decoding according to Content-Encoding. */
+static int bx_decode_body(struct botz_x *x)
+{
+  struct botz_conn *c = container_of(x, struct botz_conn, c_x);
+  struct n_buf *q_body = &x->x_q.q_body;
+
+  n_buf_clear(&c->c_q_decode);
+
+  if (n_buf_inflate(&c->c_q_decode, q_body->nb_buf + q_body->nb_start,
+                    n_buf_length(q_body), c->c_listen->bl_q_body_max) < 0) {
+    bx_error(x, errno == EFBIG ?
+             BOTZ_REQUEST_ENTITY_TOO_LARGE : BOTZ_BAD_REQUEST);
+    return -1;
+  }
+
+  *q_body = c->c_q_decode;
+
+  return 0;
+}
+
+/* Compress the response body if the client accepts it and it helps. */
+static void bx_encode_body(struct botz_x *x)
+{
+  struct botz_conn *c = container_of(x, struct botz_conn, c_x);
+  struct botz_response *r = &x->x_r;
+  int gzip = x->x_q.q_accept_encoding & BOTZ_ENC_GZIP;
+
+  if (r->r_encoding != 0 || x->x_q.q_accept_encoding == 0)
+    return;
+
+  if (!(r->r_status == 0 || r->r_status == BOTZ_OK))
+    return;
+
+  if (n_buf_length(&r->r_body) < c->c_listen->bl_r_encode_min)
+    return;
+
+  n_buf_clear(&c->c_r_encode);
+
+  if (n_buf_deflate(&c->c_r_encode, r->r_body.nb_buf + r->r_body.nb_start,
+                    n_buf_length(&r->r_body), gzip, 1 /* Fastest. */) < 0) {
+    TRACE("cannot compress response: %m\n");
+    return;
+  }
+
+  if (n_buf_length(&c->c_r_encode) >= n_buf_length(&r->r_body))
+    return;
+
+  r->r_body = c->c_r_encode;
+  r->r_encoding = gzip ? BOTZ_ENC_GZIP : BOTZ_ENC_DEFLATE;
+}
+
 static void bx_handle(EV_P_ struct botz_x *x)
 {
+  struct botz_conn *c = container_of(x, struct botz_conn, c_x);
   struct botz_entry *e = NULL;
 
-  if (x->x_r_ready)
+  /* Don't dispatch requests we already rejected while reading. */
+  if (x->x_r_ready || x->x_r.r_status >= 400)
+    goto out;
+
+  if (x->x_q_encoding != 0 && bx_decode_body(x) < 0)
     goto out;
 
+  if (x->x_q.q_method == BOTZ_PUT && c->c_listen->bl_put_cb != NULL)
+    (*c->c_listen->bl_put_cb)(EV_A_ c->c_listen, &x->x_q);
+
   e = x->x_entry = bx_lookup(EV_A_ x);
   if (e == NULL)
     goto out;
@@ -488,44 +554,152 @@ static void bx_handle(EV_P_ struct botz_x *x)
   (*e->e_ops->o_method[x->x_q.q_method])(EV_A_ e, &x->x_q, &x->x_r);
 
  out:
+  /* Handlers may grow the body with n_buf_reserve(). */
+  c->c_r_body.nb_buf = x->x_r.r_body.nb_buf;
+  c->c_r_body.nb_size = x->x_r.r_body.nb_size;
+
+  bx_encode_body(x);
   x->x_r_ready = 1;
 }
 
-static void bx_read_start(EV_P_ struct botz_x *x, char *msg, size_t msg_len)
+void botz_handle(EV_P_ struct botz_listen *bl, struct botz_request *q,
+                 struct botz_response *r)
 {
-  char *method, *path_query, *protocol;
+  struct botz_entry *e;
+  char *path = NULL;
+  int ready = 0;
 
-  int n = split(&msg, &method, &path_query, &protocol, (char **) NULL);
-  if (n == 0)
-    return; /* Ignore leading empty lines. */
+  if (q->q_path != NULL)
+    path = strdup(q->q_path);
 
-  x->x_read_cb = &bx_read_header;
-  x->x_q_start = 1;
+  if (path == NULL) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    goto out;
+  }
 
-  if (n != 3) {
-    bx_error(x, BOTZ_BAD_REQUEST);
-    return;
+  e = bl_lookup(EV_A_ bl, path, q, r, &ready);
+  if (e == NULL || ready)
+    goto out;
+
+  if (e->e_ops->o_method[q->q_method] == NULL) {
+    r->r_status = BOTZ_FORBIDDEN;
+    goto out;
+  }
+
+  (*e->e_ops->o_method[q->q_method])(EV_A_ e, q, r);
+
+ out:
+  free(path);
+}
+
+/* Parse the request head once all of it is in c_q_buf. */
+static void bx_read_head(EV_P_ struct botz_x *x)
+{
+  struct botz_conn *c = container_of(x, struct botz_conn, c_x);
+  struct n_buf *nb = &c->c_q_buf;
+  struct botz_head h;
+  size_t head_len;
+  int rc;
+
+  if (!x->x_q_start) {
+    /* Ignore leading empty lines. */
+    while (!n_buf_is_empty(nb) &&
+           (nb->nb_buf[nb->nb_start] == '\r' ||
+            nb->nb_buf[nb->nb_start] == '\n'))
+      nb->nb_start++;
+
+    if (n_buf_is_empty(nb))
+      return;
+
+    x->x_q_start = 1;
   }
 
-  if (bx_parse_method(x, method) < 0)
+  /* x_q_scan is relative to nb_start so it survives pullups. */
+  head_len = botz_head_end(nb->nb_buf + nb->nb_start, n_buf_length(nb),
+                           &x->x_q_scan);
+  if (head_len == 0)
     return;
 
-  char *path = strsep(&path_query, "?");
-  char *query = path_query;
+  rc = botz_head_parse(&h, nb->nb_buf + nb->nb_start, head_len);
+  nb->nb_start += head_len;
+
+  if (rc < 0) {
+    bx_error(x, h.h_status);
+    return;
+  }
+
+  x->x_q.q_method = h.h_method;
+  x->x_q.q_accept_encoding = h.h_accept_encoding;
+  x->x_q_encoding = h.h_content_encoding;
+  x->x_q_body_len = h.h_body_len;
+  x->x_close = h.h_close;
+  x->x_expect_100 = h.h_expect_100;
+
+  if (x->x_q_body_len > c->c_listen->bl_q_body_max) {
+    x->x_q_body_len = 0;
+    bx_error(x, BOTZ_REQUEST_ENTITY_TOO_LARGE);
+    return;
+  }
 
   ASSERT(x->x_q.q_path == NULL && x->x_q.q_query == NULL);
 
-  x->x_q.q_path = strdup(path);
+  /* path and query point into c_q_buf, which may be pulled up before
+     the request is complete, so copy them into the arena. */
+  x->x_q.q_path = bx_strndup(x, h.h_path, h.h_path_len);
+  if (x->x_q.q_path == NULL)
+    goto err;
+
+  if (h.h_query != NULL) {
+    x->x_q.q_query = bx_strndup(x, h.h_query, h.h_query_len);
+    if (x->x_q.q_query == NULL)
+      goto err;
+  }
+
+  /* Grow c_q_buf to hold the whole body, bx_q_buf_shrink() gives
+     the space back. */
+  if (x->x_q_body_len > n_buf_length(nb) &&
+      n_buf_reserve(nb, x->x_q_body_len - n_buf_length(nb)) < 0) {
+    x->x_q_body_len = 0;
+    bx_error(x, BOTZ_INTERVAL_SERVER_ERROR);
+    return;
+  }
+
+  if (x->x_q_body_len > 0)
+    x->x_q_body_wait = 1;
+  else
+    x->x_q_ready = 1;
 
-  if (query != NULL)
-    x->x_q.q_query = strdup(query);
+  return;
+
+ err:
+  bx_error(x, BOTZ_REQUEST_URI_TOO_LONG);
+}
+
+static void bx_q_buf_shrink(struct botz_conn *c)
+{
+  struct n_buf *nb = &c->c_q_buf;
+  size_t size = c->c_listen->bl_q_buf_size;
+  char *buf;
+
+  n_buf_pullup(nb);
+  if (nb->nb_size <= size || nb->nb_end > size)
+    return;
+
+  buf = realloc(nb->nb_buf, size);
+  if (buf == NULL)
+    return;
+
+  nb->nb_buf = buf;
+  nb->nb_size = size;
 }
 
 static void bc_io_cb(EV_P_ struct ev_io *w, int revents)
 {
   struct botz_conn *c = container_of(w, struct botz_conn, c_io_w);
+  struct botz_listen *bl = c->c_listen;
   struct botz_x *x = &c->c_x;
   int eof = 0, err = 0, events = 0;
+  size_t len;
 
   TRACE("revents %d\n", revents);
 
@@ -537,13 +711,17 @@ static void bc_io_cb(EV_P_ struct ev_io *w, int revents)
   }
 
   if (revents & EV_WRITE) {
+    len = n_buf_length(&c->c_r_header);
     n_buf_drain(&c->c_r_header, w->fd, &eof, &err);
+    bl->bl_bytes_out += len - n_buf_length(&c->c_r_header);
     if (err != 0)
       goto close;
 
     if (eof && x->x_r_ready) {
       eof = 0;
+      len = n_buf_length(&x->x_r.r_body);
       n_buf_drain(&x->x_r.r_body, w->fd, &eof, &err);
+      bl->bl_bytes_out += len - n_buf_length(&x->x_r.r_body);
       if (err != 0)
         goto close;
 
@@ -572,8 +750,11 @@ static void bc_io_cb(EV_P_ struct ev_io *w, int revents)
   }
 
   eof = 0;
-  if (revents & EV_READ)
+  if (revents & EV_READ) {
+    len = n_buf_length(&c->c_q_buf);
     n_buf_fill(&c->c_q_buf, w->fd, &eof, &err);
+    bl->bl_bytes_in += n_buf_length(&c->c_q_buf) - len;
+  }
 
   TRACE("read eof %d, err %d\n", eof, err);
 
@@ -583,21 +764,11 @@ static void bc_io_cb(EV_P_ struct ev_io *w, int revents)
   /* We may have left something behind in the request buffer, so we
      check it regardless of revents. */
 
-  while (!n_buf_is_empty(&c->c_q_buf) && !x->x_q_ready) {
-    char *msg;
-    size_t msg_len;
+  if (!x->x_q_ready && !x->x_q_body_wait)
+    bx_read_head(EV_A_ x);
 
-    if (x->x_q_body_wait) {
-      if (x->x_q_body_len <= n_buf_length(&c->c_q_buf))
-        x->x_q_ready = 1;
-      break;
-    }
-
-    if (n_buf_get_msg(&c->c_q_buf, &msg, &msg_len) != 0)
-      break;
-
-    (x->x_read_cb)(EV_A_ x, msg, msg_len);
-  }
+  if (x->x_q_body_wait && x->x_q_body_len <= n_buf_length(&c->c_q_buf))
+    x->x_q_ready = 1;
 
   if (eof) {
     if (!x->x_q_start)
@@ -624,8 +795,10 @@ static void bc_io_cb(EV_P_ struct ev_io *w, int revents)
     x->x_q.q_body.nb_size = c->c_q_buf.nb_size;
     x->x_q.q_body.nb_start = c->c_q_buf.nb_start;
     x->x_q.q_body.nb_end = c->c_q_buf.nb_start + body_len;
+    bl->bl_nr_requests++;
     bx_handle(EV_A_ x);
     c->c_q_buf.nb_start += body_len;
+    bx_q_buf_shrink(c);
 
     br_write_header(&x->x_r, &c->c_r_header);
 
@@ -6,15 +6,22 @@
 #include "n_buf.h"
 
 struct botz_entry;
+struct botz_request;
 
 struct botz_listen {
   struct evx_listen bl_listen;
   struct list_head bl_conn_list;
   /* TODO bl_max_conn */
   double bl_conn_timeout;
-  size_t bl_q_buf_size, bl_r_header_size, bl_r_body_size;
+  size_t bl_q_buf_size, bl_q_arena_size, bl_r_header_size, bl_r_body_size;
+  size_t bl_q_body_max; /* After decoding. */
+  size_t bl_r_encode_min; /* Smallest body worth compressing. */
   struct hash_table bl_entry_table;
   struct botz_entry *bl_root_entry;
+  /* Called with each PUT before it is handled, for journaling. */
+  void (*bl_put_cb)(EV_P_ struct botz_listen *, const struct botz_request *);
+  size_t bl_nr_conn;
+  unsigned long long bl_nr_requests, bl_bytes_in, bl_bytes_out;
 };
 
 enum {
@@ -36,11 +43,18 @@ enum {
 #define BOTZ_NOT_FOUND 404
 #define BOTZ_METHOD_NOT_ALLOWED 405
 #define BOTZ_REQUEST_TIMEOUT 408
+#define BOTZ_REQUEST_ENTITY_TOO_LARGE 413
+#define BOTZ_REQUEST_URI_TOO_LONG 414
+#define BOTZ_UNSUPPORTED_MEDIA_TYPE 415
 #define BOTZ_INTERVAL_SERVER_ERROR 500
 #define BOTZ_NOT_IMPLEMENTED 501
 
 #define BOTZ_RESPONSE_READY ((struct botz_entry *) 1UL)
 
+/* Content codings, as bits in q_accept_encoding. */
+#define BOTZ_ENC_GZIP    (1 << 0)
+#define BOTZ_ENC_DEFLATE (1 << 1)
+
 struct botz_entry;
 struct botz_entry_ops;
 struct botz_request;
@@ -56,7 +70,7 @@ struct botz_entry {
 
 struct botz_lookup {
   struct botz_entry *p_entry;
-  char *p_name, *p_rest, *p_save;
+  char *p_name, *p_rest;
 };
 
 struct botz_entry_ops {
@@ -72,9 +86,9 @@ struct botz_entry_ops {
 };
 
 struct botz_request {
-  char *q_path, *q_query /*, *q_host */;
-  struct n_buf q_body;
-  int q_method;
+  char *q_path, *q_query /*, *q_host */; /* In c_q_arena. */
+  struct n_buf q_body; /* Decoded. */
+  int q_method, q_accept_encoding;
   unsigned int q_close:1;
 };
 
@@ -82,6 +96,7 @@ struct botz_response {
   int r_status;
   struct n_buf r_body;
   char r_body_type[80];
+  int r_encoding; /* Set by handlers that supply an encoded body. */
   unsigned int r_close:1;
 };
 
@@ -90,8 +105,9 @@ struct botz_x { /* Request, response exchange. MOVEME */
   struct botz_entry *x_entry;
   struct botz_request x_q;
   struct botz_response x_r;
-  void (*x_read_cb)(EV_P_ struct botz_x *, char *, size_t);
+  size_t x_q_scan; /* Head bytes already searched for the end. */
   size_t x_q_body_len;
+  int x_q_encoding;
   unsigned int x_close:1, x_expect_100:1,
     x_q_start:1, x_q_body_wait:1, x_q_ready:1,
     x_r_ready:1, x_r_sent:1;
@@ -102,7 +118,8 @@ struct botz_conn {
   struct list_head c_listen_link;
   struct ev_io c_io_w;
   struct ev_timer c_timer_w;
-  struct n_buf c_q_buf, c_r_header, c_r_body;
+  struct n_buf c_q_buf, c_q_arena, c_r_header, c_r_body;
+  struct n_buf c_q_decode, c_r_encode; /* Grown on demand. */
   struct botz_x c_x;
   void (*c_close_cb)(EV_P_ struct botz_conn *, int);
 };
@@ -118,6 +135,11 @@ botz_new_entry(const char *name, const struct botz_entry_ops *ops, void *data);
 struct botz_entry *
 botz_lookup(struct botz_listen *bl, const char *path, int flags);
 
+/* Handle q as though it came in on a connection to bl, for replay.
+   Handlers append to r->r_body. */
+void botz_handle(EV_P_ struct botz_listen *bl, struct botz_request *q,
+                 struct botz_response *r);
+
 struct json;
 
 int botz_add_json(struct botz_listen *bl, const char *path, struct json *j);
@@ -0,0 +1,354 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "botz.h"
+#include "botz_parse.h"
+
+/* Request heads are scanned as a block: line ends are found with
+   memchr() (vectorized in libc) and header names are matched by length
+   and then compared a word at a time, case folded.  Nothing in the
+   buffer is modified. */
+
+#define BH_FOLD64 0x2020202020202020ULL
+
+static inline uint64_t bh_load64(const char *s)
+{
+  uint64_t w;
+
+  memcpy(&w, s, sizeof(w));
+
+  return w;
+}
+
+/* lc must be lower case and consist of letters, digits, and '-'. */
+static int bh_case_eq(const char *s, const char *lc, size_t len)
+{
+  for (; len >= 8; s += 8, lc += 8, len -= 8)
+    if ((bh_load64(s) | BH_FOLD64) != bh_load64(lc))
+      return 0;
+
+  for (; len > 0; s++, lc++, len--)
+    if ((*s | 0x20) != *lc)
+      return 0;
+
+  return 1;
+}
+
+static inline int bh_is_space(int c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+enum {
+  BH_ACCEPT_ENCODING,
+  BH_CONNECTION,
+  BH_CONTENT_ENCODING,
+  BH_CONTENT_LENGTH,
+  BH_EXPECT,
+  BH_NR_HEADERS,
+};
+
+static const struct {
+  const char *bh_name; /* Lower case, padded so words may be loaded. */
+  size_t bh_len;
+} bh_headers[] = {
+#define X(i, s) [i] = { s "\0\0\0\0\0\0\0", sizeof(s) - 1 }
+  X(BH_ACCEPT_ENCODING, "accept-encoding"),
+  X(BH_CONNECTION, "connection"),
+  X(BH_CONTENT_ENCODING, "content-encoding"),
+  X(BH_CONTENT_LENGTH, "content-length"),
+  X(BH_EXPECT, "expect"),
+#undef X
+};
+
+static int bh_header_id(const char *name, size_t len)
+{
+  int i;
+
+  for (i = 0; i < BH_NR_HEADERS; i++)
+    if (bh_headers[i].bh_len == len &&
+        bh_case_eq(name, bh_headers[i].bh_name, len))
+      return i;
+
+  return -1;
+}
+
+static int bh_parse_method(struct botz_head *h, const char *s, size_t len)
+{
+#define X(S)                                                    \
+  if (len == sizeof(#S) - 1 && memcmp(s, #S, len) == 0) {      \
+    h->h_method = BOTZ_ ## S;                                   \
+    return 0;                                                   \
+  }
+  X(GET);
+  X(PUT);
+  X(POST);
+  X(DELETE);
+#undef X
+
+#define X(S) (len == sizeof(S) - 1 && memcmp(s, S, len) == 0)
+  if (X("HEAD") || X("OPTIONS") || X("TRACE") || X("CONNECT"))
+    h->h_status = BOTZ_METHOD_NOT_ALLOWED;
+  else
+    h->h_status = BOTZ_NOT_IMPLEMENTED;
+#undef X
+
+  return -1;
+}
+
+static int bh_parse_size(const char *s, size_t len, size_t *z)
+{
+  size_t n = 0;
+
+  if (len == 0)
+    return -1;
+
+  for (; len > 0; s++, len--) {
+    if (!('0' <= *s && *s <= '9'))
+      return -1;
+
+    if (n > (((size_t) -1) - 9) / 10)
+      return -1;
+
+    n = 10 * n + (*s - '0');
+  }
+
+  *z = n;
+
+  return 0;
+}
+
+/* Returns a BOTZ_ENC_* bit, 0 for identity, or -1 if unknown. */
+static int bh_coding(const char *s, size_t len)
+{
+  if ((len == 4 && bh_case_eq(s, "gzip", 4)) ||
+      (len == 6 && bh_case_eq(s, "x-gzip", 6)))
+    return BOTZ_ENC_GZIP;
+
+  if (len == 7 && bh_case_eq(s, "deflate", 7))
+    return BOTZ_ENC_DEFLATE;
+
+  if (len == 8 && bh_case_eq(s, "identity", 8))
+    return 0;
+
+  return -1;
+}
+
+/* Accept-Encoding: gzip, deflate;q=0.5, br;q=0 */
+static int bh_accept_encoding(const char *s, const char *end)
+{
+  int mask = 0;
+
+  while (s < end) {
+    const char *e = memchr(s, ',', end - s), *t, *p;
+    int enc;
+
+    if (e == NULL)
+      e = end;
+
+    while (s < e && bh_is_space(*s))
+      s++;
+
+    for (t = s; t < e && *t != ';'; t++)
+      ;
+
+    p = t < e ? t : NULL;
+
+    while (t > s && bh_is_space(t[-1]))
+      t--;
+
+    /* Skip codings with q=0 (or 0.0...). */
+    if (p != NULL) {
+      p++;
+      while (p < e && bh_is_space(*p))
+        p++;
+
+      if (e - p >= 2 && (*p | 0x20) == 'q' && p[1] == '=') {
+        for (p += 2; p < e && (*p == '0' || *p == '.'); p++)
+          ;
+
+        while (p < e && bh_is_space(*p))
+          p++;
+
+        if (p == e)
+          goto next;
+      }
+    }
+
+    if (t - s == 1 && *s == '*')
+      enc = BOTZ_ENC_GZIP|BOTZ_ENC_DEFLATE;
+    else
+      enc = bh_coding(s, t - s);
+
+    if (enc > 0)
+      mask |= enc;
+
+  next:
+    if (e == end)
+      break;
+
+    s = e + 1;
+  }
+
+  return mask;
+}
+
+static int bh_parse_request_line(struct botz_head *h, const char *s, size_t len)
+{
+  const char *end = s + len, *m, *t, *t_end, *v, *q;
+
+  while (end > s && bh_is_space(end[-1]))
+    end--;
+
+  m = s;
+  s = memchr(m, ' ', end - m);
+  if (s == NULL)
+    goto bad;
+
+  if (bh_parse_method(h, m, s - m) < 0)
+    return -1;
+
+  while (s < end && *s == ' ')
+    s++;
+
+  t = s;
+  t_end = memchr(t, ' ', end - t);
+  if (t_end == NULL || t_end == t)
+    goto bad;
+
+  v = t_end;
+  while (v < end && *v == ' ')
+    v++;
+
+  if (v == end || memchr(v, ' ', end - v) != NULL)
+    goto bad; /* Missing or malformed protocol. */
+
+  h->h_path = t;
+  q = memchr(t, '?', t_end - t);
+  if (q == NULL) {
+    h->h_path_len = t_end - t;
+  } else {
+    h->h_path_len = q - t;
+    h->h_query = q + 1;
+    h->h_query_len = t_end - (q + 1);
+  }
+
+  return 0;
+
+ bad:
+  h->h_status = BOTZ_BAD_REQUEST;
+  return -1;
+}
+
+static int bh_parse_header(struct botz_head *h, const char *s, size_t len)
+{
+  const char *end = s + len, *colon, *v;
+  int id;
+
+  colon = memchr(s, ':', len);
+  if (colon == NULL)
+    return 0; /* Ignore. */
+
+  id = bh_header_id(s, colon - s);
+  if (id < 0)
+    return 0;
+
+  v = colon + 1;
+  while (v < end && bh_is_space(*v))
+    v++;
+
+  while (end > v && bh_is_space(end[-1]))
+    end--;
+
+  switch (id) {
+  case BH_ACCEPT_ENCODING:
+    h->h_accept_encoding = bh_accept_encoding(v, end);
+    break;
+  case BH_CONTENT_ENCODING:
+    h->h_content_encoding = bh_coding(v, end - v);
+    if (h->h_content_encoding < 0) {
+      h->h_status = BOTZ_UNSUPPORTED_MEDIA_TYPE;
+      return -1;
+    }
+    break;
+  case BH_CONNECTION:
+    if (end - v == 5 && bh_case_eq(v, "close", 5))
+      h->h_close = 1;
+    break;
+  case BH_CONTENT_LENGTH:
+    if (bh_parse_size(v, end - v, &h->h_body_len) < 0) {
+      h->h_status = BOTZ_BAD_REQUEST;
+      return -1;
+    }
+    break;
+  case BH_EXPECT:
+    if (end - v == 12 && bh_case_eq(v, "100-continue", 12))
+      h->h_expect_100 = 1;
+    break;
+  }
+
+  return 0;
+}
+
+size_t botz_head_end(const char *buf, size_t len, size_t *scan)
+{
+  size_t i = *scan;
+  const char *nl;
+
+  while (i < len && (nl = memchr(buf + i, '\n', len - i)) != NULL) {
+    size_t j = nl - buf + 1;
+
+    if (j < len && buf[j] == '\n')
+      return j + 1;
+
+    if (j + 1 < len && buf[j] == '\r' && buf[j + 1] == '\n')
+      return j + 2;
+
+    if (j == len || (j + 1 == len && buf[j] == '\r')) {
+      /* Can't tell yet; look at this newline again next time. */
+      *scan = j - 1;
+      return 0;
+    }
+
+    i = j;
+  }
+
+  *scan = len;
+
+  return 0;
+}
+
+int botz_head_parse(struct botz_head *h, const char *buf, size_t len)
+{
+  const char *s = buf, *end = buf + len, *nl;
+  int n = 0;
+
+  memset(h, 0, sizeof(*h));
+
+  while (s < end && (nl = memchr(s, '\n', end - s)) != NULL) {
+    size_t line_len = nl - s;
+
+    if (line_len > 0 && s[line_len - 1] == '\r')
+      line_len--;
+
+    if (line_len == 0) {
+      if (n > 0)
+        break; /* End of head. */
+    } else if (n++ == 0) {
+      if (bh_parse_request_line(h, s, line_len) < 0)
+        return -1;
+    } else {
+      if (bh_parse_header(h, s, line_len) < 0)
+        return -1;
+    }
+
+    s = nl + 1;
+  }
+
+  if (n == 0) {
+    h->h_status = BOTZ_BAD_REQUEST;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef _BOTZ_PARSE_H_
+#define _BOTZ_PARSE_H_
+#include <stddef.h>
+
+/* Result of parsing a request head (request line and headers).
+   h_path and h_query point into the parsed buffer, which is not
+   modified; they are not NUL terminated. */
+
+struct botz_head {
+  int h_method, h_status;
+  const char *h_path, *h_query;
+  size_t h_path_len, h_query_len;
+  size_t h_body_len;
+  int h_accept_encoding; /* BOTZ_ENC_* bits. */
+  int h_content_encoding; /* BOTZ_ENC_* or 0 for identity. */
+  unsigned int h_close:1, h_expect_100:1;
+};
+
+/* botz_head_end: Return the length of the head at the start of buf,
+   including the blank line that terminates it, or 0 if the head is not
+   yet complete.  Scanning resumes at *scan, which is updated so that
+   repeated calls on a growing buffer don't rescan old data. */
+size_t botz_head_end(const char *buf, size_t len, size_t *scan);
+
+/* botz_head_parse: Parse the complete head buf[0, len).  Returns 0 on
+   success, otherwise sets h_status to a BOTZ_* error status and
+   returns -1. */
+int botz_head_parse(struct botz_head *h, const char *buf, size_t len);
+
+#endif
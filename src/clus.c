@@ -3,11 +3,11 @@
 #include "string1.h"
 #include "clus.h"
 #include "job.h"
+#include "perf.h"
 #include "sub.h"
 #include "trace.h"
 #include "x_botz.h"
 
-#define CLUS_0_NAME "NONE"
 #define IDLE_JOBID "IDLE"
 
 static struct clus_node *clus_0; /* Default/unknown cluster. */
@@ -156,10 +156,11 @@ static void clus_put_cb(EV_P_ struct botz_entry *e,
   struct n_buf *nb = &q->q_body;
   char *msg;
   size_t msg_len;
+  double t0 = perf_now();
 
   /* TODO AUTH. */
 
-  c->c_modified = ev_now(EV_A);
+  c->c_modified = x_now(EV_A);
 
   TRACE("clus `%s' PUT length %zu, body `%.*s'\n",
         c->c_x.x_name, n_buf_length(nb),
@@ -167,6 +168,8 @@ static void clus_put_cb(EV_P_ struct botz_entry *e,
 
   while (n_buf_get_msg(nb, &msg, &msg_len) == 0)
     clus_msg_cb(EV_A_ c, msg);
+
+  perf_hist_add(PERF_H_clus_put, t0);
 }
 
 static void clus_get_cb(EV_P_ struct botz_entry *e,
@@ -2,12 +2,16 @@
 #define _CLUS_H_
 #include "x_node.h"
 
+#define CLUS_0_NAME "NONE"
+
+struct fed_peer;
 struct job_node;
 
 struct clus_node {
   void *c_auth;
   double c_interval, c_offset, c_modified;
   struct job_node *c_idle_job;
+  struct fed_peer *c_peer; /* Pulled from, NULL if local. */
   struct x_node c_x;
 };
 
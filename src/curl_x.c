@@ -5,8 +5,12 @@
 #include "string1.h"
 #include "trace.h"
 
+static void cx_async_destroy(struct curl_x *cx);
+
 void curl_x_destroy(struct curl_x *cx)
 {
+  if (cx->cx_multi != NULL)
+    cx_async_destroy(cx);
   if (cx->cx_curl != NULL)
     curl_easy_cleanup(cx->cx_curl);
   free(cx->cx_host);
@@ -62,6 +66,7 @@ int curl_x_get_url(struct curl_x *cx, char *url, struct n_buf *nb)
   if (cx->cx_port > 0)
     curl_easy_setopt(cx->cx_curl, CURLOPT_PORT, cx->cx_port);
   curl_easy_setopt(cx->cx_curl, CURLOPT_UPLOAD, 0L);
+  curl_easy_setopt(cx->cx_curl, CURLOPT_ACCEPT_ENCODING, "");
   curl_easy_setopt(cx->cx_curl, CURLOPT_WRITEDATA, file);
 
 #if DEBUG
@@ -94,18 +99,34 @@ int curl_x_get_url(struct curl_x *cx, char *url, struct n_buf *nb)
 int curl_x_put_url(struct curl_x *cx, const char *url, struct n_buf *nb)
 {
   FILE *file[2] = { NULL, NULL };
+  struct curl_slist *headers = NULL;
+  N_BUF(z);
+  struct n_buf *in = &nb[0];
   int rc = -1;
 
+  if (cx->cx_put_gzip && n_buf_length(&nb[0]) > 0) {
+    if (n_buf_deflate(&z, nb[0].nb_buf + nb[0].nb_start,
+                      n_buf_length(&nb[0]), 1, 6) < 0) {
+      ERROR("cannot compress request body: %m\n");
+      goto out;
+    }
+
+    headers = curl_slist_append(headers, "Content-Encoding: gzip");
+    if (headers == NULL)
+      OOM();
+
+    in = &z;
+  }
+
   /* fmemopen() fails when buffer size is zero. */
-  if (n_buf_length(&nb[0]) == 0) {
+  if (n_buf_length(in) == 0) {
     file[0] = fopen("/dev/null", "r");
     if (file[0] == NULL) {
       ERROR("cannot open `/dev/null' for reading: %m\n");
       goto out;
     }
   } else {
-    file[0] = fmemopen(nb[0].nb_buf + nb[0].nb_start,
-                       n_buf_length(&nb[0]), "r");
+    file[0] = fmemopen(in->nb_buf + in->nb_start, n_buf_length(in), "r");
     if (file[0] == NULL) {
       ERROR("cannot open memory stream: %m\n");
       goto out;
@@ -127,7 +148,9 @@ int curl_x_put_url(struct curl_x *cx, const char *url, struct n_buf *nb)
   curl_easy_setopt(cx->cx_curl, CURLOPT_UPLOAD, 1L);
   curl_easy_setopt(cx->cx_curl, CURLOPT_READDATA, file[0]);
   curl_easy_setopt(cx->cx_curl, CURLOPT_INFILESIZE_LARGE,
-                   (curl_off_t) n_buf_length(&nb[0]));
+                   (curl_off_t) n_buf_length(in));
+  curl_easy_setopt(cx->cx_curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(cx->cx_curl, CURLOPT_ACCEPT_ENCODING, "");
   curl_easy_setopt(cx->cx_curl, CURLOPT_WRITEDATA, file[1]);
 
 #if DEBUG
@@ -154,6 +177,9 @@ int curl_x_put_url(struct curl_x *cx, const char *url, struct n_buf *nb)
   if (file[1] != NULL)
     fclose(file[1]);
 
+  curl_slist_free_all(headers);
+  n_buf_destroy(&z);
+
   nb[1].nb_end = nb[1].nb_size;
 
   return rc;
@@ -231,3 +257,342 @@ int curl_x_get_iter(struct curl_x *cx,
 
   return rc;
 }
+
+/* Asynchronous requests: libcurl's multi socket interface with one
+   ev_io per socket and a single ev_timer for curl's timeouts. */
+
+struct cx_sock {
+  struct ev_io s_w;
+  struct curl_x *s_cx;
+};
+
+static void cx_req_free(struct curl_x_req *xr)
+{
+  if (xr->xr_curl != NULL)
+    curl_easy_cleanup(xr->xr_curl);
+
+  curl_slist_free_all(xr->xr_headers);
+  free(xr->xr_url);
+  n_buf_destroy(&xr->xr_nb[0]);
+  n_buf_destroy(&xr->xr_nb[1]);
+  free(xr);
+}
+
+static void cx_check_info(struct curl_x *cx)
+{
+  struct curl_x_req *xr;
+  CURLMsg *msg;
+  int nr_msg, rc;
+
+  while ((msg = curl_multi_info_read(cx->cx_multi, &nr_msg)) != NULL) {
+    if (msg->msg != CURLMSG_DONE)
+      continue;
+
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &xr);
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &xr->xr_code);
+
+    rc = 0;
+    if (msg->data.result != CURLE_OK) {
+      ERROR("request to `%s' failed: %s\n", xr->xr_url,
+            xr->xr_error[0] != 0 ? xr->xr_error :
+            curl_easy_strerror(msg->data.result));
+      rc = -1;
+    }
+
+    curl_multi_remove_handle(cx->cx_multi, xr->xr_curl);
+    list_del(&xr->xr_link);
+    cx->cx_nr_req--;
+
+    (*xr->xr_cb)(xr, rc);
+    cx_req_free(xr);
+  }
+}
+
+static void cx_sock_cb(EV_P_ struct ev_io *w, int revents)
+{
+  struct cx_sock *s = container_of(w, struct cx_sock, s_w);
+  struct curl_x *cx = s->s_cx;
+  int action = 0, running;
+
+  if (revents & EV_READ)
+    action |= CURL_CSELECT_IN;
+  if (revents & EV_WRITE)
+    action |= CURL_CSELECT_OUT;
+
+  /* May free s. */
+  curl_multi_socket_action(cx->cx_multi, w->fd, action, &running);
+  cx_check_info(cx);
+
+  /* Callbacks may have added requests since. */
+  if (running == 0 && cx->cx_nr_req == 0)
+    ev_timer_stop(EV_A_ &cx->cx_timer_w);
+}
+
+static void cx_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  struct curl_x *cx = container_of(w, struct curl_x, cx_timer_w);
+  int running;
+
+  curl_multi_socket_action(cx->cx_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+  cx_check_info(cx);
+}
+
+static int cx_socket_func(CURL *c, curl_socket_t fd, int what,
+                          void *data, void *sock_data)
+{
+  struct curl_x *cx = data;
+  struct ev_loop *loop = cx->cx_loop;
+  struct cx_sock *s = sock_data;
+  int events = 0;
+
+  if (what == CURL_POLL_REMOVE) {
+    if (s != NULL) {
+      ev_io_stop(EV_A_ &s->s_w);
+      free(s);
+    }
+    return 0;
+  }
+
+  if (s == NULL) {
+    s = malloc(sizeof(*s));
+    if (s == NULL)
+      return -1;
+
+    s->s_cx = cx;
+    ev_init(&s->s_w, &cx_sock_cb);
+    curl_multi_assign(cx->cx_multi, fd, s);
+  } else {
+    ev_io_stop(EV_A_ &s->s_w);
+  }
+
+  if (what & CURL_POLL_IN)
+    events |= EV_READ;
+  if (what & CURL_POLL_OUT)
+    events |= EV_WRITE;
+
+  ev_io_set(&s->s_w, fd, events);
+  ev_io_start(EV_A_ &s->s_w);
+
+  return 0;
+}
+
+static int cx_timer_func(CURLM *m, long timeout_ms, void *data)
+{
+  struct curl_x *cx = data;
+  struct ev_loop *loop = cx->cx_loop;
+
+  ev_timer_stop(EV_A_ &cx->cx_timer_w);
+
+  if (timeout_ms >= 0) {
+    ev_timer_set(&cx->cx_timer_w, timeout_ms / 1000.0, 0);
+    ev_timer_start(EV_A_ &cx->cx_timer_w);
+  }
+
+  return 0;
+}
+
+static size_t cx_read_func(char *buf, size_t size, size_t nmemb, void *data)
+{
+  struct n_buf *nb = data;
+  size_t len = MIN(size * nmemb, n_buf_length(nb));
+
+  memcpy(buf, nb->nb_buf + nb->nb_start, len);
+  nb->nb_start += len;
+
+  return len;
+}
+
+static size_t cx_write_func(char *buf, size_t size, size_t nmemb, void *data)
+{
+  struct n_buf *nb = data;
+  size_t len = size * nmemb;
+
+  if (n_buf_reserve(nb, len) < 0)
+    return 0;
+
+  memcpy(nb->nb_buf + nb->nb_end, buf, len);
+  nb->nb_end += len;
+
+  return len;
+}
+
+/* Drops requests still in flight without calling their callbacks. */
+static void cx_async_destroy(struct curl_x *cx)
+{
+  struct ev_loop *loop = cx->cx_loop;
+  struct curl_x_req *xr, *tmp;
+
+  list_for_each_entry_safe(xr, tmp, &cx->cx_req_list, xr_link) {
+    curl_multi_remove_handle(cx->cx_multi, xr->xr_curl);
+    list_del(&xr->xr_link);
+    cx_req_free(xr);
+  }
+
+  curl_multi_cleanup(cx->cx_multi);
+  cx->cx_multi = NULL;
+  cx->cx_nr_req = 0;
+  ev_timer_stop(EV_A_ &cx->cx_timer_w);
+}
+
+int curl_x_async_init(EV_P_ struct curl_x *cx, size_t max_req)
+{
+  cx->cx_multi = curl_multi_init();
+  if (cx->cx_multi == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  cx->cx_loop = EV_A;
+  ev_init(&cx->cx_timer_w, &cx_timer_cb);
+  INIT_LIST_HEAD(&cx->cx_req_list);
+  cx->cx_max_req = max_req;
+
+  curl_multi_setopt(cx->cx_multi, CURLMOPT_SOCKETFUNCTION, &cx_socket_func);
+  curl_multi_setopt(cx->cx_multi, CURLMOPT_SOCKETDATA, cx);
+  curl_multi_setopt(cx->cx_multi, CURLMOPT_TIMERFUNCTION, &cx_timer_func);
+  curl_multi_setopt(cx->cx_multi, CURLMOPT_TIMERDATA, cx);
+
+  return 0;
+}
+
+static struct curl_x_req *
+cx_req_new(struct curl_x *cx, const char *path, const char *query,
+           curl_x_req_cb_t *cb, void *data)
+{
+  struct curl_x_req *xr;
+  CURL *c;
+
+  if (cx->cx_nr_req >= cx->cx_max_req) {
+    errno = EBUSY;
+    return NULL;
+  }
+
+  xr = calloc(1, sizeof(*xr));
+  if (xr == NULL)
+    return NULL;
+
+  INIT_LIST_HEAD(&xr->xr_link);
+  xr->xr_cx = cx;
+  xr->xr_cb = cb;
+  xr->xr_data = data;
+
+  xr->xr_url = strf("http://%s/%s%s%s", cx->cx_host, path,
+                    query != NULL ? "?" : "",
+                    query != NULL ? query : "");
+  if (xr->xr_url == NULL)
+    goto err;
+
+  TRACE("url `%s'\n", xr->xr_url);
+
+  c = xr->xr_curl = curl_easy_init();
+  if (c == NULL)
+    goto err;
+
+  curl_easy_setopt(c, CURLOPT_URL, xr->xr_url);
+  if (cx->cx_port > 0)
+    curl_easy_setopt(c, CURLOPT_PORT, cx->cx_port);
+  curl_easy_setopt(c, CURLOPT_ACCEPT_ENCODING, "");
+  curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, &cx_write_func);
+  curl_easy_setopt(c, CURLOPT_WRITEDATA, &xr->xr_nb[1]);
+  curl_easy_setopt(c, CURLOPT_PRIVATE, xr);
+  curl_easy_setopt(c, CURLOPT_ERRORBUFFER, xr->xr_error);
+  curl_easy_setopt(c, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1L);
+  if (cx->cx_timeout_ms > 0)
+    curl_easy_setopt(c, CURLOPT_TIMEOUT_MS, cx->cx_timeout_ms);
+
+#if DEBUG
+  curl_easy_setopt(c, CURLOPT_VERBOSE, 1L);
+#endif
+
+  return xr;
+
+ err:
+  cx_req_free(xr);
+
+  return NULL;
+}
+
+static int cx_req_add(struct curl_x_req *xr)
+{
+  struct curl_x *cx = xr->xr_cx;
+
+  if (curl_multi_add_handle(cx->cx_multi, xr->xr_curl) != CURLM_OK) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  list_add_tail(&xr->xr_link, &cx->cx_req_list);
+  cx->cx_nr_req++;
+
+  return 0;
+}
+
+int curl_x_put_async(struct curl_x *cx, const char *path, const char *query,
+                     struct n_buf *body, curl_x_req_cb_t *cb, void *data)
+{
+  struct curl_x_req *xr;
+  struct n_buf *in = body;
+  N_BUF(z);
+  CURL *c;
+
+  xr = cx_req_new(cx, path, query, cb, data);
+  if (xr == NULL)
+    return -1;
+
+  if (cx->cx_put_gzip && n_buf_length(body) > 0) {
+    if (n_buf_deflate(&z, body->nb_buf + body->nb_start,
+                      n_buf_length(body), 1, 6) < 0) {
+      ERROR("cannot compress request body: %m\n");
+      goto err;
+    }
+
+    in = &z;
+
+    xr->xr_headers = curl_slist_append(NULL, "Content-Encoding: gzip");
+    if (xr->xr_headers == NULL)
+      goto err;
+  }
+
+  c = xr->xr_curl;
+  curl_easy_setopt(c, CURLOPT_UPLOAD, 1L);
+  curl_easy_setopt(c, CURLOPT_READFUNCTION, &cx_read_func);
+  curl_easy_setopt(c, CURLOPT_READDATA, &xr->xr_nb[0]);
+  curl_easy_setopt(c, CURLOPT_INFILESIZE_LARGE,
+                   (curl_off_t) n_buf_length(in));
+  curl_easy_setopt(c, CURLOPT_HTTPHEADER, xr->xr_headers);
+
+  if (cx_req_add(xr) < 0)
+    goto err;
+
+  /* Nothing is read before we return to the loop. */
+  xr->xr_nb[0] = *in;
+  memset(in, 0, sizeof(*in));
+  xr->xr_gzip = (in == &z);
+  n_buf_destroy(body);
+
+  return 0;
+
+ err:
+  n_buf_destroy(&z);
+  cx_req_free(xr);
+
+  return -1;
+}
+
+int curl_x_get_async(struct curl_x *cx, const char *path, const char *query,
+                     curl_x_req_cb_t *cb, void *data)
+{
+  struct curl_x_req *xr;
+
+  xr = cx_req_new(cx, path, query, cb, data);
+  if (xr == NULL)
+    return -1;
+
+  if (cx_req_add(xr) < 0) {
+    cx_req_free(xr);
+    return -1;
+  }
+
+  return 0;
+}
@@ -1,13 +1,41 @@
 #ifndef _CURL_X_H_
 #define _CURL_X_H_
 #include <curl/curl.h>
-
-struct n_buf;
+#include <ev.h>
+#include "list.h"
+#include "n_buf.h"
 
 struct curl_x {
   CURL *cx_curl;
   char *cx_host;
   long cx_port;
+  unsigned int cx_put_gzip:1; /* Send PUT bodies with Content-Encoding: gzip. */
+  /* Asynchronous requests, see curl_x_async_init(). */
+  CURLM *cx_multi;
+  struct ev_loop *cx_loop;
+  struct ev_timer cx_timer_w;
+  struct list_head cx_req_list;
+  size_t cx_nr_req, cx_max_req;
+  long cx_timeout_ms;
+};
+
+struct curl_x_req;
+
+/* rc is 0 on a 2xx response, -1 otherwise. */
+typedef void (curl_x_req_cb_t)(struct curl_x_req *xr, int rc);
+
+struct curl_x_req {
+  struct list_head xr_link;
+  struct curl_x *xr_cx;
+  CURL *xr_curl;
+  struct curl_slist *xr_headers;
+  char *xr_url;
+  struct n_buf xr_nb[2]; /* Request body (as sent), response body. */
+  unsigned int xr_gzip:1; /* xr_nb[0] is gzipped. */
+  long xr_code; /* HTTP status, 0 if there was no response. */
+  curl_x_req_cb_t *xr_cb;
+  void *xr_data;
+  char xr_error[CURL_ERROR_SIZE];
 };
 
 int curl_x_init(struct curl_x *cx, const char *host, const char *port);
@@ -30,4 +58,18 @@ int curl_x_put_url(struct curl_x *cx, const char *url, struct n_buf *nb /* [2] *
 int curl_x_put(struct curl_x *cx, const char *path, const char *query,
                struct n_buf *nb /* [2] */);
 
+int curl_x_async_init(EV_P_ struct curl_x *cx, size_t max_req);
+
+/* Start a PUT of body and return.  On success the request takes over
+   body's buffer and cb is later called from the loop with the response
+   in xr->xr_nb[1]; the request is freed when cb returns.  On failure
+   body is untouched.  Fails with EBUSY when max_req requests are
+   already in flight. */
+int curl_x_put_async(struct curl_x *cx, const char *path, const char *query,
+                     struct n_buf *body, curl_x_req_cb_t *cb, void *data);
+
+/* As curl_x_put_async() for a GET with no body. */
+int curl_x_get_async(struct curl_x *cx, const char *path, const char *query,
+                     curl_x_req_cb_t *cb, void *data);
+
 #endif
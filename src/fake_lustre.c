@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Build a fake /proc/fs/lustre under ROOT for running xltop-servd
+   --root=ROOT without a Lustre server: NR_MDT targets under mdt/ and
+   NR_OST under obdfilter/, each with NR_NID exports/NID/stats files
+   (and a job_stats file with -j).  With -i the counters are advanced
+   every INTERVAL seconds, COUNT times or until killed.  Files are
+   rewritten in place so that servd's held fds see the new counters,
+   as with procfs.
+
+   gcc -O2 -o fake_lustre fake_lustre.c
+   ./fake_lustre -o 8 -n 4096 -i 10 /tmp/fl &
+   xltop-servd --root=/tmp/fl --bench=10 -i 10 -t 4 */
+
+static const char *fs_name = "fake";
+static size_t nr_mdt = 1, nr_ost = 8, nr_nid = 1024, nr_job;
+
+/* Per (target, client) rate in bytes per second, roughly log-uniform
+   so that a few clients dominate, as on a real server. */
+static uint64_t fl_rate(size_t t, size_t c)
+{
+  uint64_t h = (t + 1) * 0x9e3779b97f4a7c15ULL ^
+               (c + 1) * 0xc2b2ae3d27d4eb4fULL;
+
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 32;
+
+  return (h & 0xfff) << (h >> 12) % 16;
+}
+
+static int fl_mkdir(const char *path)
+{
+  if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "cannot create `%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Overwrite path with buf[0, len) without replacing the inode. */
+static int fl_write(const char *path, const char *buf, size_t len)
+{
+  int fd, rc = -1;
+
+  fd = open(path, O_WRONLY|O_CREAT, 0644);
+  if (fd < 0)
+    goto out;
+
+  if (pwrite(fd, buf, len, 0) != (ssize_t) len)
+    goto out;
+
+  if (ftruncate(fd, len) < 0)
+    goto out;
+
+  rc = 0;
+
+ out:
+  if (rc < 0)
+    fprintf(stderr, "cannot write `%s': %s\n", path, strerror(errno));
+
+  if (fd >= 0)
+    close(fd);
+
+  return rc;
+}
+
+static int fl_stats(char *buf, size_t size, int is_ost, uint64_t rate,
+                    double now, double elapsed)
+{
+  uint64_t wr = rate * elapsed, rd = rate / 2 * elapsed;
+  uint64_t reqs = 1 + wr / 4096 + rd / 4096;
+
+  if (is_ost)
+    return snprintf(buf, size,
+      "snapshot_time             %.6f secs.usecs\n"
+      "read_bytes                %"PRIu64" samples [bytes] 4096 1048576 %"PRIu64"\n"
+      "write_bytes               %"PRIu64" samples [bytes] 4096 1048576 %"PRIu64"\n"
+      "get_info                  %"PRIu64" samples [reqs]\n"
+      "statfs                    %"PRIu64" samples [reqs]\n"
+      "ping                      %"PRIu64" samples [reqs]\n",
+      now, 1 + rd / 65536, rd, 1 + wr / 65536, wr, reqs / 64, reqs / 16,
+      (uint64_t) elapsed / 25);
+
+  return snprintf(buf, size,
+      "snapshot_time             %.6f secs.usecs\n"
+      "open                      %"PRIu64" samples [reqs]\n"
+      "close                     %"PRIu64" samples [reqs]\n"
+      "getattr                   %"PRIu64" samples [reqs]\n"
+      "setattr                   %"PRIu64" samples [reqs]\n"
+      "statfs                    %"PRIu64" samples [reqs]\n",
+      now, reqs, reqs, 4 * reqs, reqs / 8, reqs / 64);
+}
+
+static int fl_job_stats(const char *path, size_t t, int is_ost, double now,
+                        double elapsed)
+{
+  char *buf = NULL;
+  size_t len = 0, j;
+  FILE *f;
+  int rc;
+
+  f = open_memstream(&buf, &len);
+  if (f == NULL)
+    return -1;
+
+  fprintf(f, "job_stats:\n");
+
+  for (j = 0; j < nr_job; j++) {
+    uint64_t rate = fl_rate(t, nr_nid + j);
+    uint64_t wr = rate * elapsed, rd = rate / 2 * elapsed;
+
+    fprintf(f, "- job_id:          %zu\n"
+            "  snapshot_time:   %.0f\n", 1000 + j, now);
+
+    if (is_ost)
+      fprintf(f, "  read_bytes:      { samples: %"PRIu64", unit: bytes, "
+              "min: 4096, max: 1048576, sum: %"PRIu64" }\n"
+              "  write_bytes:     { samples: %"PRIu64", unit: bytes, "
+              "min: 4096, max: 1048576, sum: %"PRIu64" }\n"
+              "  punch:           { samples: %"PRIu64", unit:  reqs }\n",
+              1 + rd / 65536, rd, 1 + wr / 65536, wr, 1 + wr / (1 << 24));
+    else
+      fprintf(f, "  open:            { samples: %"PRIu64", unit:  reqs }\n"
+              "  close:           { samples: %"PRIu64", unit:  reqs }\n"
+              "  getattr:         { samples: %"PRIu64", unit:  reqs }\n",
+              1 + wr / 4096, 1 + wr / 4096, 4 + wr / 1024);
+  }
+
+  fclose(f);
+  rc = fl_write(path, buf, len);
+  free(buf);
+
+  return rc;
+}
+
+/* Write (or rewrite) every file of one target. */
+static int fl_target(const char *root, size_t t, int is_ost, int create,
+                     double now, double elapsed)
+{
+  char path[4096], buf[1024];
+  size_t n, c;
+  int len;
+
+  n = snprintf(path, sizeof(path), "%s/%s/%s-%s%04zx", root,
+               is_ost ? "obdfilter" : "mdt", fs_name,
+               is_ost ? "OST" : "MDT", is_ost ? t - nr_mdt : t);
+
+  if (create && (fl_mkdir(path) < 0 ||
+                 fl_mkdir(strcat(path, "/exports")) < 0))
+    return -1;
+
+  path[n] = 0;
+  if (nr_job > 0) {
+    strcpy(path + n, "/job_stats");
+    if (fl_job_stats(path, t, is_ost, now, elapsed) < 0)
+      return -1;
+  }
+
+  for (c = 0; c < nr_nid; c++) {
+    snprintf(path + n, sizeof(path) - n, "/exports/10.%zu.%zu.%zu@o2ib",
+             (c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+
+    if (create && fl_mkdir(path) < 0)
+      return -1;
+
+    strcat(path, "/stats");
+    len = fl_stats(buf, sizeof(buf), is_ost, fl_rate(t, c), now, elapsed);
+    if (fl_write(path, buf, len) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static double now_real(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *p)
+{
+  fprintf(stderr,
+          "Usage: %s [OPTION]... ROOT\n"
+          " -c COUNT     advance the counters COUNT times (default forever)\n"
+          " -f NAME      filesystem name (default %s)\n"
+          " -i SECONDS   advance the counters every SECONDS\n"
+          " -j NR_JOB    also write job_stats with NR_JOB jobs per target\n"
+          " -m NR_MDT    number of MDTs (default %zu)\n"
+          " -n NR_NID    number of client NIDs per target (default %zu)\n"
+          " -o NR_OST    number of OSTs (default %zu)\n",
+          p, fs_name, nr_mdt, nr_nid, nr_ost);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  char path[4096];
+  const char *root;
+  double interval = 0, t0, t1, now;
+  long count = -1, i;
+  size_t t;
+  int c;
+
+  while ((c = getopt(argc, argv, "c:f:i:j:m:n:o:")) > 0) {
+    switch (c) {
+    case 'c':
+      count = strtol(optarg, NULL, 0);
+      break;
+    case 'f':
+      fs_name = optarg;
+      break;
+    case 'i':
+      interval = strtod(optarg, NULL);
+      break;
+    case 'j':
+      nr_job = strtoul(optarg, NULL, 0);
+      break;
+    case 'm':
+      nr_mdt = strtoul(optarg, NULL, 0);
+      break;
+    case 'n':
+      nr_nid = strtoul(optarg, NULL, 0);
+      break;
+    case 'o':
+      nr_ost = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (optind + 1 != argc || nr_nid > (1 << 24))
+    usage(argv[0]);
+
+  root = argv[optind];
+  if (fl_mkdir(root) < 0)
+    return 1;
+
+  /* Empty, as on 2.x servers, so servd finds all three. */
+  snprintf(path, sizeof(path), "%s/mds", root);
+  if (fl_mkdir(path) < 0)
+    return 1;
+
+  snprintf(path, sizeof(path), "%s/mdt", root);
+  if (fl_mkdir(path) < 0)
+    return 1;
+
+  snprintf(path, sizeof(path), "%s/obdfilter", root);
+  if (fl_mkdir(path) < 0)
+    return 1;
+
+  t0 = now_real();
+
+  for (i = 0; i == 0 || (interval > 0 && (count < 0 || i <= count)); i++) {
+    if (i > 0)
+      usleep(interval * 1000000);
+
+    now = now_real();
+    for (t = 0; t < nr_mdt + nr_ost; t++)
+      if (fl_target(root, t, t >= nr_mdt, i == 0, now, now - t0 + 1) < 0)
+        return 1;
+
+    t1 = now_real();
+    printf("step %ld: %zu targets x %zu nids in %f s\n",
+           i, nr_mdt + nr_ost, nr_nid, t1 - now);
+    fflush(stdout);
+  }
+
+  return 0;
+}
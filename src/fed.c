@@ -0,0 +1,437 @@
+#include "stddef1.h"
+#include <stdio.h>
+#include <errno.h>
+#include <malloc.h>
+#include <math.h>
+#include <ev.h>
+#include "botz.h"
+#include "clus.h"
+#include "curl_x.h"
+#include "fed.h"
+#include "job.h"
+#include "query.h"
+#include "string1.h"
+#include "trace.h"
+#include "x_node.h"
+#include "xltop.h"
+
+/* Federation.  GET /_fed?since=T lists the sums of every (job, fs)
+   pair of our own clusters changed since our time T (all of them for
+   T = 0), after a line with our current time to send as the next
+   since:
+
+     NOW
+     JOB FS SUM_WR SUM_RD SUM_REQS CLUS OWNER TITLE START
+
+   Each peer in the config is pulled every interval.  The difference
+   from the sums of its last pull goes into x_update() for job
+   JOB@PEER of cluster CLUS@PEER, so clusters, the universe and /top
+   see all sites and clus x fs needs no lines of its own.  Peer
+   clusters are never listed in /_fed, so peers may pull from each
+   other.
+
+   The first pull only records sums, as does the first after a peer
+   has been unreachable for max_age: rates then ramp up over the
+   window rather than taking the whole backlog in one tick.
+
+   Pairs idle on the peer are not listed, so their sums from the last
+   pull are kept until the pair is gone.  Every FED_BASE_TTL / 2 a
+   pull asks for all pairs, and sums not listed by a full pull for
+   FED_BASE_TTL are forgotten. */
+
+#define FED_MAX_REQ 1
+#define FED_NR_BASE_HINT 4096
+#define FED_BASE_TTL 86400.0 /* Forget pairs not listed this long. */
+
+struct fed_peer {
+  struct list_head p_link;
+  struct curl_x p_cx;
+  struct ev_timer p_w;
+  struct hash_table p_base_table;
+  size_t p_nr_base;
+  double p_interval, p_max_age;
+  double p_since; /* Peer's time of the last pull. */
+  double p_modified; /* Ours. */
+  double p_full; /* Ours, of the last pull of all pairs. */
+  size_t p_nr_pull, p_nr_fail, p_nr_line;
+  unsigned int p_resync:1; /* Next pull only records sums. */
+  unsigned int p_pull_full:1; /* The pull in flight asked for all pairs. */
+  char p_name[];
+};
+
+/* Sums of one (job, fs) pair from the last pull. */
+struct fed_base {
+  struct hlist_node b_hash_node;
+  double b_sum[NR_STATS];
+  double b_modified;
+  char b_key[]; /* JOB FS */
+};
+
+static LIST_HEAD(fed_peer_list);
+
+static void fed_base_clear(struct fed_peer *p, double min_modified)
+{
+  struct hash_table *t = &p->p_base_table;
+  struct hlist_node *node, *tmp;
+  struct fed_base *b;
+  size_t i;
+
+  for (i = 0; i < (1ULL << t->t_shift); i++) {
+    hlist_for_each_entry_safe(b, node, tmp, t->t_table + i, b_hash_node) {
+      if (b->b_modified >= min_modified)
+        continue;
+
+      hlist_del(&b->b_hash_node);
+      free(b);
+      p->p_nr_base--;
+    }
+  }
+}
+
+static struct fed_base *fed_base_lookup(struct fed_peer *p, const char *job,
+                                        const char *fs)
+{
+  struct hlist_head *head;
+  struct fed_base *b;
+  char key[1024];
+  size_t n;
+
+  n = snprintf(key, sizeof(key), "%s %s", job, fs);
+  if (n >= sizeof(key))
+    return NULL;
+
+  b = str_table_lookup_entry(&p->p_base_table, key, &head,
+                             struct fed_base, b_hash_node, b_key);
+  if (b != NULL)
+    return b;
+
+  b = malloc(sizeof(*b) + n + 1);
+  if (b == NULL)
+    return NULL;
+
+  memset(b, 0, sizeof(*b));
+  strcpy(b->b_key, key);
+  hlist_add_head(&b->b_hash_node, head);
+  p->p_nr_base++;
+
+  return b;
+}
+
+static struct x_node *
+fed_job_lookup(EV_P_ struct fed_peer *p, const char *job, const char *clus,
+               const char *owner, const char *title, const char *start)
+{
+  struct clus_node *c;
+  struct job_node *j;
+  char name[1024];
+
+  if ((size_t) snprintf(name, sizeof(name), "%s@%s", clus,
+                        p->p_name) >= sizeof(name))
+    return NULL;
+
+  c = clus_lookup(name, 0);
+  if (c == NULL) {
+    c = clus_lookup(name, L_CREATE);
+    if (c == NULL)
+      return NULL;
+
+    c->c_peer = p;
+  }
+
+  if (c->c_peer != p)
+    return NULL;
+
+  if ((size_t) snprintf(name, sizeof(name), "%s@%s", job,
+                        p->p_name) >= sizeof(name))
+    return NULL;
+
+  j = job_lookup(name, &c->c_x, owner, title, start);
+  if (j == NULL)
+    return NULL;
+
+  job_touch(EV_A_ j);
+
+  return &j->j_x;
+}
+
+static void fed_msg(EV_P_ struct fed_peer *p, char *msg, double now)
+{
+  char *job, *fs, *s[NR_STATS], *clus, *owner, *title, *start, *end;
+  double d[NR_STATS], sum[NR_STATS];
+  struct fed_base *b;
+  struct x_node *x0, *x1;
+  int reset = 0, zero = 1;
+  size_t i;
+
+  if (split(&msg, &job, &fs, &s[0], &s[1], &s[2], &clus, &owner, &title,
+            &start, (char **) NULL) != 9)
+    return;
+
+  for (i = 0; i < NR_STATS; i++) {
+    sum[i] = strtod(s[i], &end);
+    if (end == s[i])
+      return;
+  }
+
+  b = fed_base_lookup(p, job, fs);
+  if (b == NULL)
+    return;
+
+  /* The peer restarted. */
+  for (i = 0; i < NR_STATS; i++)
+    if (sum[i] < b->b_sum[i])
+      reset = 1;
+
+  for (i = 0; i < NR_STATS; i++) {
+    d[i] = reset ? sum[i] : sum[i] - b->b_sum[i];
+    b->b_sum[i] = sum[i];
+    zero = zero && d[i] == 0;
+  }
+
+  b->b_modified = now;
+
+  if (p->p_resync || zero)
+    return;
+
+  x0 = fed_job_lookup(EV_A_ p, job, clus, owner, title, start);
+  if (x0 == NULL)
+    return;
+
+  x1 = x_lookup(X_FS, fs, x_all[1], L_CREATE);
+  if (x1 == NULL)
+    return;
+
+  x_update(EV_A_ x0, x1, d, now);
+}
+
+static void fed_pull_cb(struct curl_x_req *xr, int rc)
+{
+  struct fed_peer *p = xr->xr_data;
+  struct ev_loop *loop = xr->xr_cx->cx_loop;
+  double now = ev_now(EV_A), since;
+  char *msg;
+  size_t msg_len;
+
+  if (rc < 0)
+    goto err;
+
+  if (n_buf_get_msg(&xr->xr_nb[1], &msg, &msg_len) < 0 ||
+      sscanf(msg, "%lf", &since) != 1) {
+    ERROR("peer `%s': invalid response from `%s'\n", p->p_name, xr->xr_url);
+    goto err;
+  }
+
+  p->p_nr_line = 0;
+  while (n_buf_get_msg(&xr->xr_nb[1], &msg, &msg_len) == 0) {
+    fed_msg(EV_A_ p, msg, now);
+    p->p_nr_line++;
+  }
+
+  TRACE("peer `%s', since %f, %zu lines, resync %d\n",
+        p->p_name, since, p->p_nr_line, (int) p->p_resync);
+
+  p->p_since = since;
+  p->p_modified = now;
+  p->p_resync = 0;
+  p->p_nr_pull++;
+
+  if (p->p_pull_full) {
+    p->p_full = now;
+    fed_base_clear(p, now - FED_BASE_TTL);
+  }
+
+  return;
+
+ err:
+  p->p_nr_fail++;
+}
+
+static void fed_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  struct fed_peer *p = container_of(w, struct fed_peer, p_w);
+  double now = ev_now(EV_A);
+  char query[64];
+
+  if (!p->p_resync && now - p->p_modified > p->p_max_age) {
+    ERROR("peer `%s': no data for %.0f seconds, starting over\n",
+          p->p_name, now - p->p_modified);
+    fed_base_clear(p, INFINITY);
+    p->p_since = 0;
+    p->p_resync = 1;
+  }
+
+  p->p_pull_full = p->p_since == 0 || now - p->p_full > FED_BASE_TTL / 2;
+  snprintf(query, sizeof(query), "since=%f",
+           p->p_pull_full ? 0 : p->p_since);
+
+  if (curl_x_get_async(&p->p_cx, "/_fed", query, &fed_pull_cb, p) < 0) {
+    ERROR("peer `%s': cannot GET `/_fed': %m\n", p->p_name);
+    p->p_nr_fail++;
+  }
+}
+
+struct fed_peer *fed_peer_add(EV_P_ const char *name, const char *host,
+                              const char *port, double interval,
+                              double max_age)
+{
+  struct fed_peer *p;
+
+  if (list_empty(&fed_peer_list) &&
+      curl_global_init(CURL_GLOBAL_NOTHING) != 0) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  p = malloc(sizeof(*p) + strlen(name) + 1);
+  if (p == NULL)
+    return NULL;
+
+  memset(p, 0, sizeof(*p));
+  strcpy(p->p_name, name);
+  p->p_interval = interval;
+  p->p_max_age = max_age;
+  p->p_resync = 1;
+
+  if (hash_table_init(&p->p_base_table, FED_NR_BASE_HINT) < 0)
+    goto err;
+
+  if (curl_x_init(&p->p_cx, host, port) < 0)
+    goto err;
+
+  if (curl_x_async_init(EV_A_ &p->p_cx, FED_MAX_REQ) < 0)
+    goto err;
+
+  p->p_cx.cx_timeout_ms = interval * 1000;
+
+  ev_timer_init(&p->p_w, &fed_timer_cb, 0, interval);
+  ev_timer_start(EV_A_ &p->p_w);
+
+  list_add_tail(&p->p_link, &fed_peer_list);
+
+  return p;
+
+ err:
+  free(p->p_base_table.t_table);
+  free(p);
+
+  return NULL;
+}
+
+static size_t fed_list(FILE *file, double since)
+{
+  struct hash_table *jt = &x_types[X_JOB].x_hash_table;
+  struct hash_table *ft = &x_types[X_FS].x_hash_table;
+  struct hlist_node *jn, *fn;
+  struct x_node *x0, *x1;
+  struct clus_node *c;
+  struct job_node *j;
+  struct k_node *k;
+  size_t i, l, nr = 0;
+
+  for (i = 0; i < (1ULL << jt->t_shift); i++) {
+    hlist_for_each_entry(x0, jn, jt->t_table + i, x_hash_node) {
+      if (x0->x_parent == NULL || !x_is_type(x0->x_parent, X_CLUS))
+        continue;
+
+      c = container_of(x0->x_parent, struct clus_node, c_x);
+      if (c->c_peer != NULL)
+        continue;
+
+      j = container_of(x0, struct job_node, j_x);
+
+      for (l = 0; l < (1ULL << ft->t_shift); l++) {
+        hlist_for_each_entry(x1, fn, ft->t_table + l, x_hash_node) {
+          k = k_lookup(x0, x1, 0);
+          if (k == NULL || k->k_modified < since)
+            continue;
+
+          fprintf(file, "%s %s "PRI_STATS_FMT("%f")" %s %s %s %.0f\n",
+                  x0->x_name, x1->x_name, PRI_STATS_ARG(k->k_sum),
+                  c->c_x.x_name, j->j_owner, j->j_title, j->j_start_time);
+          nr++;
+        }
+      }
+    }
+  }
+
+  return nr;
+}
+
+static void fed_get_cb(EV_P_ struct botz_entry *e,
+                             struct botz_request *q,
+                             struct botz_response *r)
+{
+  FILE *file = NULL;
+  char *buf = NULL;
+  size_t len = 0;
+  double since;
+
+#define FED_QUERY(X, Q) \
+  X(Q, 0, double, since, 0, q_double_parse, 0)
+
+  DEFINE_QUERY(FED_QUERY, fed_query);
+
+  if (QUERY_PARSE(FED_QUERY, fed_query, q->q_query) < 0) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    goto out;
+  }
+
+  since = fed_query[0].q_u.u_double;
+
+  file = open_memstream(&buf, &len);
+  if (file == NULL)
+    goto err;
+
+  fprintf(file, "%f\n", ev_now(EV_A));
+  fed_list(file, since);
+
+  if (fclose(file) < 0) {
+    file = NULL;
+    goto err;
+  }
+
+  file = NULL;
+
+  if (n_buf_reserve(&r->r_body, len) < 0)
+    goto err;
+
+  memcpy(r->r_body.nb_buf + r->r_body.nb_end, buf, len);
+  r->r_body.nb_end += len;
+
+  goto out;
+
+ err:
+  ERROR("cannot list pairs: %m\n");
+  r->r_status = BOTZ_INTERVAL_SERVER_ERROR;
+
+ out:
+  if (file != NULL)
+    fclose(file);
+  free(buf);
+}
+
+const struct botz_entry_ops fed_entry_ops = {
+  .o_method = {
+    [BOTZ_GET] = &fed_get_cb,
+  }
+};
+
+static void fed_peers_get_cb(EV_P_ struct botz_entry *e,
+                                   struct botz_request *q,
+                                   struct botz_response *r)
+{
+  double now = ev_now(EV_A);
+  struct fed_peer *p;
+
+  list_for_each_entry(p, &fed_peer_list, p_link)
+    n_buf_printf(&r->r_body, "%s %s %f %zu %zu %zu %zu\n",
+                 p->p_name, p->p_cx.cx_host,
+                 p->p_modified > 0 ? now - p->p_modified : -1.0,
+                 p->p_nr_line, p->p_nr_base, p->p_nr_pull, p->p_nr_fail);
+}
+
+const struct botz_entry_ops fed_peers_entry_ops = {
+  .o_method = {
+    [BOTZ_GET] = &fed_peers_get_cb,
+  }
+};
@@ -0,0 +1,17 @@
+#ifndef _FED_H_
+#define _FED_H_
+#include <ev.h>
+
+struct botz_entry_ops;
+struct fed_peer;
+
+/* Pull from the master at host:port every interval seconds, starting
+   over if the last good pull is older than max_age. */
+struct fed_peer *fed_peer_add(EV_P_ const char *name, const char *host,
+                              const char *port, double interval,
+                              double max_age);
+
+extern const struct botz_entry_ops fed_entry_ops; /* GET /_fed */
+extern const struct botz_entry_ops fed_peers_entry_ops; /* GET /_peers */
+
+#endif
@@ -1,5 +1,6 @@
 #include "stddef1.h"
 #include "string1.h"
+#include "perf.h"
 #include "serv.h"
 #include "trace.h"
 #include "xltop.h"
@@ -31,11 +32,15 @@ fs_entry_lookup_cb(EV_P_ struct botz_lookup *p,
   struct x_node *x = p->p_entry->e_data;
 
   if (strcmp(p->p_name, "_status") == 0 && p->p_rest == NULL) {
+    double t0 = perf_now();
+
     if (q->q_method == BOTZ_GET)
       fs_status_get_cb(x, q, r);
     else
       r->r_status = BOTZ_FORBIDDEN;
 
+    perf_hist_add(PERF_H_fs_status, t0);
+
     return BOTZ_RESPONSE_READY;
   }
 
@@ -68,6 +68,36 @@ char *_str_table_lookup(struct hash_table *t, const char *key,
   return NULL;
 }
 
+int _str_table_resize(struct hash_table *t, size_t hint, size_t str_offset)
+{
+  struct hash_table new;
+  struct hlist_node *node, *tmp;
+  size_t i;
+
+  if (hash_table_init(&new, hint) < 0)
+    return -1;
+
+  if (new.t_shift == t->t_shift) {
+    free(new.t_table);
+    return 0;
+  }
+
+  for (i = 0; i < (1ULL << t->t_shift); i++) {
+    hlist_for_each_safe(node, tmp, t->t_table + i) {
+      char *str = ((char *) node) + str_offset;
+      size_t hash = str_hash(str, new.t_shift);
+
+      hlist_del(node);
+      hlist_add_head(node, new.t_table + (hash & new.t_mask));
+    }
+  }
+
+  free(t->t_table);
+  *t = new;
+
+  return 0;
+}
+
 struct str_table_entry *
 str_table_lookup(struct hash_table *t, const char *key, int flags)
 {
@@ -31,6 +31,13 @@ char *_str_table_lookup(struct hash_table *t, const char *key,
     _str != NULL ? container_of(_str, type, m_str[0]) : NULL;           \
   })
 
+int _str_table_resize(struct hash_table *t, size_t hint, size_t str_offset);
+
+/* Rehash into a table sized for hint entries, as by hash_table_init(). */
+#define str_table_resize(t, hint, type, m_node, m_str)                  \
+  _str_table_resize((t), (hint),                                        \
+                    offsetof(type, m_str) - offsetof(type, m_node))
+
 int str_table_set(struct hash_table *t, const char *key, void *value);
 
 void *str_table_ref(struct hash_table *t, const char *key);
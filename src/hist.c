@@ -0,0 +1,317 @@
+#include "stddef1.h"
+#include <errno.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdint.h>
+#include <ev.h>
+#include "botz.h"
+#include "hash.h"
+#include "hist.h"
+#include "list.h"
+#include "query.h"
+#include "string1.h"
+#include "trace.h"
+#include "x_node.h"
+#include "xltop.h"
+
+/* History of the pairs at or above job x fs (jobs, clusters, and ALL
+   against fs and ALL).  Every hist_interval seconds each such pair
+   gets a sample: the amounts added to k_sum since the last one, whole
+   bytes (or requests).  Samples go into a ring of hist_size bytes,
+   each amount as a zigzag varint of its change from the previous
+   sample's, dropping the oldest samples when the ring is full.  Rings
+   are carved from one arena of hist_nr rings; when it is used up, a
+   new pair takes the ring of a pair missed by the last pass (gone), or
+   goes without.
+
+   Histories are keyed by name, so they outlive their k_node (for a job
+   that has ended) until their ring is taken.  A pair missed by a pass
+   starts over.  Histories are not saved in the snapshot. */
+
+#define HIST_SAMPLE_MAX (NR_STATS * 10) /* Bytes. */
+
+struct hist {
+  struct hlist_node h_hash_node;
+  struct list_head h_link; /* hist_list, by h_t. */
+  unsigned char *h_ring;
+  size_t h_head, h_len, h_nr; /* Bytes from h_ring, bytes, samples. */
+  double h_t; /* Time of the newest sample. */
+  double h_sum[NR_STATS]; /* k_sum then. */
+  int64_t h_last[NR_STATS]; /* Amounts of the newest sample. */
+  int64_t h_base[NR_STATS]; /* Amounts of the sample before the oldest. */
+  char h_key[];
+};
+
+static struct hash_table hist_table;
+static LIST_HEAD(hist_list);
+static unsigned char *hist_arena;
+static size_t hist_nr, hist_nr_used, hist_size;
+static double hist_interval;
+static struct ev_periodic hist_w;
+
+static uint64_t hist_get_varint(const struct hist *h, size_t *off)
+{
+  uint64_t v = 0;
+  unsigned char b;
+  int s = 0;
+
+  do {
+    b = h->h_ring[(h->h_head + (*off)++) % hist_size];
+    v |= (uint64_t) (b & 0x7f) << s;
+    s += 7;
+  } while ((b & 0x80) && s < 64);
+
+  return v;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+  return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t z)
+{
+  return (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+}
+
+static void hist_clear(struct hist *h)
+{
+  h->h_head = 0;
+  h->h_len = 0;
+  h->h_nr = 0;
+  memset(h->h_last, 0, sizeof(h->h_last));
+  memset(h->h_base, 0, sizeof(h->h_base));
+}
+
+/* Drop the oldest sample, folding it into h_base. */
+static void hist_drop(struct hist *h)
+{
+  size_t i, off = 0;
+
+  for (i = 0; i < NR_STATS; i++)
+    h->h_base[i] += unzigzag(hist_get_varint(h, &off));
+
+  h->h_head = (h->h_head + off) % hist_size;
+  h->h_len -= off;
+  h->h_nr--;
+}
+
+static void hist_append(struct hist *h, const int64_t *a)
+{
+  unsigned char buf[HIST_SAMPLE_MAX];
+  size_t i, n = 0;
+
+  for (i = 0; i < NR_STATS; i++) {
+    uint64_t z = zigzag(a[i] - h->h_last[i]);
+
+    do {
+      buf[n++] = (z & 0x7f) | (z > 0x7f ? 0x80 : 0);
+      z >>= 7;
+    } while (z != 0);
+
+    h->h_last[i] = a[i];
+  }
+
+  while (hist_size - h->h_len < n)
+    hist_drop(h);
+
+  for (i = 0; i < n; i++)
+    h->h_ring[(h->h_head + h->h_len++) % hist_size] = buf[i];
+
+  h->h_nr++;
+}
+
+static struct hist *hist_lookup(const char *key, double t, int flags)
+{
+  struct hlist_head *head;
+  struct hist *h, *old = NULL;
+
+  h = str_table_lookup_entry(&hist_table, key, &head,
+                             struct hist, h_hash_node, h_key);
+  if (h != NULL || !(flags & L_CREATE))
+    return h;
+
+  if (hist_nr_used >= hist_nr) {
+    if (list_empty(&hist_list))
+      return NULL;
+
+    old = list_entry(hist_list.next, struct hist, h_link);
+    if (!(old->h_t < t - 1.5 * hist_interval))
+      return NULL;
+  }
+
+  /* Evict old only once h is allocated, so its ring is never lost. */
+  h = malloc(sizeof(*h) + strlen(key) + 1);
+  if (h == NULL)
+    return NULL;
+
+  memset(h, 0, sizeof(*h));
+  strcpy(h->h_key, key);
+
+  if (old == NULL) {
+    h->h_ring = hist_arena + hist_nr_used * hist_size;
+  } else {
+    TRACE("dropping history `%s'\n", old->h_key);
+
+    h->h_ring = old->h_ring;
+    hlist_del(&old->h_hash_node);
+    list_del(&old->h_link);
+    free(old);
+    hist_nr_used--;
+  }
+
+  hlist_add_head(&h->h_hash_node, head);
+  list_add_tail(&h->h_link, &hist_list);
+  hist_nr_used++;
+
+  return h;
+}
+
+static void hist_sample(struct k_node *k, double t)
+{
+  int64_t a[NR_STATS];
+  struct hist *h;
+  char key[1024];
+  size_t i;
+
+  if ((size_t) snprintf(key, sizeof(key), "%s:%s %s:%s",
+                        k->k_x[0]->x_type->x_type_name, k->k_x[0]->x_name,
+                        k->k_x[1]->x_type->x_type_name, k->k_x[1]->x_name) >=
+      sizeof(key))
+    return;
+
+  h = hist_lookup(key, t, L_CREATE);
+  if (h == NULL)
+    return;
+
+  if (t - h->h_t < 0.5 * hist_interval)
+    return;
+
+  if (t - h->h_t > 1.5 * hist_interval) {
+    hist_clear(h);
+  } else {
+    for (i = 0; i < NR_STATS; i++)
+      a[i] = llround(fmax(k->k_sum[i] - h->h_sum[i], 0));
+
+    hist_append(h, a);
+  }
+
+  memcpy(h->h_sum, k->k_sum, sizeof(h->h_sum));
+  h->h_t = t;
+  list_move_tail(&h->h_link, &hist_list);
+}
+
+static void hist_timer_cb(EV_P_ struct ev_periodic *w, int revents)
+{
+  double t = floor(ev_now(EV_A) / hist_interval + 0.5) * hist_interval;
+  struct hlist_node *n0, *n1;
+  struct x_node *x0, *x1;
+  struct k_node *k;
+  size_t i0, i1, j0, j1;
+
+  for (i0 = X_JOB; i0 <= X_U; i0++) {
+    struct hash_table *t0 = &x_types[i0].x_hash_table;
+
+    for (j0 = 0; j0 < (1ULL << t0->t_shift); j0++) {
+      hlist_for_each_entry(x0, n0, t0->t_table + j0, x_hash_node) {
+        for (i1 = X_FS; i1 <= X_V; i1++) {
+          struct hash_table *t1 = &x_types[i1].x_hash_table;
+
+          for (j1 = 0; j1 < (1ULL << t1->t_shift); j1++) {
+            hlist_for_each_entry(x1, n1, t1->t_table + j1, x_hash_node) {
+              k = k_lookup(x0, x1, 0);
+              if (k != NULL)
+                hist_sample(k, t);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+int hist_init(EV_P_ size_t nr, size_t size, double interval)
+{
+  if (nr == 0 || size < 2 * HIST_SAMPLE_MAX || !(interval > 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (hash_table_init(&hist_table, nr) < 0)
+    return -1;
+
+  hist_arena = malloc(nr * size);
+  if (hist_arena == NULL)
+    return -1;
+
+  hist_nr = nr;
+  hist_size = size;
+  hist_interval = interval;
+
+  ev_periodic_init(&hist_w, &hist_timer_cb, 0, interval, NULL);
+  ev_periodic_start(EV_A_ &hist_w);
+
+  return 0;
+}
+
+/* One line per sample, oldest first: "TIME WR RD REQS", with TIME the
+   end of the sample and rates per second over it. */
+static void hist_query_cb(EV_P_ struct botz_response *r,
+                          char *x0, char *x1, double since)
+{
+  int64_t a[NR_STATS];
+  struct hist *h = NULL;
+  char key[1024];
+  size_t i, j, off = 0;
+
+  if (hist_nr > 0 &&
+      (size_t) snprintf(key, sizeof(key), "%s %s", x0, x1) < sizeof(key))
+    h = hist_lookup(key, 0, 0);
+
+  if (h == NULL) {
+    r->r_status = BOTZ_NOT_FOUND;
+    return;
+  }
+
+  memcpy(a, h->h_base, sizeof(a));
+
+  for (j = 0; j < h->h_nr; j++) {
+    double t = h->h_t - (h->h_nr - 1 - j) * hist_interval;
+
+    for (i = 0; i < NR_STATS; i++)
+      a[i] += unzigzag(hist_get_varint(h, &off));
+
+    if (t <= since)
+      continue;
+
+    n_buf_printf(&r->r_body, "%.0f "PRI_STATS_FMT("%f")"\n", t,
+                 a[0] / hist_interval,
+                 a[1] / hist_interval,
+                 a[2] / hist_interval);
+  }
+}
+
+static void hist_get_cb(EV_P_ struct botz_entry *e,
+                        struct botz_request *q,
+                        struct botz_response *r)
+{
+#define HIST_QUERY(X, Q)                           \
+  X(Q, 0, string, x0,    NULL, q_string_parse, 1), \
+  X(Q, 1, string, x1,    NULL, q_string_parse, 1), \
+  X(Q, 2, double, since, 0,    q_double_parse, 0)
+
+  DEFINE_QUERY(HIST_QUERY, hist_query);
+
+  if (QUERY_PARSE(HIST_QUERY, hist_query, q->q_query) < 0) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    return;
+  }
+
+  hist_query_cb(EV_A_ r, QUERY_VALUES(HIST_QUERY, hist_query));
+}
+
+const struct botz_entry_ops hist_entry_ops = {
+  .o_method = {
+    [BOTZ_GET] = &hist_get_cb,
+  }
+};
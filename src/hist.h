@@ -0,0 +1,16 @@
+#ifndef _HIST_H_
+#define _HIST_H_
+#include <stddef.h>
+#include <ev.h>
+
+struct botz_entry_ops;
+
+/* Sample k_sum of the pairs at or above job x fs every interval
+   seconds, keeping up to size bytes of samples for each of at most nr
+   pairs. */
+int hist_init(EV_P_ size_t nr, size_t size, double interval);
+
+/* GET history?x0=TYPE:NAME&x1=TYPE:NAME */
+extern const struct botz_entry_ops hist_entry_ops;
+
+#endif
@@ -59,6 +59,18 @@ struct job_node *job_lookup(const char *name /* jobid */,
   return j;
 }
 
+/* Jobs reported by servd from job_stats may have no hosts to end
+   them, so each report pushes back the zombie timeout instead. */
+void job_touch(EV_P_ struct job_node *j)
+{
+  if (j->j_fake)
+    return;
+
+  ev_timer_stop(EV_A_ &j->j_zombie_w);
+  ev_timer_set(&j->j_zombie_w, job_zombie_timeout, 0);
+  ev_timer_start(EV_A_ &j->j_zombie_w);
+}
+
 void job_end(EV_P_ struct job_node *j)
 {
   TRACE("job `%s' END\n", j->j_x.x_name);
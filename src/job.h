@@ -25,4 +25,6 @@ struct job_node *job_lookup(const char *name /* JOBID@CLUS */,
 
 void job_end(EV_P_ struct job_node *j);
 
+void job_touch(EV_P_ struct job_node *j);
+
 #endif
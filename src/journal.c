@@ -0,0 +1,379 @@
+#include "stddef1.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ev.h>
+#include "botz.h"
+#include "journal.h"
+#include "perf.h"
+#include "string1.h"
+#include "trace.h"
+#include "x_node.h"
+
+/* Ingest journal.  Each PUT taken by the master is appended as a
+   record header, then its path, query, and (decoded) body.  The
+   records are in host byte order and layout, like the snapshot.
+   Requests answered with an error are journaled too, and get the same
+   answer on replay.  The file is flushed every JOURNAL_FLUSH seconds
+   and on exit.
+
+   Replay runs the handlers outside of the event loop, with x_clock
+   standing in for ev_now(), so timers (job zombies, the report
+   schedule, peer pulls) do not fire.  Use a config without snapshot
+   or peers to reproduce a run. */
+
+#define JOURNAL_MAGIC 0x4a4c5458 /* "XTLJ" */
+#define JOURNAL_FLUSH 1.0
+#define JOURNAL_R_BODY_SIZE 65536
+
+struct journal_rec {
+  uint32_t jr_magic;
+  uint32_t jr_path_len, jr_query_len, jr_body_len;
+  double jr_time;
+};
+
+static char *journal_path;
+static FILE *journal_file;
+static size_t journal_max_size;
+static int journal_nr_files;
+static struct ev_timer journal_w;
+
+static int journal_open(void)
+{
+  journal_file = fopen(journal_path, "a");
+  if (journal_file == NULL) {
+    ERROR("cannot open journal `%s': %m\n", journal_path);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void journal_rotate(void)
+{
+  char *src = NULL, *dst = NULL;
+  int i;
+
+  fclose(journal_file);
+  journal_file = NULL;
+
+  for (i = journal_nr_files - 1; i > 0; i--) {
+    src = i > 1 ? strf("%s.%d", journal_path, i - 1) : strdup(journal_path);
+    dst = strf("%s.%d", journal_path, i);
+    if (src == NULL || dst == NULL)
+      OOM();
+
+    if (rename(src, dst) < 0 && errno != ENOENT)
+      ERROR("cannot rename `%s' to `%s': %m\n", src, dst);
+
+    free(src);
+    free(dst);
+  }
+
+  if (journal_nr_files <= 1)
+    unlink(journal_path);
+
+  journal_open();
+}
+
+static void journal_put_cb(EV_P_ struct botz_listen *bl,
+                           const struct botz_request *q)
+{
+  const struct n_buf *nb = &q->q_body;
+  struct journal_rec jr;
+
+  if (journal_file == NULL)
+    return;
+
+  memset(&jr, 0, sizeof(jr));
+  jr.jr_magic = JOURNAL_MAGIC;
+  jr.jr_path_len = q->q_path != NULL ? strlen(q->q_path) : 0;
+  jr.jr_query_len = q->q_query != NULL ? strlen(q->q_query) : 0;
+  jr.jr_body_len = n_buf_length(nb);
+  jr.jr_time = ev_now(EV_A);
+
+  if (fwrite(&jr, sizeof(jr), 1, journal_file) != 1 ||
+      fwrite(q->q_path, 1, jr.jr_path_len, journal_file) != jr.jr_path_len ||
+      fwrite(q->q_query, 1, jr.jr_query_len, journal_file) != jr.jr_query_len ||
+      fwrite(nb->nb_buf + nb->nb_start, 1, jr.jr_body_len, journal_file) !=
+      jr.jr_body_len) {
+    ERROR("cannot write journal `%s': %m\n", journal_path);
+    return;
+  }
+
+  if (ftello(journal_file) >= journal_max_size)
+    journal_rotate();
+}
+
+static void journal_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  if (journal_file != NULL)
+    fflush(journal_file);
+}
+
+int journal_init(EV_P_ struct botz_listen *bl, const char *path,
+                 size_t max_size, int nr_files)
+{
+  journal_path = strdup(path);
+  if (journal_path == NULL)
+    OOM();
+
+  journal_max_size = max_size;
+  journal_nr_files = nr_files;
+
+  if (journal_open() < 0)
+    return -1;
+
+  bl->bl_put_cb = &journal_put_cb;
+
+  ev_timer_init(&journal_w, &journal_timer_cb, JOURNAL_FLUSH, JOURNAL_FLUSH);
+  ev_timer_start(EV_A_ &journal_w);
+
+  return 0;
+}
+
+void journal_fini(void)
+{
+  if (journal_file != NULL)
+    fclose(journal_file);
+
+  journal_file = NULL;
+}
+
+/* FNV-1a.  State hashes are sums of per node or per pair hashes, so
+   they do not depend on hash table order. */
+static uint64_t journal_hash(const char *s, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 0x100000001b3ULL;
+  }
+
+  return h;
+}
+
+static void journal_print_hashes(FILE *file)
+{
+  uint64_t x_hash = 0, sum_hash = 0, rate_hash = 0;
+  struct hlist_node *n;
+  struct x_node *x;
+  struct k_node *k;
+  char buf[4096];
+  size_t i, j, w, nr_x = 0;
+  int len;
+
+  for (i = 0; i < NR_X_TYPES; i++) {
+    struct hash_table *t = &x_types[i].x_hash_table;
+
+    for (j = 0; j < (1ULL << t->t_shift); j++) {
+      hlist_for_each_entry(x, n, t->t_table + j, x_hash_node) {
+        len = snprintf(buf, sizeof(buf), "%s:%s %s",
+                       x->x_type->x_type_name, x->x_name,
+                       x->x_parent != NULL ? x->x_parent->x_name : "");
+        x_hash += journal_hash(buf, MIN((size_t) len, sizeof(buf) - 1));
+      }
+    }
+  }
+
+  for (j = 0; j < (1ULL << k_hash_table.t_shift); j++) {
+    hlist_for_each_entry(k, n, k_hash_table.t_table + j, k_hash_node) {
+      len = snprintf(buf, sizeof(buf), "%s:%s %s:%s "PRI_STATS_FMT("%.17g"),
+                     k->k_x[0]->x_type->x_type_name, k->k_x[0]->x_name,
+                     k->k_x[1]->x_type->x_type_name, k->k_x[1]->x_name,
+                     PRI_STATS_ARG(k->k_sum));
+      sum_hash += journal_hash(buf, MIN((size_t) len, sizeof(buf) - 1));
+
+      /* Rounded, so that reordering the arithmetic is not a change. */
+      len = snprintf(buf, sizeof(buf), "%s:%s %s:%s "PRI_STATS_FMT("%.6e"),
+                     k->k_x[0]->x_type->x_type_name, k->k_x[0]->x_name,
+                     k->k_x[1]->x_type->x_type_name, k->k_x[1]->x_name,
+                     PRI_STATS_ARG(k->k_rate));
+      for (w = 0; w < nr_k_windows && (size_t) len < sizeof(buf); w++)
+        len += snprintf(buf + len, sizeof(buf) - len,
+                        " "PRI_STATS_FMT("%.6e"), PRI_STATS_ARG(k->k_wrate[w]));
+      rate_hash += journal_hash(buf, MIN((size_t) len, sizeof(buf) - 1));
+    }
+  }
+
+  for (i = 0; i < NR_X_TYPES; i++)
+    nr_x += x_types[i].x_nr;
+
+  fprintf(file,
+          "nr_x: %zu\n"
+          "nr_k: %zu\n"
+          "x_hash: %016llx\n"
+          "sum_hash: %016llx\n"
+          "rate_hash: %016llx\n",
+          nr_x, nr_k,
+          (unsigned long long) x_hash,
+          (unsigned long long) sum_hash,
+          (unsigned long long) rate_hash);
+}
+
+int journal_replay(EV_P_ struct botz_listen *bl, const char *path,
+                   double speed)
+{
+  struct botz_request q;
+  struct botz_response r;
+  struct n_buf q_path = { }, q_query = { };
+  unsigned long long nr_rec = 0, nr_err = 0, nr_line = 0, nr_byte = 0;
+  double w0 = perf_now(), t0 = 0, t1 = 0, sec;
+  char *m = MAP_FAILED, *p, *end;
+  size_t size = 0;
+  struct stat st;
+  int fd = -1, rc = -1;
+
+  memset(&q, 0, sizeof(q));
+  memset(&r, 0, sizeof(r));
+
+  if (n_buf_init(&r.r_body, JOURNAL_R_BODY_SIZE) < 0)
+    OOM();
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    ERROR("cannot open journal `%s': %m\n", path);
+    goto out;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    ERROR("cannot stat journal `%s': %m\n", path);
+    goto out;
+  }
+
+  size = st.st_size;
+  if (size == 0)
+    goto done;
+
+  m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (m == MAP_FAILED) {
+    ERROR("cannot map journal `%s': %m\n", path);
+    goto out;
+  }
+
+  madvise(m, size, MADV_SEQUENTIAL);
+
+  p = m;
+  end = m + size;
+
+  while (p < end) {
+    struct journal_rec jr;
+    char *s;
+
+    if (end - p < sizeof(jr))
+      goto bad;
+
+    memcpy(&jr, p, sizeof(jr));
+    p += sizeof(jr);
+
+    if (jr.jr_magic != JOURNAL_MAGIC ||
+        end - p < (size_t) jr.jr_path_len + jr.jr_query_len + jr.jr_body_len)
+      goto bad;
+
+    /* Handlers parse (and so modify) path, query, and body in place. */
+    n_buf_clear(&q_path);
+    n_buf_clear(&q_query);
+    n_buf_clear(&q.q_body);
+
+    if (n_buf_reserve(&q_path, jr.jr_path_len + 1) < 0 ||
+        n_buf_reserve(&q_query, jr.jr_query_len + 1) < 0 ||
+        n_buf_reserve(&q.q_body, jr.jr_body_len + 1) < 0)
+      OOM();
+
+    memcpy(q_path.nb_buf, p, jr.jr_path_len);
+    q_path.nb_buf[jr.jr_path_len] = 0;
+    p += jr.jr_path_len;
+
+    memcpy(q_query.nb_buf, p, jr.jr_query_len);
+    q_query.nb_buf[jr.jr_query_len] = 0;
+    p += jr.jr_query_len;
+
+    memcpy(q.q_body.nb_buf, p, jr.jr_body_len);
+    q.q_body.nb_end = jr.jr_body_len;
+    p += jr.jr_body_len;
+
+    for (s = q.q_body.nb_buf; (s = memchr(s, '\n', q.q_body.nb_buf +
+                                          jr.jr_body_len - s)) != NULL; s++)
+      nr_line++;
+
+    if (nr_rec == 0)
+      t0 = jr.jr_time;
+    t1 = jr.jr_time;
+
+    if (speed > 0) {
+      double d = w0 + (jr.jr_time - t0) / speed - perf_now();
+
+      if (d > 0) {
+        struct timespec ts = {
+          .tv_sec = d,
+          .tv_nsec = (d - (time_t) d) * 1e9,
+        };
+        nanosleep(&ts, NULL);
+      }
+    }
+
+    q.q_path = q_path.nb_buf;
+    q.q_query = jr.jr_query_len > 0 ? q_query.nb_buf : NULL;
+    q.q_method = BOTZ_PUT;
+    r.r_status = 0;
+    n_buf_clear(&r.r_body);
+
+    x_clock = jr.jr_time;
+    botz_handle(EV_A_ bl, &q, &r);
+
+    if (r.r_status >= 400)
+      nr_err++;
+
+    nr_rec++;
+    nr_byte += jr.jr_body_len;
+  }
+
+  if (0) {
+  bad:
+    ERROR("invalid journal `%s' at offset %zu, after %llu records\n",
+          path, (size_t) (p - m), nr_rec);
+  }
+
+ done:
+  sec = perf_now() - w0;
+
+  printf("records: %llu\n"
+         "lines: %llu\n"
+         "bytes: %llu\n"
+         "errors: %llu\n"
+         "span: %f\n"
+         "seconds: %f\n"
+         "records_per_sec: %f\n"
+         "lines_per_sec: %f\n",
+         nr_rec, nr_line, nr_byte, nr_err, t1 - t0, sec,
+         sec > 0 ? nr_rec / sec : 0, sec > 0 ? nr_line / sec : 0);
+
+  journal_print_hashes(stdout);
+
+  rc = 0;
+
+ out:
+  x_clock = 0;
+
+  free(q_path.nb_buf);
+  free(q_query.nb_buf);
+  free(q.q_body.nb_buf);
+  free(r.r_body.nb_buf);
+
+  if (m != MAP_FAILED)
+    munmap(m, size);
+
+  if (fd >= 0)
+    close(fd);
+
+  return rc;
+}
@@ -0,0 +1,21 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+#include <stddef.h>
+#include <ev.h>
+
+struct botz_listen;
+
+/* Append each PUT to bl to path, moving it to path.1 (and so on up to
+   path.(nr_files - 1)) when it grows past max_size bytes. */
+int journal_init(EV_P_ struct botz_listen *bl, const char *path,
+                 size_t max_size, int nr_files);
+
+void journal_fini(void);
+
+/* Feed the PUTs in path to bl with x_clock set to their time, as fast
+   as possible if speed is 0, else at speed times their pace.  Prints
+   throughput and hashes of the resulting state to stdout. */
+int journal_replay(EV_P_ struct botz_listen *bl, const char *path,
+                   double speed);
+
+#endif
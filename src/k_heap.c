@@ -164,7 +164,7 @@ int k_top_cmp(struct k_heap *h, struct k_node *k0, struct k_node *k1)
   size_t i;
 
   for (i = 0; i < T_SPEC_LEN; i++) {
-    if (!(t->t_spec[i] < sizeof(struct k_node)))
+    if (!(t->t_spec[i] < K_NODE_SIZE))
       break;
 
     double v0 = *(double *) (((char *) k0) + t->t_spec[i]);
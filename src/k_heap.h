@@ -17,6 +17,26 @@ struct k_top {
 
 #define T_SPEC_LEN (sizeof(t->t_spec) / sizeof(t->t_spec[0]))
 
+/* Default sort: rates, then sums, then pending. */
+static inline void k_top_spec_init(struct k_top *t)
+{
+  size_t i, n = 0;
+
+  memset(t, 0, sizeof(*t));
+
+  for (i = 0; i < NR_STATS && n < T_SPEC_LEN; i++)
+    t->t_spec[n++] = offsetof(struct k_node, k_rate[i]);
+
+  for (i = 0; i < NR_STATS && n < T_SPEC_LEN; i++)
+    t->t_spec[n++] = offsetof(struct k_node, k_sum[i]);
+
+  for (i = 0; i < NR_STATS && n < T_SPEC_LEN; i++)
+    t->t_spec[n++] = offsetof(struct k_node, k_pending[i]);
+
+  if (n < T_SPEC_LEN)
+    t->t_spec[n++] = offsetof(struct k_node, k_t);
+}
+
 /* k_heap_filt_t: Return > 0 to traverse/enqueue this node and all
    below; 0 to enqueue traverse/enqueue this node and call filt on
    descendents, < 0 to ignode this node. */
@@ -0,0 +1,841 @@
+#include "stddef1.h"
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ev.h>
+#include "xltop.h"
+#include "curl_x.h"
+#include "n_buf.h"
+#include "string1.h"
+#include "trace.h"
+
+/* xltop-load: synthetic load for a (test) master.  Simulates servds
+   reporting to /serv/NAME/_report on the schedule the master hands
+   out, clusds PUTting host to job maps with job churn to /clus/NAME,
+   and xltop clients polling /top and /fs/NAME/_status, all from one
+   loop.  On exit prints per endpoint counts, errors, requests skipped
+   (because the last one was still in flight or max_requests were),
+   throughput, and latency percentiles.
+
+   Servers, filesystems, and cluster domains are taken from the
+   master.  For stats lines to land on the hosts of the job maps, give
+   the master's lnet file as --nids; otherwise NIDs and host names are
+   made up and the master files the NIDs under the default cluster. */
+
+#define LOAD_DURATION 60.0
+#define LOAD_NR_HOSTS 4096
+#define LOAD_NR_TARGETS 8
+#define LOAD_NR_LINES 64 /* Per target per report. */
+#define LOAD_NR_CLIENTS 100
+#define LOAD_CLIENT_INTERVAL 5.0
+#define LOAD_CLUS_INTERVAL 30.0
+#define LOAD_JOB_SIZE 16
+#define LOAD_CHURN 0.1
+#define LOAD_MAX_REQ 512
+
+#define LOAD_EPS(X) \
+  X(serv_report)    \
+  X(clus_put)       \
+  X(top)            \
+  X(fs_status)
+
+enum {
+#define X(name) EP_ ## name,
+  LOAD_EPS(X)
+#undef X
+  NR_EPS,
+};
+
+struct load_ep {
+  const char *ep_name;
+  double *ep_lat; /* Seconds, of each 2xx response. */
+  size_t ep_nr_lat, ep_lat_size;
+  unsigned long long ep_nr_err, ep_nr_skip, ep_bytes_out, ep_bytes_in;
+};
+
+static struct load_ep load_ep[NR_EPS] = {
+#define X(name) [EP_ ## name] = { .ep_name = #name },
+  LOAD_EPS(X)
+#undef X
+};
+
+/* A request in flight. */
+struct load_req {
+  int r_ep;
+  double r_t0;
+  int *r_busy;
+  void (*r_done)(EV_P_ struct load_req *, struct curl_x_req *, int);
+  void *r_data;
+};
+
+struct load_host {
+  char *h_name, *h_nid;
+  size_t h_job;
+};
+
+struct load_serv {
+  char *ls_name;
+  size_t ls_target0; /* Target names are global. */
+  double ls_interval, ls_offset; /* From the master. */
+  struct ev_timer ls_w;
+  int ls_busy;
+};
+
+struct load_clus {
+  char *lc_name;
+  size_t *lc_host, lc_nr_host; /* Indexes into load_host. */
+  size_t lc_next_job;
+  struct ev_timer lc_w;
+  int lc_busy;
+};
+
+struct load_client {
+  struct ev_timer lx_w;
+  size_t lx_nr_poll;
+  int lx_busy[2];
+};
+
+static struct curl_x curl_x;
+
+static struct load_host *load_host;
+static size_t nr_load_host;
+static struct load_serv *load_serv;
+static size_t nr_load_serv;
+static struct load_clus *load_clus;
+static size_t nr_load_clus;
+static struct load_client *load_client;
+static size_t nr_load_client;
+static char **load_fs;
+static size_t nr_load_fs;
+
+static size_t nr_targets = LOAD_NR_TARGETS, nr_lines = LOAD_NR_LINES;
+static double serv_interval; /* 0 to use the master's. */
+static double clus_interval = LOAD_CLUS_INTERVAL;
+static double client_interval = LOAD_CLIENT_INTERVAL;
+static size_t job_size = LOAD_JOB_SIZE;
+static double churn = LOAD_CHURN;
+static double load_t0;
+
+static const char *load_views[] = {
+  "x0=u:ALL&x1=v:ALL&d0=1&d1=1&limit=40", /* Jobs to filesystems. */
+  "x0=u:ALL&x1=v:ALL&d0=1&d1=2&limit=40", /* Jobs to servers. */
+  "x0=u:ALL&x1=v:ALL&d0=0&d1=1&limit=40", /* Hosts to filesystems. */
+  "x0=u:ALL&x1=v:ALL&d0=1&d1=3&limit=40", /* Jobs to targets. */
+};
+
+#define NR_LOAD_VIEWS (sizeof(load_views) / sizeof(load_views[0]))
+
+static void load_ep_add(int i, double lat)
+{
+  struct load_ep *ep = &load_ep[i];
+
+  if (ep->ep_nr_lat == ep->ep_lat_size) {
+    size_t size = MAX(2 * ep->ep_lat_size, (size_t) 4096);
+    double *lat_v = realloc(ep->ep_lat, size * sizeof(lat_v[0]));
+
+    if (lat_v == NULL)
+      OOM();
+
+    ep->ep_lat = lat_v;
+    ep->ep_lat_size = size;
+  }
+
+  ep->ep_lat[ep->ep_nr_lat++] = lat;
+}
+
+static void load_req_cb(struct curl_x_req *xr, int rc)
+{
+  struct load_req *r = xr->xr_data;
+  struct load_ep *ep = &load_ep[r->r_ep];
+
+  *r->r_busy = 0;
+
+  if (rc < 0) {
+    TRACE("%s: request to `%s' failed: %s\n",
+          ep->ep_name, xr->xr_url, xr->xr_error);
+    ep->ep_nr_err++;
+  } else {
+    load_ep_add(r->r_ep, ev_time() - r->r_t0);
+    ep->ep_bytes_in += n_buf_length(&xr->xr_nb[1]);
+  }
+
+  if (r->r_done != NULL)
+    (*r->r_done)(xr->xr_cx->cx_loop, r, xr, rc);
+
+  free(r);
+}
+
+/* Send body (GET if NULL) for endpoint i unless *busy.  The request
+   takes over body's buffer. */
+static void load_req(int i, int *busy, const char *path, const char *query,
+                     struct n_buf *body,
+                     void (*done)(EV_P_ struct load_req *,
+                                  struct curl_x_req *, int),
+                     void *data)
+{
+  struct load_ep *ep = &load_ep[i];
+  size_t len = body != NULL ? n_buf_length(body) : 0;
+  struct load_req *r;
+  int rc;
+
+  if (*busy)
+    goto skip;
+
+  r = malloc(sizeof(*r));
+  if (r == NULL)
+    OOM();
+
+  r->r_ep = i;
+  r->r_t0 = ev_time();
+  r->r_busy = busy;
+  r->r_done = done;
+  r->r_data = data;
+
+  if (body != NULL)
+    rc = curl_x_put_async(&curl_x, path, query, body, &load_req_cb, r);
+  else
+    rc = curl_x_get_async(&curl_x, path, query, &load_req_cb, r);
+
+  if (rc < 0) {
+    free(r);
+    if (errno != EBUSY)
+      ERROR("cannot start request to `%s': %m\n", path);
+    goto skip;
+  }
+
+  *busy = 1;
+  ep->ep_bytes_out += len;
+
+  return;
+
+ skip:
+  ep->ep_nr_skip++;
+  if (body != NULL)
+    free(body->nb_buf);
+}
+
+/* Servers. */
+
+static void serv_schedule(EV_P_ struct load_serv *ls)
+{
+  double now = ev_now(EV_A), next;
+
+  next = floor(now / ls->ls_interval) * ls->ls_interval + ls->ls_offset;
+  while (next <= now)
+    next += ls->ls_interval;
+
+  ev_timer_set(&ls->ls_w, next - now, 0);
+  ev_timer_start(EV_A_ &ls->ls_w);
+}
+
+static void serv_done(EV_P_ struct load_req *r, struct curl_x_req *xr, int rc)
+{
+  struct load_serv *ls = r->r_data;
+  double interval, offset;
+  char *buf;
+
+  if (rc < 0 || serv_interval > 0)
+    return;
+
+  if (n_buf_reserve(&xr->xr_nb[1], 1) < 0)
+    return;
+
+  buf = xr->xr_nb[1].nb_buf + xr->xr_nb[1].nb_start;
+  buf[n_buf_length(&xr->xr_nb[1])] = 0;
+
+  if (sscanf(buf, "%lf %lf", &interval, &offset) == 2 && interval > 0) {
+    ls->ls_interval = interval;
+    ls->ls_offset = offset;
+  }
+}
+
+static void serv_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  struct load_serv *ls = container_of(w, struct load_serv, ls_w);
+  struct serv_status ss;
+  char path[4096];
+  size_t i, j;
+  N_BUF(nb);
+
+  memset(&ss, 0, sizeof(ss));
+  ss.ss_time = ev_now(EV_A);
+  ss.ss_uptime = ev_now(EV_A) - load_t0;
+  ss.ss_nr_ost = nr_targets;
+  ss.ss_nr_nid = nr_load_host;
+  ss.ss_interval = ls->ls_interval;
+
+  if (n_buf_init(&nb, 64 + nr_targets * (32 + nr_lines * 64)) < 0)
+    OOM();
+
+  n_buf_printf(&nb, PRI_SERV_STATUS_FMT"\n", PRI_SERV_STATUS_ARG(ss));
+
+  for (i = 0; i < nr_targets; i++) {
+    n_buf_printf(&nb, "%sOST%04zx\n", XLTOP_TARGET_PREFIX, ls->ls_target0 + i);
+
+    for (j = 0; j < nr_lines && nr_load_host > 0; j++) {
+      struct load_host *h = &load_host[random() % nr_load_host];
+
+      n_buf_printf(&nb, "%s %ld %ld %ld\n", h->h_nid,
+                   random() % (1 << 24), random() % (1 << 24),
+                   random() % 1024);
+    }
+  }
+
+  snprintf(path, sizeof(path), "serv/%s/_report", ls->ls_name);
+  load_req(EP_serv_report, &ls->ls_busy, path, NULL, &nb, &serv_done, ls);
+
+  serv_schedule(EV_A_ ls);
+}
+
+/* Clusters. */
+
+static void clus_remap(struct load_clus *lc)
+{
+  size_t i, j, n;
+
+  /* End about churn of the jobs by moving their hosts to new jobs
+     of up to job_size hosts. */
+  for (i = 0; i < lc->lc_nr_host; i = j) {
+    struct load_host *h = &load_host[lc->lc_host[i]];
+
+    for (j = i + 1; j < lc->lc_nr_host; j++)
+      if (load_host[lc->lc_host[j]].h_job != h->h_job)
+        break;
+
+    if (h->h_job != 0 && drand48() >= churn)
+      continue;
+
+    for (n = 0; i < j; i++, n--) {
+      if (n == 0) {
+        n = 1 + random() % job_size;
+        lc->lc_next_job++;
+      }
+      load_host[lc->lc_host[i]].h_job = lc->lc_next_job;
+    }
+  }
+}
+
+static void clus_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  struct load_clus *lc = container_of(w, struct load_clus, lc_w);
+  char path[4096];
+  size_t i;
+  N_BUF(nb);
+
+  clus_remap(lc);
+
+  if (n_buf_init(&nb, 64 + lc->lc_nr_host * 128) < 0)
+    OOM();
+
+  for (i = 0; i < lc->lc_nr_host; i++) {
+    struct load_host *h = &load_host[lc->lc_host[i]];
+
+    n_buf_printf(&nb, "%s %zu@%s u%zu job%zu %.0f\n", h->h_name,
+                 h->h_job, lc->lc_name, h->h_job % 97, h->h_job,
+                 load_t0);
+  }
+
+  snprintf(path, sizeof(path), "clus/%s", lc->lc_name);
+  load_req(EP_clus_put, &lc->lc_busy, path, NULL, &nb, NULL, NULL);
+}
+
+/* Clients. */
+
+static void client_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  struct load_client *lx = container_of(w, struct load_client, lx_w);
+  char path[4096];
+
+  load_req(EP_top, &lx->lx_busy[0], "top",
+           load_views[lx->lx_nr_poll % NR_LOAD_VIEWS], NULL, NULL, NULL);
+
+  if (nr_load_fs > 0) {
+    snprintf(path, sizeof(path), "fs/%s/_status",
+             load_fs[lx->lx_nr_poll % nr_load_fs]);
+    load_req(EP_fs_status, &lx->lx_busy[1], path, NULL, NULL, NULL, NULL);
+  }
+
+  lx->lx_nr_poll++;
+}
+
+/* Setup. */
+
+/* Names from GET /TYPE/_hash ("INDEX NAME" lines). */
+static size_t load_get_names(const char *path, char ***names)
+{
+  size_t nr = 0, size = 0;
+  char *msg, *name;
+  size_t msg_len;
+  N_BUF(nb);
+
+  *names = NULL;
+
+  if (n_buf_init(&nb, 1048576) < 0)
+    OOM();
+
+  if (curl_x_get(&curl_x, path, NULL, &nb) < 0)
+    FATAL("cannot get `%s' from master\n", path);
+
+  while (n_buf_get_msg(&nb, &msg, &msg_len) == 0) {
+    if (wsep(&msg) == NULL || (name = wsep(&msg)) == NULL)
+      continue;
+
+    if (nr == size) {
+      size = MAX(2 * size, (size_t) 64);
+      *names = realloc(*names, size * sizeof(**names));
+      if (*names == NULL)
+        OOM();
+    }
+
+    (*names)[nr] = strdup(name);
+    if ((*names)[nr] == NULL)
+      OOM();
+    nr++;
+  }
+
+  free(nb.nb_buf);
+
+  return nr;
+}
+
+static void load_add_host(const char *nid, const char *name)
+{
+  static size_t size;
+  struct load_host *h;
+
+  if (nr_load_host == size) {
+    size = MAX(2 * size, (size_t) 4096);
+    load_host = realloc(load_host, size * sizeof(load_host[0]));
+    if (load_host == NULL)
+      OOM();
+  }
+
+  h = &load_host[nr_load_host++];
+  h->h_nid = strdup(nid);
+  h->h_name = strdup(name);
+  h->h_job = 0;
+
+  if (h->h_nid == NULL || h->h_name == NULL)
+    OOM();
+}
+
+/* Lines "NID [HOST]" as in the master's lnet files. */
+static void load_read_nids(const char *path)
+{
+  FILE *file;
+  char *line = NULL, *s, *nid, *name;
+  size_t line_size = 0;
+
+  file = fopen(path, "r");
+  if (file == NULL)
+    FATAL("cannot open `%s': %m\n", path);
+
+  while (getline(&line, &line_size, file) >= 0) {
+    s = line;
+    nid = wsep(&s);
+    if (nid == NULL || *nid == '#')
+      continue;
+
+    name = wsep(&s);
+    load_add_host(nid, name != NULL ? name : nid);
+  }
+
+  free(line);
+  fclose(file);
+}
+
+/* Give each cluster the hosts in its domains, making hosts up in
+   them if there was no NID file. */
+static void load_clus_init(size_t nr_hosts)
+{
+  char *msg, *domain, *name, **dom_clus = NULL, **dom = NULL;
+  size_t i, j, nr_dom = 0, msg_len;
+  N_BUF(nb);
+
+  if (n_buf_init(&nb, 1048576) < 0)
+    OOM();
+
+  if (curl_x_get(&curl_x, "_domains", NULL, &nb) < 0)
+    FATAL("cannot get `%s' from master\n", "_domains");
+
+  while (n_buf_get_msg(&nb, &msg, &msg_len) == 0) {
+    domain = wsep(&msg);
+    name = wsep(&msg);
+    if (domain == NULL || name == NULL)
+      continue;
+
+    dom = realloc(dom, (nr_dom + 1) * sizeof(dom[0]));
+    dom_clus = realloc(dom_clus, (nr_dom + 1) * sizeof(dom_clus[0]));
+    if (dom == NULL || dom_clus == NULL)
+      OOM();
+
+    dom[nr_dom] = strdup(domain);
+    dom_clus[nr_dom] = strdup(name);
+    nr_dom++;
+
+    for (i = 0; i < nr_load_clus; i++)
+      if (strcmp(load_clus[i].lc_name, name) == 0)
+        break;
+
+    if (i < nr_load_clus)
+      continue;
+
+    load_clus = realloc(load_clus, (nr_load_clus + 1) * sizeof(load_clus[0]));
+    if (load_clus == NULL)
+      OOM();
+
+    memset(&load_clus[nr_load_clus], 0, sizeof(load_clus[0]));
+    load_clus[nr_load_clus].lc_name = strdup(name);
+    nr_load_clus++;
+  }
+
+  free(nb.nb_buf);
+
+  if (nr_load_host == 0) {
+    char nid[64], host[4096];
+
+    for (i = 0; i < nr_hosts; i++) {
+      snprintf(nid, sizeof(nid), "10.%zu.%zu.%zu@o2ib",
+               (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+      if (nr_dom > 0)
+        snprintf(host, sizeof(host), "c%zu.%s", i, dom[i % nr_dom]);
+      else
+        snprintf(host, sizeof(host), "c%zu", i);
+      load_add_host(nid, host);
+    }
+  }
+
+  for (i = 0; i < nr_load_host; i++) {
+    const char *h = load_host[i].h_name;
+    struct load_clus *lc = NULL;
+
+    for (j = 0; j < nr_dom && lc == NULL; j++) {
+      size_t h_len = strlen(h), d_len = strlen(dom[j]);
+
+      if (h_len > d_len && h[h_len - d_len - 1] == '.' &&
+          strcmp(h + h_len - d_len, dom[j]) == 0) {
+        size_t k;
+
+        for (k = 0; k < nr_load_clus; k++)
+          if (strcmp(load_clus[k].lc_name, dom_clus[j]) == 0)
+            lc = &load_clus[k];
+      }
+    }
+
+    if (lc == NULL)
+      continue;
+
+    lc->lc_host = realloc(lc->lc_host,
+                          (lc->lc_nr_host + 1) * sizeof(lc->lc_host[0]));
+    if (lc->lc_host == NULL)
+      OOM();
+
+    lc->lc_host[lc->lc_nr_host++] = i;
+  }
+
+  for (i = 0; i < nr_dom; i++) {
+    free(dom[i]);
+    free(dom_clus[i]);
+  }
+  free(dom);
+  free(dom_clus);
+}
+
+/* Report. */
+
+static int load_cmp(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double load_pct(const struct load_ep *ep, double p)
+{
+  size_t i;
+
+  if (ep->ep_nr_lat == 0)
+    return 0;
+
+  i = ceil(p * ep->ep_nr_lat);
+  i = i > 0 ? i - 1 : 0;
+
+  return ep->ep_lat[MIN(i, ep->ep_nr_lat - 1)];
+}
+
+static void load_report(double sec)
+{
+  size_t i;
+
+  printf("%-12s %9s %7s %7s %9s %9s %9s %8s %8s %8s %8s\n",
+         "ENDPOINT", "COUNT", "ERRORS", "SKIPPED", "REQ/S", "KB_OUT/S",
+         "KB_IN/S", "P50_MS", "P90_MS", "P99_MS", "MAX_MS");
+
+  for (i = 0; i < NR_EPS; i++) {
+    struct load_ep *ep = &load_ep[i];
+
+    qsort(ep->ep_lat, ep->ep_nr_lat, sizeof(ep->ep_lat[0]), &load_cmp);
+
+    printf("%-12s %9zu %7llu %7llu %9.1f %9.1f %9.1f %8.2f %8.2f %8.2f %8.2f\n",
+           ep->ep_name, ep->ep_nr_lat, ep->ep_nr_err, ep->ep_nr_skip,
+           ep->ep_nr_lat / sec,
+           ep->ep_bytes_out / sec / 1024, ep->ep_bytes_in / sec / 1024,
+           1000 * load_pct(ep, 0.50), 1000 * load_pct(ep, 0.90),
+           1000 * load_pct(ep, 0.99), 1000 * load_pct(ep, 1.0));
+  }
+}
+
+static void end_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  ev_break(EV_A_ EVBREAK_ALL);
+}
+
+static void sigint_cb(EV_P_ ev_signal *w, int revents)
+{
+  ev_break(EV_A_ EVBREAK_ALL);
+}
+
+static void print_help(void)
+{
+  const char *p = program_invocation_short_name;
+
+  printf("Usage: %s [OPTION]...\n"
+	 "Mandatory arguments to long options are mandatory for short options too.\n"
+	 " -C, --clients=N             simulate N polling xltop clients (default %d)\n"
+	 " -c, --churn=FRACTION        end FRACTION of the jobs at each remap (default %.2f)\n"
+	 " -d, --duration=SECONDS      run for SECONDS (default %.0f)\n"
+	 " -H, --hosts=N               make up N hosts if no NID file (default %d)\n"
+	 " -h, --help                  display this help and exit\n"
+	 " -I, --client-interval=SECONDS\n"
+	 "                             poll every SECONDS (default %.0f)\n"
+	 " -i, --interval=SECONDS      report every SECONDS (default the master's)\n"
+	 " -J, --job-size=N            start jobs of up to N hosts (default %d)\n"
+	 " -K, --clus-interval=SECONDS remap hosts to jobs every SECONDS (default %.0f)\n"
+	 " -l, --lines=N               send N NID lines per target (default %d)\n"
+	 " -m, --master=HOST-OR-ADDR   connect to master on HOST-OR-ADDR (default %s)\n"
+	 " -n, --nids=FILE             take NIDs and hosts from FILE (an lnet file)\n"
+	 " -p, --port=PORT             connect to master at PORT (default %s)\n"
+	 " -q, --max-requests=N        keep at most N requests in flight (default %d)\n"
+	 " -s, --servs=N               simulate at most N of the master's servers\n"
+	 " -t, --targets=N             report N targets per server (default %d)\n"
+	 " -v, --version               display version information and exit\n"
+	 " -z, --compress              gzip PUT bodies\n"
+	 "\nReport %s bugs to <%s>.\n"
+	 , p, LOAD_NR_CLIENTS, LOAD_CHURN, LOAD_DURATION, LOAD_NR_HOSTS,
+	 LOAD_CLIENT_INTERVAL, LOAD_JOB_SIZE, LOAD_CLUS_INTERVAL,
+	 LOAD_NR_LINES, str_or(XLTOP_MASTER, "NONE"), XLTOP_PORT,
+	 LOAD_MAX_REQ, LOAD_NR_TARGETS, p, PACKAGE_BUGREPORT);
+}
+
+static void print_version(void)
+{
+  printf("%s (%s) %s\n", program_invocation_short_name,
+	 PACKAGE_NAME, PACKAGE_VERSION);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *m_host = XLTOP_MASTER, *m_port = XLTOP_PORT;
+  const char *nid_path = NULL;
+  double duration = LOAD_DURATION;
+  size_t nr_hosts = LOAD_NR_HOSTS, max_servs = (size_t) -1;
+  size_t max_req = LOAD_MAX_REQ;
+  char **serv_names;
+  int want_compress = 0;
+  size_t i;
+
+  nr_load_client = LOAD_NR_CLIENTS;
+
+  struct option opts[] = {
+    { "clients",         1, NULL, 'C' },
+    { "churn",           1, NULL, 'c' },
+    { "duration",        1, NULL, 'd' },
+    { "hosts",           1, NULL, 'H' },
+    { "help",            0, NULL, 'h' },
+    { "client-interval", 1, NULL, 'I' },
+    { "interval",        1, NULL, 'i' },
+    { "job-size",        1, NULL, 'J' },
+    { "clus-interval",   1, NULL, 'K' },
+    { "lines",           1, NULL, 'l' },
+    { "master",          1, NULL, 'm' },
+    { "nids",            1, NULL, 'n' },
+    { "port",            1, NULL, 'p' },
+    { "max-requests",    1, NULL, 'q' },
+    { "servs",           1, NULL, 's' },
+    { "targets",         1, NULL, 't' },
+    { "version",         0, NULL, 'v' },
+    { "compress",        0, NULL, 'z' },
+    { NULL,              0, NULL,  0  },
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "C:c:d:H:hI:i:J:K:l:m:n:p:q:s:t:vz",
+                          opts, 0)) > 0) {
+    switch (c) {
+    case 'C':
+      nr_load_client = strtoul(optarg, NULL, 0);
+      break;
+    case 'c':
+      churn = strtod(optarg, NULL);
+      break;
+    case 'd':
+      duration = strtod(optarg, NULL);
+      if (duration <= 0)
+        FATAL("invalid duration `%s'\n", optarg);
+      break;
+    case 'H':
+      nr_hosts = strtoul(optarg, NULL, 0);
+      break;
+    case 'h':
+      print_help();
+      exit(EXIT_SUCCESS);
+    case 'I':
+      client_interval = strtod(optarg, NULL);
+      if (client_interval <= 0)
+        FATAL("invalid client interval `%s'\n", optarg);
+      break;
+    case 'i':
+      serv_interval = strtod(optarg, NULL);
+      if (serv_interval <= 0)
+        FATAL("invalid interval `%s'\n", optarg);
+      break;
+    case 'J':
+      job_size = strtoul(optarg, NULL, 0);
+      if (job_size == 0)
+        FATAL("invalid job size `%s'\n", optarg);
+      break;
+    case 'K':
+      clus_interval = strtod(optarg, NULL);
+      if (clus_interval <= 0)
+        FATAL("invalid cluster interval `%s'\n", optarg);
+      break;
+    case 'l':
+      nr_lines = strtoul(optarg, NULL, 0);
+      break;
+    case 'm':
+      m_host = optarg;
+      break;
+    case 'n':
+      nid_path = optarg;
+      break;
+    case 'p':
+      m_port = optarg;
+      break;
+    case 'q':
+      max_req = strtoul(optarg, NULL, 0);
+      if (max_req == 0)
+        FATAL("invalid max requests `%s'\n", optarg);
+      break;
+    case 's':
+      max_servs = strtoul(optarg, NULL, 0);
+      break;
+    case 't':
+      nr_targets = strtoul(optarg, NULL, 0);
+      break;
+    case 'v':
+      print_version();
+      exit(EXIT_SUCCESS);
+    case 'z':
+      want_compress = 1;
+      break;
+    case '?':
+      FATAL("Try `%s --help' for more information.\n", program_invocation_short_name);
+    }
+  }
+
+  if (!str_is_set(m_host))
+    FATAL("no host or address specified for master\n");
+
+  if (!str_is_set(m_port))
+    FATAL("no port specified for master\n");
+
+  srandom(1);
+  srand48(1);
+
+  int curl_rc = curl_global_init(CURL_GLOBAL_NOTHING);
+  if (curl_rc != 0)
+    FATAL("cannot initialize curl: %s\n", curl_easy_strerror(curl_rc));
+
+  if (curl_x_init(&curl_x, m_host, m_port) < 0)
+    FATAL("cannot initialize curl handle: %m\n");
+
+  curl_x.cx_put_gzip = want_compress;
+
+  if (nid_path != NULL)
+    load_read_nids(nid_path);
+
+  load_clus_init(nr_hosts);
+
+  nr_load_serv = load_get_names("serv/_hash", &serv_names);
+  nr_load_serv = MIN(nr_load_serv, max_servs);
+  nr_load_fs = load_get_names("fs/_hash", &load_fs);
+
+  load_serv = calloc(nr_load_serv, sizeof(load_serv[0]));
+  load_client = calloc(nr_load_client, sizeof(load_client[0]));
+  if ((load_serv == NULL && nr_load_serv > 0) ||
+      (load_client == NULL && nr_load_client > 0))
+    OOM();
+
+  printf("servs %zu, targets %zu, hosts %zu, clusters %zu, clients %zu\n",
+         nr_load_serv, nr_load_serv * nr_targets, nr_load_host,
+         nr_load_clus, nr_load_client);
+
+  if (curl_x_async_init(EV_DEFAULT_ &curl_x, max_req) < 0)
+    FATAL("cannot initialize curl multi handle: %m\n");
+
+  load_t0 = ev_now(EV_DEFAULT);
+
+  /* Spread the first reports, polls, and remaps over their intervals. */
+  for (i = 0; i < nr_load_serv; i++) {
+    struct load_serv *ls = &load_serv[i];
+    double interval = serv_interval > 0 ? serv_interval : 10;
+
+    ls->ls_name = serv_names[i];
+    ls->ls_target0 = i * nr_targets;
+    ls->ls_interval = interval;
+    ls->ls_offset = drand48() * interval;
+    ev_init(&ls->ls_w, &serv_timer_cb);
+    serv_schedule(EV_DEFAULT_ ls);
+  }
+
+  for (i = 0; i < nr_load_clus; i++) {
+    struct load_clus *lc = &load_clus[i];
+
+    ev_timer_init(&lc->lc_w, &clus_timer_cb,
+                  drand48() * clus_interval, clus_interval);
+    ev_timer_start(EV_DEFAULT_ &lc->lc_w);
+  }
+
+  for (i = 0; i < nr_load_client; i++) {
+    struct load_client *lx = &load_client[i];
+
+    lx->lx_nr_poll = i;
+    ev_timer_init(&lx->lx_w, &client_timer_cb,
+                  drand48() * client_interval, client_interval);
+    ev_timer_start(EV_DEFAULT_ &lx->lx_w);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  static struct ev_signal sigint_w;
+  ev_signal_init(&sigint_w, &sigint_cb, SIGINT);
+  ev_signal_start(EV_DEFAULT_ &sigint_w);
+
+  static struct ev_timer end_w;
+  ev_timer_init(&end_w, &end_cb, duration, 0);
+  ev_timer_start(EV_DEFAULT_ &end_w);
+
+  ev_run(EV_DEFAULT_ 0);
+
+  ev_now_update(EV_DEFAULT);
+  load_report(ev_now(EV_DEFAULT) - load_t0);
+
+  curl_x_destroy(&curl_x);
+  curl_global_cleanup();
+
+  return 0;
+}
@@ -0,0 +1,304 @@
+#include <string.h>
+#include "lstats.h"
+#include "xltop.h"
+
+/* Lines look like
+
+     NAME COUNT samples [UNIT] [MIN MAX SUM [SUMSQ]]
+
+   with runs of spaces between fields.  Counter names are matched by
+   length and then compared in place; only COUNT, and SUM for the byte
+   counters, are converted. */
+
+static inline const char *ls_skip_space(const char *s, const char *end)
+{
+  while (s < end && (*s == ' ' || *s == '\t'))
+    s++;
+
+  return s;
+}
+
+static inline const char *ls_skip_word(const char *s, const char *end)
+{
+  while (s < end && *s != ' ' && *s != '\t' && *s != '\n')
+    s++;
+
+  return s;
+}
+
+static inline const char *ls_parse_int(const char *s, const char *end,
+                                       int64_t *v)
+{
+  int64_t x = 0;
+
+  for (; s < end && (unsigned) (*s - '0') < 10; s++)
+    x = 10 * x + (*s - '0');
+
+  *v = x;
+
+  return s;
+}
+
+#define LS_EQ(s, n, lit) \
+  ((n) == sizeof(lit) - 1 && memcmp((s), (lit), sizeof(lit) - 1) == 0)
+
+void lstats_parse(int64_t *stats, const char *s, size_t len)
+{
+  const char *end = s + len, *eol, *name, *unit;
+  size_t name_len, unit_len;
+  int64_t count, sum;
+  int i;
+
+  for (; s < end; s = eol + 1) {
+    eol = memchr(s, '\n', end - s);
+    if (eol == NULL)
+      eol = end;
+
+    name = ls_skip_space(s, eol);
+    s = ls_skip_word(name, eol);
+    name_len = s - name;
+
+    if (name_len == 0 || LS_EQ(name, name_len, "ping"))
+      continue;
+
+    s = ls_skip_space(s, eol);
+    s = ls_parse_int(s, eol, &count);
+    s = ls_skip_word(s, eol); /* Digits we couldn't parse. */
+
+    s = ls_skip_space(s, eol);
+    s = ls_skip_word(s, eol); /* "samples" */
+
+    unit = ls_skip_space(s, eol);
+    s = ls_skip_word(unit, eol);
+    unit_len = s - unit;
+
+    if (LS_EQ(unit, unit_len, "[reqs]")) {
+      stats[STAT_NR_REQS] += count;
+      continue;
+    }
+
+    if (!LS_EQ(unit, unit_len, "[bytes]"))
+      continue;
+
+    if (LS_EQ(name, name_len, "write_bytes"))
+      i = STAT_WR_BYTES;
+    else if (LS_EQ(name, name_len, "read_bytes"))
+      i = STAT_RD_BYTES;
+    else
+      continue;
+
+    /* MIN MAX SUM. */
+    s = ls_skip_space(s, eol);
+    s = ls_skip_word(s, eol);
+    s = ls_skip_space(s, eol);
+    s = ls_skip_word(s, eol);
+    s = ls_skip_space(s, eol);
+    if (s == eol)
+      continue;
+
+    ls_parse_int(s, eol, &sum);
+    stats[i] += sum;
+  }
+}
+
+/* job_stats records look like
+
+     - job_id:          cp.0
+       snapshot_time:   1336062282
+       read_bytes:      { samples: 4, unit: bytes, min: 4096, ... sum: 16384 }
+       getattr:         { samples: 2, unit: reqs }
+
+   in YAML flow style.  A record ends where the next one begins. */
+
+void lstats_job_init(struct lstats_job_parser *p,
+                     void (*cb)(void *, const char *, const int64_t *),
+                     void *data)
+{
+  memset(p, 0, sizeof(*p));
+  p->p_cb = cb;
+  p->p_data = data;
+}
+
+static void ls_job_flush(struct lstats_job_parser *p)
+{
+  if (p->p_in_job)
+    (*p->p_cb)(p->p_data, p->p_job_id, p->p_stats);
+
+  p->p_in_job = 0;
+}
+
+/* Find KEY: VALUE in the flow mapping s[0, end) (just past the '{'). */
+static const char *ls_job_field(const char *s, const char *end,
+                                const char *key, size_t key_len,
+                                size_t *v_len)
+{
+  const char *k, *v, *e;
+
+  while (s < end) {
+    k = ls_skip_space(s, end);
+    for (e = k; e < end && *e != ':' && *e != ',' && *e != '}'; e++)
+      ;
+
+    if (e == end || *e == '}')
+      return NULL;
+
+    v = (*e == ':') ? ls_skip_space(e + 1, end) : e;
+    for (s = v; s < end && *s != ',' && *s != '}'; s++)
+      ;
+
+    if (e - k == (ptrdiff_t) key_len && memcmp(k, key, key_len) == 0) {
+      for (e = s; e > v && (e[-1] == ' ' || e[-1] == '\t'); e--)
+        ;
+      *v_len = e - v;
+      return v;
+    }
+
+    if (s < end && *s == '}')
+      return NULL;
+
+    s++;
+  }
+
+  return NULL;
+}
+
+#define LS_JOB_FIELD(s, end, lit, v_len) \
+  ls_job_field((s), (end), (lit), sizeof(lit) - 1, (v_len))
+
+static void ls_job_line(struct lstats_job_parser *p, const char *s,
+                        const char *end)
+{
+  const char *name, *v;
+  size_t name_len, v_len;
+  int64_t count, sum;
+  int i;
+
+  s = ls_skip_space(s, end);
+
+  if (s < end && *s == '-') {
+    ls_job_flush(p);
+
+    s = ls_skip_space(s + 1, end);
+    if (!(end - s > 7 && memcmp(s, "job_id:", 7) == 0))
+      return;
+
+    s = ls_skip_space(s + 7, end);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+      end--;
+
+    /* Newer servers quote job_ids with odd characters. */
+    if (end - s >= 2 && (*s == '"' || *s == '\'') && end[-1] == *s) {
+      s++;
+      end--;
+    }
+
+    /* Reported as whitespace separated words; skip what won't fit. */
+    if (s == end || ls_skip_word(s, end) != end ||
+        !((size_t) (end - s) < sizeof(p->p_job_id)))
+      return;
+
+    memcpy(p->p_job_id, s, end - s);
+    p->p_job_id[end - s] = 0;
+    memset(p->p_stats, 0, sizeof(p->p_stats));
+    p->p_in_job = 1;
+    return;
+  }
+
+  if (!p->p_in_job)
+    return;
+
+  name = s;
+  s = memchr(name, ':', end - name);
+  if (s == NULL)
+    return;
+
+  name_len = s - name;
+  if (LS_EQ(name, name_len, "ping"))
+    return;
+
+  s = memchr(s, '{', end - s);
+  if (s == NULL)
+    return;
+  s++;
+
+  v = LS_JOB_FIELD(s, end, "unit", &v_len);
+  if (v == NULL)
+    return;
+
+  if (LS_EQ(v, v_len, "reqs")) {
+    v = LS_JOB_FIELD(s, end, "samples", &v_len);
+    if (v == NULL)
+      return;
+
+    ls_parse_int(v, v + v_len, &count);
+    p->p_stats[STAT_NR_REQS] += count;
+    return;
+  }
+
+  if (!LS_EQ(v, v_len, "bytes"))
+    return;
+
+  if (LS_EQ(name, name_len, "write_bytes"))
+    i = STAT_WR_BYTES;
+  else if (LS_EQ(name, name_len, "read_bytes"))
+    i = STAT_RD_BYTES;
+  else
+    return;
+
+  v = LS_JOB_FIELD(s, end, "sum", &v_len);
+  if (v == NULL)
+    return;
+
+  ls_parse_int(v, v + v_len, &sum);
+  p->p_stats[i] += sum;
+}
+
+/* Lines split across calls are carried in p_line; longer ones than
+   that holds are dropped. */
+void lstats_job_feed(struct lstats_job_parser *p, const char *s, size_t len)
+{
+  const char *end = s + len, *eol;
+  size_t n;
+
+  while (s < end) {
+    eol = memchr(s, '\n', end - s);
+    if (eol == NULL)
+      eol = end;
+
+    n = eol - s;
+
+    if (p->p_line_len > 0 || eol == end) {
+      if (p->p_skip_line || p->p_line_len + n > sizeof(p->p_line)) {
+        p->p_skip_line = 1;
+        p->p_line_len = 0;
+      } else {
+        memcpy(p->p_line + p->p_line_len, s, n);
+        p->p_line_len += n;
+      }
+
+      if (eol < end) {
+        if (!p->p_skip_line)
+          ls_job_line(p, p->p_line, p->p_line + p->p_line_len);
+        p->p_line_len = 0;
+        p->p_skip_line = 0;
+      }
+    } else if (p->p_skip_line) {
+      p->p_skip_line = 0;
+    } else {
+      ls_job_line(p, s, eol);
+    }
+
+    s = eol + 1;
+  }
+}
+
+void lstats_job_end(struct lstats_job_parser *p)
+{
+  if (p->p_line_len > 0 && !p->p_skip_line)
+    ls_job_line(p, p->p_line, p->p_line + p->p_line_len);
+
+  p->p_line_len = 0;
+  p->p_skip_line = 0;
+
+  ls_job_flush(p);
+}
@@ -0,0 +1,37 @@
+#ifndef _LSTATS_H_
+#define _LSTATS_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "xltop.h"
+
+/* Add the counters from the Lustre exports/NID/stats text s[0, len)
+   into stats (indexed by STAT_*): the sample count of every "[reqs]"
+   line but ping, and the sums of read_bytes and write_bytes. */
+void lstats_parse(int64_t *stats, const char *s, size_t len);
+
+#define LSTATS_JOB_LINE_MAX 512
+
+/* Streaming parser for a target's job_stats file, which may be too
+   big to read in one go.  Feed it the text in pieces of any size with
+   lstats_job_feed() and finish with lstats_job_end(); p_cb is called
+   once per job record with the record's job_id and counters, counted
+   as in lstats_parse(). */
+struct lstats_job_parser {
+  void (*p_cb)(void *data, const char *job_id, const int64_t *stats);
+  void *p_data;
+  int64_t p_stats[NR_STATS];
+  unsigned int p_in_job:1, p_skip_line:1;
+  size_t p_line_len;
+  char p_job_id[LSTATS_JOB_LINE_MAX];
+  char p_line[LSTATS_JOB_LINE_MAX];
+};
+
+void lstats_job_init(struct lstats_job_parser *p,
+                     void (*cb)(void *, const char *, const int64_t *),
+                     void *data);
+
+void lstats_job_feed(struct lstats_job_parser *p, const char *s, size_t len);
+
+void lstats_job_end(struct lstats_job_parser *p);
+
+#endif
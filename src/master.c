@@ -14,19 +14,33 @@
 #include "x_node.h"
 #include "k_heap.h"
 #include "job.h"
+#include "journal.h"
 #include "clus.h"
+#include "fed.h"
 #include "fs.h"
+#include "hist.h"
 #include "lnet.h"
+#include "metrics.h"
+#include "perf.h"
+#include "serv_sched.h"
 #include "serv.h"
+#include "snap.h"
+#include "string1.h"
 #include "xltop.h"
 #include "pidfile.h"
 #include "trace.h"
 
 #define XLTOP_BIND "0.0.0.0"
+#define XLTOP_JOURNAL_SIZE 1024 /* MB. */
+#define XLTOP_JOURNAL_FILES 4
 #define XLTOP_CLUS_INTERVAL 120.0
+#define XLTOP_HISTORY_INTERVAL 60.0
+#define XLTOP_HISTORY_SIZE 2048
 #define XLTOP_NR_HOSTS_HINT 4096
 #define XLTOP_NR_JOBS_HINT 256
+#define XLTOP_PEER_INTERVAL 30.0
 #define XLTOP_SERV_INTERVAL 300.0
+#define XLTOP_SNAPSHOT_INTERVAL 300.0
 
 #define BIND_CFG_OPTS \
   CFG_STR("bind", NULL, CFGF_NONE),           \
@@ -35,11 +49,16 @@
   CFG_STR("bind_service", NULL, CFGF_NONE), \
   CFG_STR("bind_port", NULL, CFGF_NONE)
 
+static int no_bind; /* Replaying a journal. */
+
 static int bind_cfg(cfg_t *cfg, const char *addr, const char *port)
 {
   struct ap_struct ap;
   char *opt;
 
+  if (no_bind)
+    return 0;
+
   opt = cfg_getstr(cfg, "bind");
   if (opt != NULL) {
     if (ap_parse(&ap, opt, addr, port) < 0)
@@ -135,6 +154,7 @@ static cfg_opt_t fs_cfg_opts[] = {
   /* AUTH_CFG_OPTS, */
   BIND_CFG_OPTS,
   CFG_STR("lnet", NULL, CFGF_NONE),
+  CFG_STR("job_clus", CLUS_0_NAME, CFGF_NONE),
   CFG_STR_LIST("servs", NULL, CFGF_NONE),
   CFG_FLOAT("interval", XLTOP_SERV_INTERVAL, CFGF_NONE),
   CFG_END(),
@@ -144,6 +164,8 @@ static void fs_cfg(EV_P_ cfg_t *cfg, char *addr, char *port)
 {
   const char *name = cfg_title(cfg);
   const char *lnet_name = cfg_getstr(cfg, "lnet");
+  const char *job_clus_name = cfg_getstr(cfg, "job_clus");
+  struct clus_node *c;
   struct x_node *x;
   double interval;
   struct lnet_struct *l;
@@ -161,6 +183,11 @@ static void fs_cfg(EV_P_ cfg_t *cfg, char *addr, char *port)
     FATAL("fs `%s': unknown lnet `%s': %m\n",
           name, lnet_name != NULL ? lnet_name : "-");
 
+  /* Cluster for jobids that servds read from job_stats. */
+  c = clus_lookup(job_clus_name, L_CREATE);
+  if (c == NULL)
+    FATAL("fs `%s': cannot create cluster `%s': %m\n", name, job_clus_name);
+
   interval = cfg_getfloat(cfg, "interval");
   if (interval <= 0)
     FATAL("fs `%s': invalid interval %lf\n", name, interval);
@@ -179,11 +206,62 @@ static void fs_cfg(EV_P_ cfg_t *cfg, char *addr, char *port)
 
     /* TODO AUTH */
 
+    s->s_job_clus = c;
     s->s_interval = interval;
     s->s_offset = (i * interval) / nr_servs;
   }
 }
 
+static cfg_opt_t peer_cfg_opts[] = {
+  CFG_STR("host", NULL, CFGF_NONE),
+  CFG_STR("port", XLTOP_PORT, CFGF_NONE),
+  CFG_FLOAT("interval", XLTOP_PEER_INTERVAL, CFGF_NONE),
+  CFG_FLOAT("max_age", 0, CFGF_NONE), /* Default 4 intervals. */
+  CFG_END(),
+};
+
+static void peer_cfg(EV_P_ cfg_t *cfg)
+{
+  const char *name = cfg_title(cfg);
+  const char *host = cfg_getstr(cfg, "host");
+  const char *port = cfg_getstr(cfg, "port");
+  double interval = cfg_getfloat(cfg, "interval");
+  double max_age = cfg_getfloat(cfg, "max_age");
+
+  if (host == NULL)
+    FATAL("peer `%s': no host given\n", name);
+
+  if (interval <= 0)
+    FATAL("peer `%s': invalid interval %lf\n", name, interval);
+
+  if (max_age <= 0)
+    max_age = 4 * interval;
+
+  if (fed_peer_add(EV_A_ name, host, port, interval, max_age) == NULL)
+    FATAL("peer `%s': cannot add peer: %m\n", name);
+
+  TRACE("added peer `%s'\n", name);
+}
+
+/* path relative to the current dir made absolute, since we chdir()
+   to the config dir and then to "/". */
+static char *cwd_path(const char *path)
+{
+  char *cwd, *abs;
+
+  cwd = get_current_dir_name();
+  if (path[0] == '/' || cwd == NULL)
+    abs = strdup(path);
+  else
+    abs = strf("%s/%s", cwd, path);
+  free(cwd);
+
+  if (abs == NULL)
+    OOM();
+
+  return abs;
+}
+
 static void sigterm_cb(EV_P_ ev_signal *w, int revents)
 {
   ev_break(EV_A_ EVBREAK_ALL);
@@ -202,6 +280,9 @@ static void print_help(void)
 	 " -h, --help                display this help and exit\n"
 	 " -p, --port=PORT           listen on PORT (default %s)\n"
 	 " -P, --pidfile=PATH        write PID to PATH\n"
+	 " -r, --replay=JOURNAL      replay JOURNAL, print throughput and state, and exit\n"
+	 " -s, --speed=FACTOR        replay at FACTOR times the journaled pace (default\n"
+	 "                             as fast as possible)\n"
 	 " -v, --version             display version information and exit\n"
 	 "\nReport %s bugs to <%s>.\n"
 	 , p, XLTOP_BIND, XLTOP_PORT, p, PACKAGE_BUGREPORT);
@@ -227,6 +308,8 @@ int main(int argc, char *argv[])
   int pidfile_fd = -1;
   const char *pidfile_path = NULL;
   int want_daemon = 0;
+  char *replay_path = NULL;
+  double replay_speed = 0;
   size_t i;
 
   struct option opts[] = {
@@ -236,12 +319,14 @@ int main(int argc, char *argv[])
     { "help",     0, NULL, 'h' },
     { "port",     1, NULL, 'p' },
     { "pidfile",  1, NULL, 'P' },
+    { "replay",   1, NULL, 'r' },
+    { "speed",    1, NULL, 's' },
     { "version",  0, NULL, 'v' },
     { NULL,       0, NULL,  0  },
   };
 
   int opt;
-  while ((opt = getopt_long(argc, argv, "b:c:dhP:p:v", opts, 0)) > 0) {
+  while ((opt = getopt_long(argc, argv, "b:c:dhP:p:r:s:v", opts, 0)) > 0) {
     switch (opt) {
     case 'b':
       b_addr = optarg;
@@ -260,6 +345,13 @@ int main(int argc, char *argv[])
     case 'p':
       b_port = optarg;
       break;
+    case 'r':
+      replay_path = cwd_path(optarg);
+      no_bind = 1;
+      break;
+    case 's':
+      replay_speed = strtod(optarg, NULL);
+      break;
     case 'v':
       print_version();
       exit(EXIT_SUCCESS);
@@ -273,11 +365,21 @@ int main(int argc, char *argv[])
     BIND_CFG_OPTS,
     CFG_FLOAT("tick", K_TICK, CFGF_NONE),
     CFG_FLOAT("window", K_WINDOW, CFGF_NONE),
+    CFG_FLOAT_LIST("windows", NULL, CFGF_NONE),
     CFG_INT("nr_hosts_hint", XLTOP_NR_HOSTS_HINT, CFGF_NONE),
     CFG_INT("nr_jobs_hint", XLTOP_NR_JOBS_HINT, CFGF_NONE),
+    CFG_STR("snapshot", NULL, CFGF_NONE),
+    CFG_FLOAT("snapshot_interval", XLTOP_SNAPSHOT_INTERVAL, CFGF_NONE),
+    CFG_STR("journal", NULL, CFGF_NONE),
+    CFG_INT("journal_size", XLTOP_JOURNAL_SIZE, CFGF_NONE),
+    CFG_INT("journal_files", XLTOP_JOURNAL_FILES, CFGF_NONE),
+    CFG_INT("history", 0, CFGF_NONE),
+    CFG_INT("history_size", XLTOP_HISTORY_SIZE, CFGF_NONE),
+    CFG_FLOAT("history_interval", XLTOP_HISTORY_INTERVAL, CFGF_NONE),
     CFG_SEC("clus", clus_cfg_opts, CFGF_MULTI|CFGF_TITLE),
     CFG_SEC("lnet", lnet_cfg_opts, CFGF_MULTI|CFGF_TITLE),
     CFG_SEC("fs", fs_cfg_opts, CFGF_MULTI|CFGF_TITLE),
+    CFG_SEC("peer", peer_cfg_opts, CFGF_MULTI|CFGF_TITLE),
     CFG_END()
   };
 
@@ -347,6 +449,18 @@ have_conf_file:
   if (k_window <= 0)
     FATAL("%s: window must be positive\n", conf_file_name);
 
+  double windows[K_WINDOWS_MAX];
+  size_t nr_windows = cfg_size(main_cfg, "windows");
+
+  if (nr_windows > K_WINDOWS_MAX)
+    FATAL("%s: too many windows (max %d)\n", conf_file_name, K_WINDOWS_MAX);
+
+  for (i = 0; i < nr_windows; i++)
+    windows[i] = cfg_getnfloat(main_cfg, "windows", i);
+
+  if (k_windows_init(windows, nr_windows) < 0)
+    FATAL("%s: windows must be positive\n", conf_file_name);
+
   size_t nr_host_hint = cfg_getint(main_cfg, "nr_hosts_hint");
   size_t nr_job_hint = cfg_getint(main_cfg, "nr_jobs_hint");
   size_t nr_clus = cfg_size(main_cfg, "clus");
@@ -405,17 +519,96 @@ have_conf_file:
            cfg_getnsec(main_cfg, "fs", i),
            b_addr, b_port);
 
+  if (replay_path != NULL) {
+    /* Without peers, snapshot, or journal. */
+    cfg_free(main_cfg);
+    fclose(conf_file);
+
+    if (journal_replay(EV_DEFAULT_ &x_listen, replay_path, replay_speed) < 0)
+      FATAL("cannot replay `%s'\n", replay_path);
+
+    exit(EXIT_SUCCESS);
+  }
+
+  size_t nr_peer = cfg_size(main_cfg, "peer");
+  for (i = 0; i < nr_peer; i++)
+    peer_cfg(EV_DEFAULT_ cfg_getnsec(main_cfg, "peer", i));
+
+  /* Paths in the config are relative to the config dir. */
+  char *snap_path = NULL;
+  const char *snap_arg = cfg_getstr(main_cfg, "snapshot");
+  double snap_interval = cfg_getfloat(main_cfg, "snapshot_interval");
+  if (snap_arg != NULL) {
+    snap_path = cwd_path(snap_arg);
+
+    if (snap_interval <= 0)
+      FATAL("%s: snapshot_interval must be positive\n", conf_file_name);
+
+    if (snap_load(EV_DEFAULT_ snap_path) < 0)
+      ERROR("starting without snapshot `%s'\n", snap_path);
+
+    snap_init(EV_DEFAULT_ snap_path, snap_interval);
+    free(snap_path);
+  }
+
+  const char *journal_arg = cfg_getstr(main_cfg, "journal");
+  long journal_size = cfg_getint(main_cfg, "journal_size");
+  long journal_files = cfg_getint(main_cfg, "journal_files");
+  if (journal_arg != NULL) {
+    char *journal_path = cwd_path(journal_arg);
+
+    if (journal_size <= 0 || journal_files <= 0)
+      FATAL("%s: journal_size and journal_files must be positive\n",
+            conf_file_name);
+
+    if (journal_init(EV_DEFAULT_ &x_listen, journal_path,
+                     (size_t) journal_size << 20, journal_files) < 0)
+      FATAL("cannot start journal `%s'\n", journal_path);
+
+    free(journal_path);
+  }
+
+  long nr_hist = cfg_getint(main_cfg, "history");
+  long hist_size = cfg_getint(main_cfg, "history_size");
+  double hist_interval = cfg_getfloat(main_cfg, "history_interval");
+  if (nr_hist > 0 &&
+      hist_init(EV_DEFAULT_ nr_hist, hist_size > 0 ? hist_size : 0,
+                hist_interval) < 0)
+    FATAL("%s: cannot keep history for %ld pairs of %ld bytes every %f seconds: %m\n",
+          conf_file_name, nr_hist, hist_size, hist_interval);
+
   cfg_free(main_cfg);
   fclose(conf_file);
 
+  sched_init(EV_DEFAULT);
+
   extern const struct botz_entry_ops top_entry_ops; /* MOVEME */
   if (botz_add(&x_listen, "top", &top_entry_ops, NULL) < 0)
     FATAL("cannot add listen entry `%s': %m\n", "top");
 
+  extern const struct botz_entry_ops windows_entry_ops; /* MOVEME */
+  if (botz_add(&x_listen, "_windows", &windows_entry_ops, NULL) < 0)
+    FATAL("cannot add listen entry `%s': %m\n", "_windows");
+
+  if (botz_add(&x_listen, "history", &hist_entry_ops, NULL) < 0)
+    FATAL("cannot add listen entry `%s': %m\n", "history");
+
   extern const struct botz_entry_ops domains_entry_ops; /* MOVEME */
   if (botz_add(&x_listen, "_domains", &domains_entry_ops, NULL) < 0)
     FATAL("cannot add listen entry `%s': %m\n", "_domains");
 
+  if (botz_add(&x_listen, "_stats", &perf_entry_ops, NULL) < 0)
+    FATAL("cannot add listen entry `%s': %m\n", "_stats");
+
+  if (botz_add(&x_listen, "metrics", &metrics_entry_ops, NULL) < 0)
+    FATAL("cannot add listen entry `%s': %m\n", "metrics");
+
+  if (botz_add(&x_listen, "_fed", &fed_entry_ops, NULL) < 0)
+    FATAL("cannot add listen entry `%s': %m\n", "_fed");
+
+  if (botz_add(&x_listen, "_peers", &fed_peers_entry_ops, NULL) < 0)
+    FATAL("cannot add listen entry `%s': %m\n", "_peers");
+
   signal(SIGPIPE, SIG_IGN);
 
   evx_listen_start(EV_DEFAULT_ &x_listen.bl_listen);
@@ -437,6 +630,9 @@ have_conf_file:
 
   ev_run(EV_DEFAULT_ 0);
 
+  snap_fini(EV_DEFAULT);
+  journal_fini();
+
   if (pidfile_path != NULL)
     unlink(pidfile_path);
 
@@ -0,0 +1,318 @@
+#include "stddef1.h"
+#include <math.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <ev.h>
+#include "botz.h"
+#include "k_heap.h"
+#include "metrics.h"
+#include "serv.h"
+#include "string1.h"
+#include "trace.h"
+#include "x_node.h"
+#include "xltop.h"
+
+/* OpenMetrics exposition at /metrics.  The body is rendered at most
+   once per tick and served from mx_cache in between (compressed on
+   first request into mx_cache_gz); series labels are rendered once
+   per x_node and kept in x_label. */
+
+#define MX_TOP_LIMIT ((size_t) 4096)
+
+static const char *mx_stat_name[NR_STATS] = {
+  [STAT_WR_BYTES] = "write_bytes",
+  [STAT_RD_BYTES] = "read_bytes",
+  [STAT_NR_REQS] = "requests",
+};
+
+#define MX_SERV_STATUS(X)               \
+  X(time,         "%.0f", ss_time)      \
+  X(uptime,       "%.0f", ss_uptime)    \
+  X(load1,        "%.2f", ss_load[0])   \
+  X(load5,        "%.2f", ss_load[1])   \
+  X(load15,       "%.2f", ss_load[2])   \
+  X(total_ram,    "%zu",  ss_total_ram) \
+  X(free_ram,     "%zu",  ss_free_ram)  \
+  X(shared_ram,   "%zu",  ss_shared_ram) \
+  X(buffer_ram,   "%zu",  ss_buffer_ram) \
+  X(total_swap,   "%zu",  ss_total_swap) \
+  X(free_swap,    "%zu",  ss_free_swap) \
+  X(nr_task,      "%zu",  ss_nr_task)   \
+  X(nr_mdt,       "%zu",  ss_nr_mdt)    \
+  X(nr_ost,       "%zu",  ss_nr_ost)    \
+  X(nr_nid,       "%zu",  ss_nr_nid)    \
+  X(collect_time, "%f",   ss_collect_time) \
+  X(nr_open,      "%zu",  ss_nr_open)   \
+  X(read_bytes,   "%zu",  ss_read_bytes) \
+  X(upload_time,  "%f",   ss_upload_time) \
+  X(upload_bytes, "%zu",  ss_upload_bytes) \
+  X(nr_upload_fail, "%zu", ss_nr_upload_fail) \
+  X(interval,     "%f",   ss_interval)
+
+static struct n_buf mx_cache, mx_cache_gz;
+static double mx_cache_tick = -1;
+
+/* Like n_buf_printf() but grows nb rather than truncating. */
+__attribute__((format(printf, 2, 3)))
+static int mx_printf(struct n_buf *nb, const char *fmt, ...)
+{
+  va_list args;
+  size_t max;
+  int len;
+
+  while (1) {
+    max = nb->nb_size - nb->nb_end;
+
+    va_start(args, fmt);
+    len = vsnprintf(nb->nb_buf + nb->nb_end, max, fmt, args);
+    va_end(args);
+
+    if (len < 0)
+      return -1;
+
+    if ((size_t) len < max) {
+      nb->nb_end += len;
+      return 0;
+    }
+
+    if (n_buf_reserve(nb, len + 1) < 0)
+      return -1;
+  }
+}
+
+/* Returns "" for the universes. */
+static const char *mx_label(struct x_node *x)
+{
+  const char *s;
+  char *d;
+
+  if (x->x_label != NULL)
+    return x->x_label;
+
+  if (x == x_all[x_which(x)])
+    return "";
+
+  /* type="name" with '\\', '"' and '\n' escaped. */
+  d = malloc(strlen(x->x_type->x_type_name) + 2 * strlen(x->x_name) + 4);
+  if (d == NULL)
+    return "";
+
+  x->x_label = d;
+  d += sprintf(d, "%s=\"", x->x_type->x_type_name);
+
+  for (s = x->x_name; *s != 0; s++) {
+    if (*s == '\\' || *s == '"') {
+      *(d++) = '\\';
+      *(d++) = *s;
+    } else if (*s == '\n') {
+      *(d++) = '\\';
+      *(d++) = 'n';
+    } else {
+      *(d++) = *s;
+    }
+  }
+
+  *(d++) = '"';
+  *d = 0;
+
+  return x->x_label;
+}
+
+static int mx_k_sample(struct n_buf *nb, const char *name, struct k_node *k,
+                       double v)
+{
+  const char *l0 = mx_label(k->k_x[0]), *l1 = mx_label(k->k_x[1]);
+
+  return mx_printf(nb, "%s{%s%s%s} %f\n", name, l0,
+                   (*l0 != 0 && *l1 != 0) ? "," : "", l1, v);
+}
+
+/* Rate gauges and byte/request counters for the pairs in kv. */
+static int mx_k_families(struct n_buf *nb, const char *family,
+                         struct k_node **kv, size_t n)
+{
+  char name[128];
+  size_t i, j;
+
+  for (i = 0; i < NR_STATS; i++) {
+    snprintf(name, sizeof(name), "xltop_%s_%s_rate", family, mx_stat_name[i]);
+
+    if (mx_printf(nb, "# TYPE %s gauge\n"
+                  "# HELP %s Moving average of %s per second.\n",
+                  name, name, mx_stat_name[i]) < 0)
+      return -1;
+
+    for (j = 0; j < n; j++)
+      if (mx_k_sample(nb, name, kv[j], kv[j]->k_rate[i]) < 0)
+        return -1;
+  }
+
+  for (i = 0; i < NR_STATS; i++) {
+    snprintf(name, sizeof(name), "xltop_%s_%s", family, mx_stat_name[i]);
+
+    if (mx_printf(nb, "# TYPE %s counter\n"
+                  "# HELP %s Total %s since the pair was created.\n",
+                  name, name, mx_stat_name[i]) < 0)
+      return -1;
+
+    snprintf(name, sizeof(name), "xltop_%s_%s_total",
+             family, mx_stat_name[i]);
+
+    for (j = 0; j < n; j++)
+      if (mx_k_sample(nb, name, kv[j], kv[j]->k_sum[i]) < 0)
+        return -1;
+  }
+
+  return 0;
+}
+
+/* Fill kv with the (ALL, x) pairs for x of type.  Returns count. */
+static size_t mx_collect(struct k_node **kv, size_t max, int type, double now)
+{
+  struct hash_table *t = &x_types[type].x_hash_table;
+  struct hlist_node *node;
+  struct x_node *x;
+  struct k_node *k;
+  size_t i, n = 0;
+
+  for (i = 0; i < (1ULL << t->t_shift); i++) {
+    hlist_for_each_entry(x, node, t->t_table + i, x_hash_node) {
+      k = k_lookup(x_all[0], x, 0);
+      if (k == NULL || !(n < max))
+        continue;
+
+      k_freshen(k, now);
+      kv[n++] = k;
+    }
+  }
+
+  return n;
+}
+
+static int mx_serv_status(struct n_buf *nb)
+{
+  struct hash_table *t = &x_types[X_SERV].x_hash_table;
+  struct hlist_node *node;
+  struct x_node *x;
+  struct serv_node *s;
+  size_t i;
+
+#define X(field, fmt, member)                                           \
+  if (mx_printf(nb, "# TYPE xltop_serv_status_%s gauge\n", #field) < 0) \
+    return -1;                                                          \
+                                                                        \
+  for (i = 0; i < (1ULL << t->t_shift); i++) {                          \
+    hlist_for_each_entry(x, node, t->t_table + i, x_hash_node) {        \
+      s = container_of(x, struct serv_node, s_x);                       \
+      if (mx_printf(nb, "xltop_serv_status_%s{%s} "fmt"\n", #field,     \
+                    mx_label(x), s->s_status.member) < 0)               \
+        return -1;                                                      \
+    }                                                                   \
+  }
+  MX_SERV_STATUS(X)
+#undef X
+
+  return 0;
+}
+
+static int mx_render(struct n_buf *nb, double now)
+{
+  struct k_node **kv = NULL;
+  struct k_top top, *t = &top;
+  size_t n, max;
+  int rc = -1;
+
+  k_top_spec_init(t);
+
+  max = MAX(MAX(x_types[X_FS].x_nr, x_types[X_SERV].x_nr),
+            x_types[X_TARGET].x_nr);
+  kv = malloc(max * sizeof(kv[0]) + 1);
+  if (kv == NULL)
+    goto out;
+
+  n = mx_collect(kv, max, X_FS, now);
+  if (mx_k_families(nb, "fs", kv, n) < 0)
+    goto out;
+
+  n = mx_collect(kv, max, X_SERV, now);
+  if (mx_k_families(nb, "serv", kv, n) < 0)
+    goto out;
+
+  n = mx_collect(kv, max, X_TARGET, now);
+  if (mx_k_families(nb, "target", kv, n) < 0)
+    goto out;
+
+  if (mx_serv_status(nb) < 0)
+    goto out;
+
+  /* Top jobs by fs: depth 2 below u (clus, job), 1 below v (fs). */
+  if (k_heap_init(&t->t_h, MX_TOP_LIMIT) < 0)
+    goto out;
+
+  k_heap_top(&t->t_h, x_all[0], 2, x_all[1], 1, NULL, &k_top_cmp, now);
+  k_heap_order(&t->t_h, &k_top_cmp);
+
+  if (mx_k_families(nb, "job_fs", t->t_h.h_k, t->t_h.h_count) < 0)
+    goto out;
+
+  if (mx_printf(nb, "# EOF\n") < 0)
+    goto out;
+
+  rc = 0;
+
+ out:
+  k_heap_destroy(&t->t_h);
+  free(kv);
+
+  return rc;
+}
+
+static void metrics_get_cb(EV_P_ struct botz_entry *e,
+                                 struct botz_request *q,
+                                 struct botz_response *r)
+{
+  double now = ev_now(EV_A);
+  double tick = floor(now / k_tick);
+  struct n_buf *nb = &mx_cache;
+
+  if (tick != mx_cache_tick) {
+    mx_cache_tick = -1;
+    n_buf_clear(&mx_cache);
+    n_buf_clear(&mx_cache_gz);
+
+    if (mx_render(&mx_cache, now) < 0) {
+      ERROR("cannot render metrics: %m\n");
+      r->r_status = BOTZ_INTERVAL_SERVER_ERROR;
+      return;
+    }
+
+    mx_cache_tick = tick;
+  }
+
+  if (q->q_accept_encoding & BOTZ_ENC_GZIP) {
+    if (n_buf_is_empty(&mx_cache_gz) &&
+        n_buf_deflate(&mx_cache_gz, mx_cache.nb_buf + mx_cache.nb_start,
+                      n_buf_length(&mx_cache), 1, 6) < 0)
+      n_buf_clear(&mx_cache_gz);
+
+    if (!n_buf_is_empty(&mx_cache_gz)) {
+      nb = &mx_cache_gz;
+      r->r_encoding = BOTZ_ENC_GZIP;
+    }
+  }
+
+  if (n_buf_reserve(&r->r_body, n_buf_length(nb)) < 0 ||
+      n_buf_copy(&r->r_body, nb) != 0) {
+    r->r_status = BOTZ_INTERVAL_SERVER_ERROR;
+    return;
+  }
+
+  snprintf(r->r_body_type, sizeof(r->r_body_type),
+           "application/openmetrics-text; version=1.0.0; charset=utf-8");
+}
+
+const struct botz_entry_ops metrics_entry_ops = {
+  .o_method = {
+    [BOTZ_GET] = &metrics_get_cb,
+  }
+};
@@ -0,0 +1,8 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+struct botz_entry_ops;
+
+extern const struct botz_entry_ops metrics_entry_ops;
+
+#endif
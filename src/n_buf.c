@@ -132,6 +132,35 @@ int n_buf_copy(struct n_buf *nb, const struct n_buf *src)
   return 0;
 }
 
+/* Grow nb so that at least len bytes may be appended. */
+int n_buf_reserve(struct n_buf *nb, size_t len)
+{
+  size_t size;
+  char *buf;
+
+  n_buf_check(nb);
+
+  n_buf_pullup(nb);
+
+  if (nb->nb_size - nb->nb_end >= len)
+    return 0;
+
+  size = nb->nb_size > 0 ? 2 * nb->nb_size : 4096;
+  if (size < nb->nb_end + len)
+    size = nb->nb_end + len;
+
+  buf = realloc(nb->nb_buf, size);
+  if (buf == NULL)
+    return -1;
+
+  nb->nb_buf = buf;
+  nb->nb_size = size;
+
+  n_buf_check(nb);
+
+  return 0;
+}
+
 void n_buf_destroy(struct n_buf *nb)
 {
   n_buf_check(nb);
@@ -20,6 +20,12 @@ size_t n_buf_write(struct n_buf *nb, void *mem, size_t len);
 int n_buf_get(struct n_buf *nb, size_t max_len, char **msg, size_t *msg_len);
 int n_buf_get_msg(struct n_buf *nb, char **msg, size_t *msg_len);
 int n_buf_copy(struct n_buf *nb, const struct n_buf *src);
+int n_buf_reserve(struct n_buf *nb, size_t len);
+
+/* In n_buf_z.c, link with -lz. */
+int n_buf_deflate(struct n_buf *nb, const void *src, size_t len,
+                  int gzip, int level);
+int n_buf_inflate(struct n_buf *nb, const void *src, size_t len, size_t max);
 
 static inline void n_buf_check(const struct n_buf *nb)
 {
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <zlib.h>
+#include "n_buf.h"
+#include "trace.h"
+
+/* Append the compressed contents of src[0, len) to nb, growing nb as
+   needed.  gzip selects the gzip wrapper, otherwise zlib (HTTP
+   "deflate"). */
+int n_buf_deflate(struct n_buf *nb, const void *src, size_t len,
+                  int gzip, int level)
+{
+  z_stream z;
+  int zrc, rc = -1;
+
+  memset(&z, 0, sizeof(z));
+
+  zrc = deflateInit2(&z, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8,
+                     Z_DEFAULT_STRATEGY);
+  if (zrc != Z_OK) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if (n_buf_reserve(nb, deflateBound(&z, len)) < 0)
+    goto out;
+
+  z.next_in = (Bytef *) src;
+  z.avail_in = len;
+  z.next_out = (Bytef *) nb->nb_buf + nb->nb_end;
+  z.avail_out = nb->nb_size - nb->nb_end;
+
+  zrc = deflate(&z, Z_FINISH);
+  if (zrc != Z_STREAM_END) {
+    TRACE("deflate rc %d, msg `%s'\n", zrc, z.msg != NULL ? z.msg : "");
+    errno = EIO;
+    goto out;
+  }
+
+  nb->nb_end += z.total_out;
+  rc = 0;
+
+ out:
+  deflateEnd(&z);
+
+  return rc;
+}
+
+/* Append the decompressed contents of src[0, len) (gzip or zlib
+   wrapped) to nb.  Fails with EFBIG if the output would exceed max
+   bytes. */
+int n_buf_inflate(struct n_buf *nb, const void *src, size_t len, size_t max)
+{
+  z_stream z;
+  size_t start;
+  int zrc, rc = -1;
+
+  memset(&z, 0, sizeof(z));
+
+  if (inflateInit2(&z, 15 + 32) != Z_OK) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  n_buf_pullup(nb);
+  start = nb->nb_end;
+
+  z.next_in = (Bytef *) src;
+  z.avail_in = len;
+
+  do {
+    if (nb->nb_end - start >= max) {
+      errno = EFBIG;
+      goto out;
+    }
+
+    if (n_buf_reserve(nb, 4 * len + 4096) < 0)
+      goto out;
+
+    z.next_out = (Bytef *) nb->nb_buf + nb->nb_end;
+    z.avail_out = nb->nb_size - nb->nb_end;
+
+    zrc = inflate(&z, Z_NO_FLUSH);
+    nb->nb_end = nb->nb_size - z.avail_out;
+
+    if (zrc != Z_OK && zrc != Z_STREAM_END) {
+      TRACE("inflate rc %d, msg `%s'\n", zrc, z.msg != NULL ? z.msg : "");
+      errno = EINVAL;
+      goto out;
+    }
+  } while (zrc != Z_STREAM_END);
+
+  if (nb->nb_end - start > max) {
+    errno = EFBIG;
+    goto out;
+  }
+
+  rc = 0;
+
+ out:
+  inflateEnd(&z);
+
+  return rc;
+}
@@ -0,0 +1,238 @@
+#include "stddef1.h"
+#include <malloc.h>
+#include <ev.h>
+#include "botz.h"
+#include "perf.h"
+#include "query.h"
+#include "string1.h"
+#include "trace.h"
+#include "x_botz.h"
+
+unsigned long long perf_counter[NR_PERF_COUNTERS];
+struct perf_hist perf_hist[NR_PERF_HISTS];
+
+static const char *perf_counter_name[] = {
+#define X(name) [PERF_ ## name] = #name,
+  PERF_COUNTERS(X)
+#undef X
+};
+
+static const char *perf_hist_name[] = {
+#define X(name) [PERF_H_ ## name] = #name,
+  PERF_HISTS(X)
+#undef X
+};
+
+#if defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+#define PERF_MALLINFO2 1
+#endif
+#endif
+
+#define PERF_SUB (1ULL << PERF_SUB_BITS)
+
+static size_t perf_bucket(unsigned long long us)
+{
+  size_t b;
+  int e;
+
+  if (us < PERF_SUB)
+    return us;
+
+  e = 63 - __builtin_clzll(us);
+  b = (e - PERF_SUB_BITS + 1) * PERF_SUB +
+    ((us >> (e - PERF_SUB_BITS)) & (PERF_SUB - 1));
+
+  return MIN(b, (size_t) NR_PERF_BUCKETS - 1);
+}
+
+/* Smallest value (usec) that lands in bucket b. */
+static unsigned long long perf_bucket_lo(size_t b)
+{
+  int e;
+
+  if (b < PERF_SUB)
+    return b;
+
+  e = b / PERF_SUB + PERF_SUB_BITS - 1;
+
+  return (PERF_SUB + b % PERF_SUB) << (e - PERF_SUB_BITS);
+}
+
+void perf_hist_add(int i, double t0)
+{
+  struct perf_hist *h = &perf_hist[i];
+  double us = (perf_now() - t0) * 1e6;
+  unsigned long long u = us > 0 ? us : 0;
+
+  h->h_count++;
+  h->h_sum += us;
+  h->h_max = MAX(h->h_max, u);
+  h->h_bucket[perf_bucket(u)]++;
+}
+
+/* Upper bound (usec) of the bucket holding quantile p. */
+static unsigned long long perf_quantile(const struct perf_hist *h, double p)
+{
+  unsigned long long n = 0, want = p * h->h_count;
+  size_t b;
+
+  if (h->h_count == 0)
+    return 0;
+
+  for (b = 0; b < NR_PERF_BUCKETS - 1; b++) {
+    n += h->h_bucket[b];
+    if (n > want)
+      return MIN(perf_bucket_lo(b + 1), h->h_max);
+  }
+
+  return h->h_max;
+}
+
+/* Text output is "name: value" lines; JSON is a single object with
+   histograms nested by name. */
+struct perf_out {
+  struct n_buf *o_nb;
+  const char *o_prefix;
+  int o_json, o_n;
+};
+
+static void po_sep(struct perf_out *o)
+{
+  if (o->o_json && o->o_n++ > 0)
+    n_buf_printf(o->o_nb, ", ");
+}
+
+static void po_ull(struct perf_out *o, const char *name, unsigned long long v)
+{
+  po_sep(o);
+
+  if (o->o_json)
+    n_buf_printf(o->o_nb, "\"%s\": %llu", name, v);
+  else
+    n_buf_printf(o->o_nb, "%s%s: %llu\n", o->o_prefix, name, v);
+}
+
+static void po_double(struct perf_out *o, const char *name, double v)
+{
+  po_sep(o);
+
+  if (o->o_json)
+    n_buf_printf(o->o_nb, "\"%s\": %f", name, v);
+  else
+    n_buf_printf(o->o_nb, "%s%s: %f\n", o->o_prefix, name, v);
+}
+
+static void po_hist(struct perf_out *o, const char *name,
+                    const struct perf_hist *h)
+{
+  char prefix[64];
+  size_t b;
+  int n, outer_n = 0;
+
+  if (o->o_json) {
+    po_sep(o);
+    n_buf_printf(o->o_nb, "\"%s\": {", name);
+    outer_n = o->o_n;
+    o->o_n = 0;
+  } else {
+    snprintf(prefix, sizeof(prefix), "%s_", name);
+    o->o_prefix = prefix;
+  }
+
+  po_ull(o, "count", h->h_count);
+  po_double(o, "sum_usec", h->h_sum);
+  po_ull(o, "max_usec", h->h_max);
+  po_ull(o, "p50_usec", perf_quantile(h, 0.50));
+  po_ull(o, "p90_usec", perf_quantile(h, 0.90));
+  po_ull(o, "p99_usec", perf_quantile(h, 0.99));
+
+  if (o->o_json) {
+    /* Non-empty buckets as [lower bound usec, count]. */
+    n_buf_printf(o->o_nb, ", \"buckets\": [");
+    for (b = 0, n = 0; b < NR_PERF_BUCKETS; b++)
+      if (h->h_bucket[b] != 0)
+        n_buf_printf(o->o_nb, "%s[%llu, %llu]", n++ > 0 ? ", " : "",
+                     perf_bucket_lo(b), h->h_bucket[b]);
+    n_buf_printf(o->o_nb, "]}");
+    o->o_n = outer_n;
+  } else {
+    o->o_prefix = "";
+  }
+}
+
+static void perf_get_cb(EV_P_ struct botz_entry *e,
+                              struct botz_request *q,
+                              struct botz_response *r)
+{
+  struct perf_out o = {
+    .o_nb = &r->r_body,
+    .o_prefix = "",
+  };
+  char name[64];
+  size_t i;
+
+#define PERF_QUERY(X, Q) \
+  X(Q, 0, string, format, NULL, q_string_parse, 0)
+
+  DEFINE_QUERY(PERF_QUERY, perf_query);
+
+  if (QUERY_PARSE(PERF_QUERY, perf_query, q->q_query) < 0) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    return;
+  }
+
+  const char *format = perf_query[0].q_u.u_string;
+
+  if (format != NULL && strcmp(format, "json") == 0)
+    o.o_json = 1;
+  else if (format != NULL && strcmp(format, "text") != 0) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    return;
+  }
+
+  if (o.o_json) {
+    n_buf_printf(o.o_nb, "{");
+    snprintf(r->r_body_type, sizeof(r->r_body_type), "application/json");
+  }
+
+  po_double(&o, "now", ev_now(EV_A));
+  po_ull(&o, "nr_conn", x_listen.bl_nr_conn);
+  po_ull(&o, "nr_requests", x_listen.bl_nr_requests);
+  po_ull(&o, "bytes_in", x_listen.bl_bytes_in);
+  po_ull(&o, "bytes_out", x_listen.bl_bytes_out);
+
+  for (i = 0; i < NR_PERF_COUNTERS; i++)
+    po_ull(&o, perf_counter_name[i], perf_counter[i]);
+
+  po_ull(&o, "nr_k", nr_k);
+  po_ull(&o, "k_bytes", nr_k * K_NODE_SIZE);
+
+  for (i = 0; i < NR_X_TYPES; i++) {
+    snprintf(name, sizeof(name), "nr_%s", x_types[i].x_type_name);
+    po_ull(&o, name, x_types[i].x_nr);
+  }
+
+#if PERF_MALLINFO2
+  struct mallinfo2 mi = mallinfo2();
+#else
+  struct mallinfo mi = mallinfo();
+#endif
+
+  po_ull(&o, "heap_arena", mi.arena);
+  po_ull(&o, "heap_mmap", mi.hblkhd);
+  po_ull(&o, "heap_in_use", mi.uordblks);
+  po_ull(&o, "heap_free", mi.fordblks);
+
+  for (i = 0; i < NR_PERF_HISTS; i++)
+    po_hist(&o, perf_hist_name[i], &perf_hist[i]);
+
+  if (o.o_json)
+    n_buf_printf(o.o_nb, "}\n");
+}
+
+const struct botz_entry_ops perf_entry_ops = {
+  .o_method = {
+    [BOTZ_GET] = &perf_get_cb,
+  }
+};
@@ -0,0 +1,75 @@
+#ifndef _PERF_H_
+#define _PERF_H_
+#include <stddef.h>
+#include <time.h>
+
+struct botz_entry_ops;
+
+/* Master self instrumentation, served at /_stats. */
+
+#define PERF_COUNTERS(X) \
+  X(x_update)            \
+  X(k_lookup_hit)        \
+  X(k_lookup_miss)       \
+  X(k_create)            \
+  X(k_freshen)           \
+  X(sched_run)           \
+  X(sched_move)
+
+#define PERF_HISTS(X) \
+  X(top)              \
+  X(serv_put)         \
+  X(serv_status)      \
+  X(serv_report)      \
+  X(serv_batch)       \
+  X(clus_put)         \
+  X(fs_status)
+
+enum {
+#define X(name) PERF_ ## name,
+  PERF_COUNTERS(X)
+#undef X
+  NR_PERF_COUNTERS,
+};
+
+enum {
+#define X(name) PERF_H_ ## name,
+  PERF_HISTS(X)
+#undef X
+  NR_PERF_HISTS,
+};
+
+/* Log-linear latency buckets: values below 2^PERF_SUB_BITS usec get
+   their own bucket; above that each power of two is split into
+   2^PERF_SUB_BITS buckets.  The last bucket catches everything over
+   about 33 seconds. */
+#define PERF_SUB_BITS 2
+#define NR_PERF_BUCKETS 96
+
+struct perf_hist {
+  unsigned long long h_count;
+  double h_sum; /* usec */
+  unsigned long long h_max; /* usec */
+  unsigned long long h_bucket[NR_PERF_BUCKETS];
+};
+
+extern unsigned long long perf_counter[NR_PERF_COUNTERS];
+extern struct perf_hist perf_hist[NR_PERF_HISTS];
+
+#define PERF_INC(name) (perf_counter[PERF_ ## name]++)
+
+static inline double perf_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Record the time elapsed since t0 (from perf_now()) in histogram i. */
+void perf_hist_add(int i, double t0);
+
+extern const struct botz_entry_ops perf_entry_ops;
+
+#endif
@@ -0,0 +1,844 @@
+#include "stddef1.h"
+#include <stdio.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ev.h>
+#include "xltop.h"
+#include "ap_parse.h"
+#include "botz.h"
+#include "curl_x.h"
+#include "hash.h"
+#include "list.h"
+#include "n_buf.h"
+#include "pidfile.h"
+#include "query.h"
+#include "string1.h"
+#include "trace.h"
+
+/* xltop-relay takes servd reports as the master would (PUT /serv/NAME,
+   /serv/NAME/_status, /serv/NAME/_report, and /serv/_batch from other
+   relays) for any number of servers, sums each server's stats lines by
+   target and NID, and every interval forwards all of them to the
+   master's /serv/_batch in as few PUTs as it can.  The master thus
+   parses one line per (server, target, NID) per interval and holds a
+   connection per relay rather than per server.  Servers are answered
+   with the interval and offset the master last gave for them.
+
+   Reports replayed from a servd spool keep their time and are sent
+   as they are, as are sections a relay below us dated before the
+   current interval.  Batches the master did not take are kept (up to
+   RELAY_PENDING_SIZE) and sent first at the next interval.
+
+   A batch is cut at a section boundary before it passes batch_size
+   bytes (before compression), which must stay below what the master
+   takes in one request (64MB, 1MB for masters before this was
+   configurable); only a single server's section can be larger. */
+
+#define RELAY_BIND "0.0.0.0"
+#define RELAY_INTERVAL 10.0
+#define RELAY_BATCH_SIZE (512 << 10)
+#define RELAY_PENDING_SIZE (64 << 20)
+#define MAX_BATCHES 8
+#define NR_SERV_HINT 256
+#define NR_LINE_HINT 65536
+
+#define P_FMT PRI_STATS_FMT("%"PRId64)
+#define P_ARG PRI_STATS_ARG
+
+struct relay_serv {
+  struct hlist_node rs_hash_node;
+  struct list_head rs_link;
+  struct list_head rs_line_list; /* Target-less lines first. */
+  char *rs_status; /* Last status line, until forwarded. */
+  double rs_time; /* Of the last report. */
+  double rs_interval, rs_offset; /* From the master, 0 until known. */
+  char rs_name[];
+};
+
+/* Sum of one server's lines for one target and NID (or job). */
+struct relay_line {
+  struct hlist_node l_hash_node;
+  struct list_head l_link;
+  const char *l_target, *l_nid; /* In l_key. */
+  size_t l_target_len;
+  int64_t l_stats[NR_STATS];
+  char l_key[]; /* SERV TARGET NID, TARGET may be empty. */
+};
+
+static struct botz_listen relay_listen;
+static struct curl_x curl_x;
+static struct ev_periodic forward_w;
+
+static LIST_HEAD(relay_serv_list);
+static struct hash_table relay_serv_table;
+static struct hash_table relay_line_table;
+static size_t nr_line, nr_line_max;
+
+/* Sections to send as they are: replays and failed batches. */
+static struct n_buf relay_pending;
+static size_t relay_batch_size = RELAY_BATCH_SIZE;
+
+static struct relay_serv *relay_serv_lookup(const char *name, int flags)
+{
+  struct hlist_head *head;
+  struct relay_serv *rs;
+
+  rs = str_table_lookup_entry(&relay_serv_table, name, &head,
+                              struct relay_serv, rs_hash_node, rs_name);
+  if (rs != NULL || !(flags & L_CREATE))
+    return rs;
+
+  rs = malloc(sizeof(*rs) + strlen(name) + 1);
+  if (rs == NULL)
+    return NULL;
+
+  memset(rs, 0, sizeof(*rs));
+  INIT_LIST_HEAD(&rs->rs_line_list);
+  strcpy(rs->rs_name, name);
+
+  hlist_add_head(&rs->rs_hash_node, head);
+  list_add_tail(&rs->rs_link, &relay_serv_list);
+
+  TRACE("serv `%s'\n", name);
+
+  return rs;
+}
+
+static struct relay_line *
+relay_line_lookup(struct relay_serv *rs, const char *target, const char *nid)
+{
+  struct hlist_head *head;
+  struct relay_line *l;
+  char key[1024];
+  size_t n;
+
+  n = snprintf(key, sizeof(key), "%s %s %s", rs->rs_name, target, nid);
+  if (n >= sizeof(key))
+    return NULL;
+
+  l = str_table_lookup_entry(&relay_line_table, key, &head,
+                             struct relay_line, l_hash_node, l_key);
+  if (l != NULL)
+    return l;
+
+  l = malloc(sizeof(*l) + n + 1);
+  if (l == NULL)
+    return NULL;
+
+  memset(l, 0, sizeof(*l));
+  strcpy(l->l_key, key);
+  l->l_target = l->l_key + strlen(rs->rs_name) + 1;
+  l->l_target_len = strlen(target);
+  l->l_nid = l->l_target + l->l_target_len + 1;
+
+  hlist_add_head(&l->l_hash_node, head);
+  if (l->l_target_len == 0)
+    list_add(&l->l_link, &rs->rs_line_list);
+  else
+    list_add_tail(&l->l_link, &rs->rs_line_list);
+
+  nr_line++;
+
+  return l;
+}
+
+/* As serv_msg_cb() in serv.c.  *target is where lines go, "" until the
+   first target line.  The stats on a target line are kept as a line
+   for the target with an empty NID. */
+static void relay_msg(struct relay_serv *rs, char *msg, const char **target)
+{
+  struct relay_line *l;
+  int64_t d[NR_STATS];
+  char *nid, *end;
+  size_t i;
+
+  nid = wsep(&msg);
+  if (nid == NULL)
+    return;
+
+  if (strncmp(nid, XLTOP_TARGET_PREFIX, strlen(XLTOP_TARGET_PREFIX)) == 0) {
+    *target = nid + strlen(XLTOP_TARGET_PREFIX);
+    if (**target == 0)
+      return;
+
+    nid = "";
+  }
+
+  if (msg == NULL)
+    return;
+
+  for (i = 0; i < NR_STATS; i++) {
+    d[i] = strtoll(msg, &end, 10);
+    if (end == msg)
+      return;
+    msg = end;
+  }
+
+  l = relay_line_lookup(rs, *target, nid);
+  if (l == NULL) {
+    ERROR("serv `%s', cannot add line for `%s': %m\n", rs->rs_name, nid);
+    return;
+  }
+
+  for (i = 0; i < NR_STATS; i++)
+    l->l_stats[i] += d[i];
+}
+
+static void relay_put_msgs(EV_P_ struct relay_serv *rs, struct n_buf *nb)
+{
+  const char *target = "";
+  char *msg;
+  size_t msg_len;
+
+  rs->rs_time = ev_now(EV_A);
+
+  while (n_buf_get_msg(nb, &msg, &msg_len) == 0)
+    relay_msg(rs, msg, &target);
+}
+
+static int relay_status_set(struct relay_serv *rs, const char *msg)
+{
+  char *status = strdup(msg);
+
+  if (status == NULL)
+    return -1;
+
+  free(rs->rs_status);
+  rs->rs_status = status;
+
+  return 0;
+}
+
+/* Take the status line from the front of q's body and answer as the
+   master did for rs. */
+static int relay_status_put(struct relay_serv *rs, struct botz_request *q,
+                            struct botz_response *r)
+{
+  char *msg;
+  size_t msg_len;
+
+  if (n_buf_get_msg(&q->q_body, &msg, &msg_len) != 0) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    return -1;
+  }
+
+  if (relay_status_set(rs, msg) < 0) {
+    r->r_status = BOTZ_INTERVAL_SERVER_ERROR;
+    return -1;
+  }
+
+  if (rs->rs_interval > 0)
+    n_buf_printf(&r->r_body, "%f %f\n", rs->rs_interval, rs->rs_offset);
+
+  return 0;
+}
+
+/* A report replayed from a servd spool goes upstream as its own
+   section with its own time. */
+static int relay_pending_add(struct relay_serv *rs, double t,
+                             struct n_buf *nb)
+{
+  size_t len = n_buf_length(nb);
+  char hdr[1024];
+  int n;
+
+  n = snprintf(hdr, sizeof(hdr), XLTOP_SERV_PREFIX"%s %f 0\n",
+               rs->rs_name, t);
+  if (n < 0 || (size_t) n >= sizeof(hdr))
+    return -1;
+
+  if (n_buf_length(&relay_pending) + n + len + 1 > RELAY_PENDING_SIZE) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  if (n_buf_reserve(&relay_pending, n + len + 1) < 0)
+    return -1;
+
+  n_buf_write(&relay_pending, hdr, n);
+  n_buf_write(&relay_pending, nb->nb_buf + nb->nb_start, len);
+  if (len > 0 && nb->nb_buf[nb->nb_end - 1] != '\n')
+    n_buf_putc(&relay_pending, '\n');
+
+  return 0;
+}
+
+static void relay_put_cb(EV_P_ struct botz_entry *e,
+                               struct botz_request *q,
+                               struct botz_response *r)
+{
+  struct relay_serv *rs = e->e_data;
+  double t;
+
+  /* time is set on reports replayed from a servd spool. */
+#define RELAY_PUT_QUERY(X, Q) \
+  X(Q, 0, double, time, 0, q_double_parse, 0)
+
+  DEFINE_QUERY(RELAY_PUT_QUERY, relay_put_query);
+
+  if (QUERY_PARSE(RELAY_PUT_QUERY, relay_put_query, q->q_query) < 0) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    return;
+  }
+
+  t = relay_put_query[0].q_u.u_double;
+  if (t > 0) {
+    if (relay_pending_add(rs, t, &q->q_body) < 0) {
+      ERROR("serv `%s', cannot keep replayed report: %m\n", rs->rs_name);
+      r->r_status = BOTZ_INTERVAL_SERVER_ERROR;
+    }
+    return;
+  }
+
+  relay_put_msgs(EV_A_ rs, &q->q_body);
+}
+
+static struct botz_entry *
+relay_serv_lookup_cb(EV_P_ struct botz_lookup *p,
+                           struct botz_request *q,
+                           struct botz_response *r)
+{
+  struct relay_serv *rs = p->p_entry->e_data;
+
+  if (p->p_rest != NULL)
+    return NULL;
+
+  if (strcmp(p->p_name, "_status") != 0 &&
+      strcmp(p->p_name, "_report") != 0)
+    return NULL;
+
+  if (q->q_method != BOTZ_PUT) {
+    r->r_status = BOTZ_FORBIDDEN;
+    return BOTZ_RESPONSE_READY;
+  }
+
+  if (relay_status_put(rs, q, r) == 0 && strcmp(p->p_name, "_report") == 0)
+    relay_put_msgs(EV_A_ rs, &q->q_body);
+
+  return BOTZ_RESPONSE_READY;
+}
+
+static const struct botz_entry_ops relay_serv_ops = {
+  .o_lookup = &relay_serv_lookup_cb,
+  .o_method = {
+    [BOTZ_PUT] = &relay_put_cb,
+  }
+};
+
+/* Bytes from s to the next line starting a section, or to end. */
+static size_t relay_lines_len(char *s, char *end)
+{
+  size_t n = strlen(XLTOP_SERV_PREFIX);
+  char *e = s;
+
+  while (e < end && !((size_t) (end - e) >= n &&
+                      memcmp(e, XLTOP_SERV_PREFIX, n) == 0)) {
+    e = memchr(e, '\n', end - e);
+    e = e != NULL ? e + 1 : end;
+  }
+
+  return e - s;
+}
+
+/* PUT /serv/_batch from a relay below us, see serv_batch_cb() in
+   serv.c.  Sections are merged like reports, at our time, except
+   those from before the current interval (replays, or batches the
+   relay kept), which go upstream as they are with their time. */
+static void relay_batch_cb(EV_P_ struct botz_request *q,
+                           struct botz_response *r)
+{
+  struct relay_serv *rs = NULL;
+  const char *target = "";
+  double t_min = ev_periodic_at(&forward_w) - forward_w.interval;
+  size_t n = strlen(XLTOP_SERV_PREFIX);
+  struct n_buf lines;
+  char *msg, *name;
+  size_t msg_len;
+  double t;
+  int has_status, nr_sect = 0;
+
+  if (q->q_method != BOTZ_PUT) {
+    r->r_status = BOTZ_FORBIDDEN;
+    return;
+  }
+
+  while (n_buf_get_msg(&q->q_body, &msg, &msg_len) == 0) {
+    if (strncmp(msg, XLTOP_SERV_PREFIX, n) != 0) {
+      if (rs != NULL)
+        relay_msg(rs, msg, &target);
+      continue;
+    }
+
+    msg += n;
+    name = wsep(&msg);
+    if (name == NULL || msg == NULL ||
+        sscanf(msg, "%lf %d", &t, &has_status) != 2) {
+      TRACE("dropping section with bad header\n");
+      rs = NULL;
+      continue;
+    }
+
+    nr_sect++;
+
+    rs = relay_serv_lookup(name, L_CREATE);
+    if (rs == NULL) {
+      ERROR("cannot create serv `%s': %m\n", name);
+      continue;
+    }
+
+    target = "";
+
+    if (has_status && n_buf_get_msg(&q->q_body, &msg, &msg_len) == 0 &&
+        relay_status_set(rs, msg) == 0 && rs->rs_interval > 0)
+      n_buf_printf(&r->r_body, "%s %f %f\n",
+                   rs->rs_name, rs->rs_interval, rs->rs_offset);
+
+    if (t < t_min) {
+      lines = q->q_body;
+      lines.nb_end = lines.nb_start +
+        relay_lines_len(lines.nb_buf + lines.nb_start,
+                        lines.nb_buf + lines.nb_end);
+      q->q_body.nb_start = lines.nb_end;
+
+      if (relay_pending_add(rs, t, &lines) < 0)
+        ERROR("serv `%s', cannot keep section from %f: %m\n",
+              rs->rs_name, t);
+
+      rs = NULL;
+      continue;
+    }
+
+    rs->rs_time = ev_now(EV_A);
+  }
+
+  if (nr_sect == 0)
+    r->r_status = BOTZ_BAD_REQUEST;
+}
+
+static struct botz_entry *
+relay_dir_lookup_cb(EV_P_ struct botz_lookup *p,
+                          struct botz_request *q,
+                          struct botz_response *r)
+{
+  struct relay_serv *rs;
+
+  if (strcmp(p->p_name, "_batch") == 0 && p->p_rest == NULL) {
+    relay_batch_cb(EV_A_ q, r);
+    return BOTZ_RESPONSE_READY;
+  }
+
+  if (*p->p_name == '_')
+    return NULL;
+
+  /* Only a PUT brings a new serv. */
+  rs = relay_serv_lookup(p->p_name, q->q_method == BOTZ_PUT ? L_CREATE : 0);
+  if (rs == NULL) {
+    if (q->q_method == BOTZ_PUT)
+      ERROR("cannot create serv `%s': %m\n", p->p_name);
+    return NULL;
+  }
+
+  return botz_new_entry(p->p_name, &relay_serv_ops, rs);
+}
+
+static const struct botz_entry_ops relay_dir_ops = {
+  .o_lookup = &relay_dir_lookup_cb,
+};
+
+/* The master answers with "NAME INTERVAL OFFSET" lines. */
+static void relay_sched_set(struct curl_x_req *xr)
+{
+  struct relay_serv *rs;
+  double interval, offset;
+  char *msg, name[1024];
+  size_t msg_len;
+
+  while (n_buf_get_msg(&xr->xr_nb[1], &msg, &msg_len) == 0) {
+    if (sscanf(msg, "%1023s %lf %lf", name, &interval, &offset) != 3)
+      continue;
+
+    rs = relay_serv_lookup(name, 0);
+    if (rs == NULL)
+      continue;
+
+    if (rs->rs_interval != interval || rs->rs_offset != offset)
+      TRACE("serv `%s', interval %f, offset %f\n", name, interval, offset);
+
+    rs->rs_interval = interval;
+    rs->rs_offset = offset;
+  }
+}
+
+static void send_batch_cb(struct curl_x_req *xr, int rc)
+{
+  struct n_buf *nb = &xr->xr_nb[0];
+  N_BUF(z);
+
+  if (rc == 0) {
+    relay_sched_set(xr);
+    return;
+  }
+
+  if (xr->xr_code == 404)
+    ERROR("master does not take batches at `%s'\n", xr->xr_url);
+
+  /* Refused, it would be again.  Retry timeouts, throttling, server
+     errors and failed transfers. */
+  if (xr->xr_code >= 400 && xr->xr_code < 500 &&
+      xr->xr_code != 408 && xr->xr_code != 429) {
+    ERROR("master refused batch of %zu bytes with %ld, dropping%s\n",
+          nb->nb_end, xr->xr_code,
+          xr->xr_code == 413 ? " (lower --batch-size)" : "");
+    return;
+  }
+
+  /* Recover the batch as we built it. */
+  nb->nb_start = 0;
+  if (xr->xr_gzip) {
+    if (n_buf_inflate(&z, nb->nb_buf, nb->nb_end, RELAY_PENDING_SIZE) < 0)
+      ERROR("cannot decompress batch: %m\n");
+    nb = &z;
+  }
+
+  if (n_buf_length(&relay_pending) + n_buf_length(nb) > RELAY_PENDING_SIZE ||
+      n_buf_reserve(&relay_pending, n_buf_length(nb)) < 0)
+    ERROR("dropping batch of %zu bytes\n", n_buf_length(nb));
+  else
+    n_buf_write(&relay_pending, nb->nb_buf + nb->nb_start, n_buf_length(nb));
+
+  n_buf_destroy(&z);
+}
+
+/* Takes nb's buffer. */
+static void send_batch(struct n_buf *nb)
+{
+  const char *path = "/serv/_batch";
+
+  TRACE("sending batch of %zu bytes\n", n_buf_length(nb));
+
+  if (curl_x_put_async(&curl_x, path, NULL, nb, &send_batch_cb, NULL) < 0) {
+    ERROR("cannot PUT `%s': %m\n", path);
+
+    if (n_buf_length(&relay_pending) + n_buf_length(nb) <= RELAY_PENDING_SIZE &&
+        n_buf_reserve(&relay_pending, n_buf_length(nb)) == 0)
+      n_buf_write(&relay_pending, nb->nb_buf + nb->nb_start,
+                  n_buf_length(nb));
+  }
+
+  n_buf_destroy(nb);
+}
+
+/* Append len bytes of whole sections to nb, first sending nb if that
+   would take it past relay_batch_size. */
+static void batch_add(struct n_buf *nb, char *buf, size_t len)
+{
+  if (!n_buf_is_empty(nb) && n_buf_length(nb) + len > relay_batch_size)
+    send_batch(nb);
+
+  if (n_buf_reserve(nb, len) < 0) {
+    ERROR("dropping %zu bytes of batch: %m\n", len);
+    return;
+  }
+
+  n_buf_write(nb, buf, len);
+}
+
+/* Move relay_pending into batches a section at a time. */
+static void batch_add_pending(struct n_buf *nb)
+{
+  struct n_buf p = relay_pending;
+  char *s, *e, *end;
+
+  memset(&relay_pending, 0, sizeof(relay_pending));
+
+  s = p.nb_buf + p.nb_start;
+  end = p.nb_buf + p.nb_end;
+
+  while (s < end) {
+    e = memchr(s, '\n', end - s);
+    e = e != NULL ? e + 1 : end;
+    e += relay_lines_len(e, end);
+
+    batch_add(nb, s, e - s);
+    s = e;
+  }
+
+  n_buf_destroy(&p);
+}
+
+/* Print rs's section and forget its lines. */
+static void print_serv(FILE *file, struct relay_serv *rs)
+{
+  struct relay_line *l, *tmp;
+  const char *target = NULL;
+  size_t target_len = 0;
+
+  fprintf(file, XLTOP_SERV_PREFIX"%s %f %d\n",
+          rs->rs_name, rs->rs_time, rs->rs_status != NULL);
+
+  if (rs->rs_status != NULL)
+    fprintf(file, "%s\n", rs->rs_status);
+
+  free(rs->rs_status);
+  rs->rs_status = NULL;
+
+  list_for_each_entry_safe(l, tmp, &rs->rs_line_list, l_link) {
+    if (l->l_target_len > 0 && *l->l_nid == 0) {
+      target = l->l_target;
+      target_len = l->l_target_len;
+      fprintf(file, XLTOP_TARGET_PREFIX"%.*s "P_FMT"\n",
+              (int) target_len, target, P_ARG(l->l_stats));
+    } else {
+      if (l->l_target_len > 0 &&
+          (target == NULL || l->l_target_len != target_len ||
+           memcmp(l->l_target, target, target_len) != 0)) {
+        target = l->l_target;
+        target_len = l->l_target_len;
+        fprintf(file, XLTOP_TARGET_PREFIX"%.*s\n", (int) target_len, target);
+      }
+
+      fprintf(file, "%s "P_FMT"\n", l->l_nid, P_ARG(l->l_stats));
+    }
+
+    hlist_del(&l->l_hash_node);
+    list_del(&l->l_link);
+    free(l);
+    nr_line--;
+  }
+}
+
+static void forward(double now)
+{
+  struct relay_serv *rs;
+  FILE *file;
+  char *buf;
+  size_t len;
+  N_BUF(nb);
+
+  TRACE("now %f, %zu lines, %zu bytes pending\n",
+        now, nr_line, n_buf_length(&relay_pending));
+
+  if (curl_x.cx_nr_req > 0) {
+    /* Keep merging until the master catches up. */
+    ERROR("%zu batches still in flight, not forwarding\n", curl_x.cx_nr_req);
+    return;
+  }
+
+  if (!n_buf_is_empty(&relay_pending))
+    batch_add_pending(&nb);
+
+  nr_line_max = MAX(nr_line_max, nr_line);
+
+  list_for_each_entry(rs, &relay_serv_list, rs_link) {
+    if (rs->rs_status == NULL && list_empty(&rs->rs_line_list))
+      continue;
+
+    buf = NULL;
+    file = open_memstream(&buf, &len);
+    if (file == NULL) {
+      ERROR("cannot open memory stream: %m\n");
+      break;
+    }
+
+    print_serv(file, rs);
+    fclose(file);
+
+    batch_add(&nb, buf, len);
+    free(buf);
+  }
+
+  if (!n_buf_is_empty(&nb))
+    send_batch(&nb);
+
+  /* The table is empty now, so this is cheap. */
+  if (nr_line_max > (1ULL << relay_line_table.t_shift) ||
+      nr_line_max < (1ULL << relay_line_table.t_shift) / 8) {
+    if (str_table_resize(&relay_line_table, MAX(nr_line_max, (size_t) NR_LINE_HINT),
+                         struct relay_line, l_hash_node, l_key) < 0)
+      ERROR("cannot resize line table: %m\n");
+  }
+
+  nr_line_max = 0;
+}
+
+static void forward_cb(EV_P_ ev_periodic *w, int revents)
+{
+  forward(ev_now(EV_A));
+}
+
+static void sigterm_cb(EV_P_ ev_signal *w, int revents)
+{
+  ev_break(EV_A_ EVBREAK_ALL);
+}
+
+static void print_help(void)
+{
+  const char *p = program_invocation_short_name;
+
+  printf("Usage: %s [OPTION]...\n"
+	 "Mandatory arguments to long options are mandatory for short options too.\n"
+	 " -b, --bind=ADDR[:PORT]      listen for servds on ADDR (default %s:%s)\n"
+	 " -d, --daemon                detach and run in the background\n"
+	 " -h, --help                  display this help and exit\n"
+	 " -i, --interval=SECONDS      forward to master every SECONDS (default %.0f)\n"
+	 " -m, --master=HOST-OR-ADDR   connect to master on HOST-OR-ADDR (default %s)\n"
+	 " -P, --pidfile=PATH          write PID to PATH\n"
+	 " -p, --port=PORT             connect to master at PORT (default %s)\n"
+	 " -s, --batch-size=BYTES      start another PUT to master past BYTES (default %d)\n"
+	 " -v, --version               display version information and exit\n"
+	 " -z, --compress              gzip batches sent to master\n"
+	 "\nReport %s bugs to <%s>.\n"
+	 , p, RELAY_BIND, XLTOP_PORT, RELAY_INTERVAL,
+	 str_or(XLTOP_MASTER, "NONE"), XLTOP_PORT, RELAY_BATCH_SIZE,
+	 p, PACKAGE_BUGREPORT);
+}
+
+static void print_version(void)
+{
+  printf("%s (%s) %s\n", program_invocation_short_name,
+	 PACKAGE_NAME, PACKAGE_VERSION);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *m_host = XLTOP_MASTER, *m_port = XLTOP_PORT;
+  const char *b_arg = NULL;
+  struct ap_struct ap;
+  double interval = RELAY_INTERVAL;
+  int pidfile_fd = -1;
+  const char *pidfile_path = NULL;
+  int want_daemon = 0;
+  int want_compress = 0;
+
+  struct option opts[] = {
+    { "bind",     1, NULL, 'b' },
+    { "daemon",   0, NULL, 'd' },
+    { "help",     0, NULL, 'h' },
+    { "interval", 1, NULL, 'i' },
+    { "master",   1, NULL, 'm' },
+    { "pidfile",  1, NULL, 'P' },
+    { "port",     1, NULL, 'p' },
+    { "batch-size", 1, NULL, 's' },
+    { "version",  0, NULL, 'v' },
+    { "compress", 0, NULL, 'z' },
+    { NULL,       0, NULL,  0  },
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "b:dhi:m:P:p:s:vz", opts, 0)) > 0) {
+    switch (c) {
+    case 'b':
+      b_arg = optarg;
+      break;
+    case 'd':
+      want_daemon = 1;
+      break;
+    case 'h':
+      print_help();
+      exit(EXIT_SUCCESS);
+    case 'i':
+      interval = strtod(optarg, NULL);
+      if (interval <= 0)
+        FATAL("invalid interval `%s'\n", optarg);
+      break;
+    case 'm':
+      m_host = optarg;
+      break;
+    case 'P':
+      pidfile_path = optarg;
+      break;
+    case 'p':
+      m_port = optarg;
+      break;
+    case 's':
+      relay_batch_size = strtoul(optarg, NULL, 0);
+      if (relay_batch_size == 0)
+        FATAL("invalid batch size `%s'\n", optarg);
+      break;
+    case 'v':
+      print_version();
+      exit(EXIT_SUCCESS);
+    case 'z':
+      want_compress = 1;
+      break;
+    case '?':
+      FATAL("Try `%s --help' for more information.\n", program_invocation_short_name);
+    }
+  }
+
+  if (!str_is_set(m_host))
+    FATAL("no host or address specified for master\n");
+
+  if (!str_is_set(m_port))
+    FATAL("no port specified for master\n");
+
+  if (ap_parse(&ap, b_arg, RELAY_BIND, XLTOP_PORT) < 0)
+    FATAL("invalid bind address `%s'\n", b_arg);
+
+  if (hash_table_init(&relay_serv_table, NR_SERV_HINT) < 0)
+    FATAL("cannot initialize serv hash: %m\n");
+
+  if (hash_table_init(&relay_line_table, NR_LINE_HINT) < 0)
+    FATAL("cannot initialize line hash: %m\n");
+
+  int curl_rc = curl_global_init(CURL_GLOBAL_NOTHING);
+  if (curl_rc != 0)
+    FATAL("cannot initialize curl: %s\n", curl_easy_strerror(curl_rc));
+
+  if (curl_x_init(&curl_x, m_host, m_port) < 0)
+    FATAL("cannot initialize curl handle: %m\n");
+
+  curl_x.cx_put_gzip = want_compress;
+
+  if (botz_listen_init(&relay_listen, NR_SERV_HINT) < 0)
+    FATAL("cannot initialize listener: %m\n");
+
+  relay_listen.bl_conn_timeout = 600; /* XXX */
+
+  if (evx_listen_add_name(&relay_listen.bl_listen,
+                          ap.ap_addr, ap.ap_port, 0) < 0)
+    FATAL("cannot bind to host/address `%s', service/port `%s': %m\n",
+          ap.ap_addr, ap.ap_port);
+
+  if (botz_add(&relay_listen, "serv", &relay_dir_ops, NULL) < 0)
+    FATAL("cannot add listen entry `%s': %m\n", "serv");
+
+  signal(SIGPIPE, SIG_IGN);
+
+  evx_listen_start(EV_DEFAULT_ &relay_listen.bl_listen);
+
+  if (want_daemon && daemon(0, 0) < 0)
+    FATAL("cannot daemonize: %m\n");
+
+  if (pidfile_path != NULL) {
+    pidfile_fd = pidfile_create(pidfile_path);
+    if (pidfile_fd < 0)
+      FATAL("exiting\n");
+  }
+
+  if (curl_x_async_init(EV_DEFAULT_ &curl_x, MAX_BATCHES) < 0)
+    FATAL("cannot initialize curl multi handle: %m\n");
+
+  curl_x.cx_timeout_ms = interval * 1000;
+
+  static struct ev_signal sigterm_w;
+  ev_signal_init(&sigterm_w, &sigterm_cb, SIGTERM);
+  ev_signal_start(EV_DEFAULT_ &sigterm_w);
+
+  ev_periodic_init(&forward_w, &forward_cb, 0, interval, NULL);
+  ev_periodic_start(EV_DEFAULT_ &forward_w);
+
+  ev_run(EV_DEFAULT_ 0);
+
+  curl_x_destroy(&curl_x);
+  curl_global_cleanup();
+
+  if (pidfile_path != NULL)
+    unlink(pidfile_path);
+
+  FATAL("exiting\n");
+}
@@ -1,7 +1,12 @@
 #include <unistd.h>
 #include "xltop.h"
 #include "x_botz.h"
+#include "clus.h"
+#include "job.h"
 #include "lnet.h"
+#include "perf.h"
+#include "query.h"
+#include "serv_sched.h"
 #include "serv.h"
 #include "string1.h"
 #include "trace.h"
@@ -30,26 +35,107 @@ serv_create(const char *name, struct x_node *p, struct lnet_struct *l)
   return s;
 }
 
-static void serv_msg_cb(EV_P_ struct serv_node *s, char *msg)
+/* Jobids from job_stats become JOBID@CLUS under s's job cluster. */
+static struct x_node *
+serv_job_lookup(EV_P_ struct serv_node *s, const char *job_id)
+{
+  struct clus_node *c = s->s_job_clus;
+  struct job_node *j;
+  char name[256];
+
+  if (c == NULL)
+    return NULL;
+
+  if ((size_t) snprintf(name, sizeof(name), "%s@%s", job_id,
+                        c->c_x.x_name) >= sizeof(name))
+    return NULL;
+
+  j = job_lookup(name, &c->c_x, "NONE", "NONE", "0");
+  if (j == NULL)
+    return NULL;
+
+  job_touch(EV_A_ j);
+
+  return &j->j_x;
+}
+
+/* Targets follow their server on failover. */
+static struct x_node *
+serv_target_lookup(struct serv_node *s, const char *name)
+{
+  struct x_node *x = x_lookup(X_TARGET, name, &s->s_x, L_CREATE);
+
+  if (x != NULL && x->x_parent != &s->s_x)
+    x_set_parent(x, &s->s_x);
+
+  return x;
+}
+
+/* strtod() rather than sscanf(), which was half of ingest time. */
+static int serv_stats_parse(char *msg, double *d)
+{
+  char *end;
+  size_t i;
+
+  for (i = 0; i < NR_STATS; i++) {
+    d[i] = strtod(msg, &end);
+    if (end == msg)
+      return -1;
+    msg = end;
+  }
+
+  return 0;
+}
+
+/* *x1 is where lines go: s, or the target from the last target line.
+   Lines for s are the totals over targets.  A target line carries
+   what its top NIDs (the lines after it) leave out; these count only
+   against the target, at their job for hosts, as (host, target) pairs
+   would number hosts times targets.  Reports from servds that predate
+   targets have no target lines. */
+static void serv_msg_cb(EV_P_ struct serv_node *s, char *msg, double t,
+                        struct x_node **x1)
 {
   struct x_node *x;
   char *nid;
   double d[NR_STATS];
+  size_t n = strlen(XLTOP_JOB_PREFIX);
 
   nid = wsep(&msg);
-  if (nid == NULL || msg == NULL)
+  if (nid == NULL)
+    return;
+
+  if (strncmp(nid, XLTOP_TARGET_PREFIX, strlen(XLTOP_TARGET_PREFIX)) == 0) {
+    x = serv_target_lookup(s, nid + strlen(XLTOP_TARGET_PREFIX));
+    *x1 = (x != NULL) ? x : &s->s_x;
+
+    if (x != NULL && msg != NULL && serv_stats_parse(msg, d) == 0)
+      x_update_leaf(EV_A_ x_all[0], x, d, t);
+    return;
+  }
+
+  if (msg == NULL)
     return;
 
   TRACE("nid `%s', msg `%s'\n", nid, msg);
 
-  x = lnet_lookup_nid(s->s_lnet, nid, L_CREATE);
+  if (strncmp(nid, XLTOP_JOB_PREFIX, n) == 0)
+    x = serv_job_lookup(EV_A_ s, nid + n);
+  else
+    x = lnet_lookup_nid(s->s_lnet, nid, L_CREATE);
+
   if (x == NULL)
     return;
 
-  if (sscanf(msg, SCN_STATS_FMT("%lf"), SCN_STATS_ARG(d)) != NR_STATS)
+  if (serv_stats_parse(msg, d) < 0)
     return;
 
-  x_update(EV_A_ x, &s->s_x, d);
+  if (*x1 == &s->s_x)
+    x_update(EV_A_ x, *x1, d, t);
+  else if (x_is_type(x, X_HOST) && x->x_parent != NULL)
+    x_update_leaf(EV_A_ x->x_parent, *x1, d, t);
+  else
+    x_update_leaf(EV_A_ x, *x1, d, t);
 }
 
 static void
@@ -60,7 +146,9 @@ serv_get_r(struct n_buf *nb, struct x_node *x0, struct x_node *sx, double now)
   if (k == NULL)
     return;
 
-  if (x0->x_type == &x_types[X_HOST]) {
+  /* Jobs without hosts are reported directly from job_stats. */
+  if (x0->x_type == &x_types[X_HOST] ||
+      (x_is_job(x0) && x0->x_nr_child == 0)) {
     k_freshen(k, now);
     n_buf_printf(nb, PRI_K_NODE_FMT"\n", PRI_K_NODE_ARG(k));
   } else {
@@ -80,20 +168,59 @@ static void serv_get_cb(EV_P_ struct botz_entry *e,
   serv_get_r(&r->r_body, x_all[0], &s->s_x, ev_now(EV_A));
 }
 
+/* Finish a report of bytes from s begun at t0. */
+static void serv_put_end(EV_P_ struct serv_node *s, size_t bytes, double t0)
+{
+  sched_report(s, bytes, perf_now() - t0);
+}
+
+/* Fold the stats lines left in q's body into s's pairs at t. */
+static void serv_put_msgs(EV_P_ struct serv_node *s, struct botz_request *q,
+                          double t)
+{
+  struct x_node *x1 = &s->s_x;
+  size_t bytes = n_buf_length(&q->q_body);
+  double t0 = perf_now();
+  char *msg;
+  size_t msg_len;
+
+  s->s_modified = x_now(EV_A);
+
+  while (n_buf_get_msg(&q->q_body, &msg, &msg_len) == 0)
+    serv_msg_cb(EV_A_ s, msg, t, &x1);
+
+  serv_put_end(EV_A_ s, bytes, t0);
+}
+
 static void serv_put_cb(EV_P_ struct botz_entry *e,
                               struct botz_request *q,
                               struct botz_response *r)
 {
   struct serv_node *s = e->e_data;
-  char *msg;
-  size_t msg_len;
+  double now = x_now(EV_A), t;
+  double t0 = perf_now();
 
   /* TODO AUTH. */
 
-  s->s_modified = ev_now(EV_A);
+  /* time is set on reports replayed from a servd spool. */
+#define SERV_PUT_QUERY(X, Q) \
+  X(Q, 0, double, time, 0, q_double_parse, 0)
 
-  while (n_buf_get_msg(&q->q_body, &msg, &msg_len) == 0)
-    serv_msg_cb(EV_A_ s, msg);
+  DEFINE_QUERY(SERV_PUT_QUERY, serv_put_query);
+
+  if (QUERY_PARSE(SERV_PUT_QUERY, serv_put_query, q->q_query) < 0) {
+    r->r_status = BOTZ_BAD_REQUEST;
+    goto out;
+  }
+
+  t = serv_put_query[0].q_u.u_double;
+  if (!(t > 0 && t < now))
+    t = now;
+
+  serv_put_msgs(EV_A_ s, q, t);
+
+ out:
+  perf_hist_add(PERF_H_serv_put, t0);
 }
 
 static void serv_info_cb(struct serv_node *s,
@@ -106,42 +233,73 @@ static void serv_info_cb(struct serv_node *s,
                  "interval: %f\n"
                  "offset: %f\n"
                  "modified: %f\n"
+                 "cost: %f\n"
+                 "bytes: %.0f\n"
                  "lnet: %s\n",
                  /* TODO status. */
                  s->s_x.x_name,
                  s->s_interval,
                  s->s_offset,
                  s->s_modified,
+                 s->s_cost,
+                 s->s_bytes,
                  s->s_lnet->l_name);
   else
     r->r_status = BOTZ_FORBIDDEN;
 }
 
-static void serv_status_put_cb(struct serv_node *s,
-                               struct botz_request *q,
-                               struct botz_response *r)
+static int serv_status_set(struct serv_node *s, const char *msg)
+{
+  struct serv_status status = {};
+
+  if (sscanf(msg, SCN_SERV_STATUS_FMT, SCN_SERV_STATUS_ARG(status)) <
+      NR_SCN_SERV_STATUS_MIN_ARGS)
+    return -1;
+
+  memcpy(&s->s_status, &status, sizeof(status));
+
+  return 0;
+}
+
+/* Take the status line from the front of q's body and answer with
+   the interval and offset s should use. */
+static int serv_status_put(struct serv_node *s, struct botz_request *q,
+                           struct botz_response *r)
 {
   char *msg;
   size_t msg_len;
-  struct serv_status status;
 
   /* TODO AUTH. */
-  if (n_buf_get_msg(&q->q_body, &msg, &msg_len) != 0) {
-    r->r_status = BOTZ_BAD_REQUEST;
-    return;
-  }
-
-  if (sscanf(msg, SCN_SERV_STATUS_FMT, SCN_SERV_STATUS_ARG(status)) !=
-      NR_SCN_SERV_STATUS_ARGS) {
+  if (n_buf_get_msg(&q->q_body, &msg, &msg_len) != 0 ||
+      serv_status_set(s, msg) < 0) {
     r->r_status = BOTZ_BAD_REQUEST;
-    return;
+    return -1;
   }
 
   TRACE("serv `%s', sending interval %f, offset %f\n",
         s->s_x.x_name, s->s_interval, s->s_offset);
 
-  memcpy(&s->s_status, &status, sizeof(status));
   n_buf_printf(&r->r_body, "%f %f\n", s->s_interval, s->s_offset);
+
+  return 0;
+}
+
+/* PUT /serv/NAME/_report: a status line as for _status followed by
+   stats lines as for /serv/NAME, so one request per interval does the
+   work of both.  Answered like _status. */
+static void serv_report_cb(EV_P_ struct serv_node *s,
+                           struct botz_request *q,
+                           struct botz_response *r)
+{
+  if (q->q_method != BOTZ_PUT) {
+    r->r_status = BOTZ_FORBIDDEN;
+    return;
+  }
+
+  if (serv_status_put(s, q, r) < 0)
+    return;
+
+  serv_put_msgs(EV_A_ s, q, x_now(EV_A));
 }
 
 static void serv_status_cb(struct serv_node *s,
@@ -152,7 +310,7 @@ static void serv_status_cb(struct serv_node *s,
     n_buf_printf(&r->r_body, PRI_SERV_STATUS_FMT"\n",
                  PRI_SERV_STATUS_ARG(s->s_status));
   else if (q->q_method == BOTZ_PUT)
-    serv_status_put_cb(s, q, r);
+    serv_status_put(s, q, r);
   else
     r->r_status = BOTZ_FORBIDDEN;
 }
@@ -171,7 +329,18 @@ serv_entry_lookup_cb(EV_P_ struct botz_lookup *p,
   }
 
   if (strcmp(p->p_name, "_status") == 0 && p->p_rest == NULL) {
+    double t0 = perf_now();
+
     serv_status_cb(s, q, r);
+    perf_hist_add(PERF_H_serv_status, t0);
+    return BOTZ_RESPONSE_READY;
+  }
+
+  if (strcmp(p->p_name, "_report") == 0 && p->p_rest == NULL) {
+    double t0 = perf_now();
+
+    serv_report_cb(EV_A_ s, q, r);
+    perf_hist_add(PERF_H_serv_report, t0);
     return BOTZ_RESPONSE_READY;
   }
 
@@ -186,14 +355,104 @@ static const struct botz_entry_ops serv_entry_ops = {
   }
 };
 
+/* PUT /serv/_batch, from xltop-relay: the reports of many servers,
+   each starting with a line "serv:NAME TIME HAS_STATUS", followed by
+   a status line if HAS_STATUS, then stats lines as for /serv/NAME.
+   Answered with "NAME INTERVAL OFFSET" for each status taken.  Lines
+   of servers we don't know are dropped. */
+static void serv_batch_cb(EV_P_ struct botz_request *q,
+                          struct botz_response *r)
+{
+  struct serv_node *s = NULL;
+  struct x_node *x, *x1 = NULL;
+  double now = x_now(EV_A), t = now, t0 = 0;
+  size_t bytes = 0, n = strlen(XLTOP_SERV_PREFIX);
+  char *msg, *name;
+  size_t msg_len;
+  int has_status, nr_sect = 0;
+
+  if (q->q_method != BOTZ_PUT) {
+    r->r_status = BOTZ_FORBIDDEN;
+    return;
+  }
+
+  /* TODO AUTH. */
+
+  while (n_buf_get_msg(&q->q_body, &msg, &msg_len) == 0) {
+    if (strncmp(msg, XLTOP_SERV_PREFIX, n) != 0) {
+      if (s != NULL) {
+        bytes += msg_len + 1;
+        serv_msg_cb(EV_A_ s, msg, t, &x1);
+      }
+      continue;
+    }
+
+    if (s != NULL)
+      serv_put_end(EV_A_ s, bytes, t0);
+
+    s = NULL;
+    bytes = msg_len + 1;
+    t0 = perf_now();
+
+    msg += n;
+    name = wsep(&msg);
+    if (name == NULL || msg == NULL ||
+        sscanf(msg, "%lf %d", &t, &has_status) != 2) {
+      TRACE("dropping section with bad header\n");
+      continue;
+    }
+
+    nr_sect++;
+
+    if (!(t > 0 && t < now))
+      t = now;
+
+    x = x_lookup(X_SERV, name, NULL, 0);
+    if (x == NULL) {
+      TRACE("dropping report from unknown serv `%s'\n", name);
+      continue;
+    }
+
+    s = container_of(x, struct serv_node, s_x);
+    s->s_modified = now;
+    x1 = &s->s_x;
+
+    if (!has_status || n_buf_get_msg(&q->q_body, &msg, &msg_len) != 0)
+      continue;
+
+    bytes += msg_len + 1;
+    if (serv_status_set(s, msg) < 0)
+      continue;
+
+    n_buf_printf(&r->r_body, "%s %f %f\n",
+                 s->s_x.x_name, s->s_interval, s->s_offset);
+  }
+
+  if (s != NULL)
+    serv_put_end(EV_A_ s, bytes, t0);
+
+  if (nr_sect == 0)
+    r->r_status = BOTZ_BAD_REQUEST;
+}
+
 static struct botz_entry *
 serv_dir_lookup_cb(EV_P_ struct botz_lookup *p,
                          struct botz_request *q,
                          struct botz_response *r)
 {
-  struct x_node *x = x_lookup(X_SERV, p->p_name, NULL, 0);
+  struct x_node *x;
   struct serv_node *s;
 
+  if (strcmp(p->p_name, "_batch") == 0 && p->p_rest == NULL) {
+    double t0 = perf_now();
+
+    serv_batch_cb(EV_A_ q, r);
+    perf_hist_add(PERF_H_serv_batch, t0);
+    return BOTZ_RESPONSE_READY;
+  }
+
+  x = x_lookup(X_SERV, p->p_name, NULL, 0);
+
   TRACE("name `%s', x %p\n", p->p_name, x);
 
   if (x != NULL) {
@@ -4,12 +4,15 @@
 #include "x_node.h"
 #include "xltop.h"
 
+struct clus_node;
 struct lnet_struct;
 
 struct serv_node {
   struct serv_status s_status;
   double s_interval, s_offset, s_modified;
+  double s_cost, s_bytes; /* Smoothed ingest sec and bytes per report. */
   struct lnet_struct *s_lnet;
+  struct clus_node *s_job_clus; /* Of jobids from job_stats. */
   struct x_node s_x;
 };
 
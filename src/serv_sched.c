@@ -0,0 +1,236 @@
+#include "stddef1.h"
+#include <math.h>
+#include <malloc.h>
+#include <ev.h>
+#include "perf.h"
+#include "serv_sched.h"
+#include "serv.h"
+#include "string1.h"
+#include "trace.h"
+#include "x_node.h"
+
+/* Report schedule across all servers.  fs_cfg() spaces each
+   filesystem's servers over its own interval, so servers of different
+   filesystems report at the same offsets and ingest comes in bursts.
+
+   sched_run() places every live server on one ring of SCHED_SLOTS
+   slots spanning the longest interval, heaviest first, at the offset
+   whose slots are least loaded so far, and in the middle of the
+   longest run of such offsets.  A server's weight is its smoothed
+   ingest time per report; one not measured yet is weighted by its
+   report size at the overall cost per byte, or failing that by the
+   mean.  New offsets are taken only if they cut the peak slot load by
+   SCHED_GAIN, since each move costs the server a short interval.
+   Servers get their offset back from their next status PUT. */
+
+#define SCHED_PERIOD 60.0
+#define SCHED_SLOTS 256
+#define SCHED_GAIN 0.1
+#define SCHED_ALPHA 0.25 /* Smoothing of s_cost and s_bytes. */
+#define SCHED_LIVE 3 /* Intervals without a report before a server is dead. */
+
+struct sched_ent {
+  struct serv_node *e_s;
+  double e_weight, e_offset;
+};
+
+static struct ev_timer sched_w;
+
+void sched_report(struct serv_node *s, size_t bytes, double sec)
+{
+  if (s->s_cost == 0) {
+    s->s_cost = sec;
+    s->s_bytes = bytes;
+    return;
+  }
+
+  s->s_cost += SCHED_ALPHA * (sec - s->s_cost);
+  s->s_bytes += SCHED_ALPHA * (bytes - s->s_bytes);
+}
+
+static int sched_live(const struct serv_node *s, double now)
+{
+  return s->s_modified > 0 && now - s->s_modified < SCHED_LIVE * s->s_interval;
+}
+
+static int sched_ent_cmp(const void *p0, const void *p1)
+{
+  const struct sched_ent *e0 = p0, *e1 = p1;
+
+  if (e0->e_weight != e1->e_weight)
+    return e0->e_weight > e1->e_weight ? -1 : 1;
+
+  /* Keep runs with equal weights stable. */
+  return strcmp(e0->e_s->s_x.x_name, e1->e_s->s_x.x_name);
+}
+
+/* Add w to each slot that a server at offset o with interval i hits
+   during one period and return the largest (so w == 0 just looks). */
+static double sched_hit(double *load, double period, double o, double i,
+                        double w)
+{
+  double max = 0, t;
+  size_t j;
+
+  for (t = o; t < period; t += i) {
+    j = (size_t) (t * SCHED_SLOTS / period) % SCHED_SLOTS;
+    load[j] += w;
+    max = MAX(max, load[j]);
+  }
+
+  return max;
+}
+
+static double sched_peak(const double *load)
+{
+  double max = 0;
+  size_t j;
+
+  for (j = 0; j < SCHED_SLOTS; j++)
+    max = MAX(max, load[j]);
+
+  return max;
+}
+
+/* The candidate offset for e: the middle of the longest run of least
+   loaded slot offsets below its interval. */
+static double sched_place(double *load, double period,
+                          const struct sched_ent *e)
+{
+  double i = e->e_s->s_interval, step = period / SCHED_SLOTS;
+  double cost[SCHED_SLOTS], min = INFINITY;
+  size_t n = 0, j, run = 0, best = 0, best_end = 0;
+
+  for (j = 0; j < SCHED_SLOTS && j * step < i; j++, n++) {
+    cost[j] = sched_hit(load, period, j * step, i, 0);
+    min = MIN(min, cost[j]);
+  }
+
+  /* Runs may wrap around the end of the interval. */
+  for (j = 0; j < 2 * n; j++) {
+    if (cost[j % n] > min) {
+      run = 0;
+      continue;
+    }
+
+    if (++run > best && run <= n) {
+      best = run;
+      best_end = j;
+    }
+  }
+
+  j = (best_end + n - best / 2) % n;
+
+  return j * step;
+}
+
+static void sched_run(EV_P)
+{
+  struct hash_table *t = &x_types[X_SERV].x_hash_table;
+  struct hlist_node *node;
+  struct serv_node *s;
+  struct sched_ent *ev = NULL, *e;
+  double load[SCHED_SLOTS], now = ev_now(EV_A), period = 0;
+  double sum_cost = 0, sum_bytes = 0, mean, w, peak0, peak1;
+  size_t i, n = 0, nr_cost = 0, nr_live = 0;
+  struct x_node *x;
+
+  ev = malloc((x_types[X_SERV].x_nr + 1) * sizeof(ev[0]));
+  if (ev == NULL)
+    goto out;
+
+  /* Live servers, or all of them if none has reported yet. */
+  for (i = 0; i < (1ULL << t->t_shift); i++) {
+    hlist_for_each_entry(x, node, t->t_table + i, x_hash_node) {
+      s = container_of(x, struct serv_node, s_x);
+      nr_live += sched_live(s, now);
+    }
+  }
+
+  for (i = 0; i < (1ULL << t->t_shift); i++) {
+    hlist_for_each_entry(x, node, t->t_table + i, x_hash_node) {
+      s = container_of(x, struct serv_node, s_x);
+      if (!(s->s_interval > 0))
+        continue;
+
+      if (nr_live > 0 && !sched_live(s, now))
+        continue;
+
+      ev[n].e_s = s;
+      ev[n].e_weight = s->s_cost;
+      ev[n].e_offset = s->s_offset;
+      n++;
+
+      period = MAX(period, s->s_interval);
+
+      if (s->s_cost > 0) {
+        sum_cost += s->s_cost;
+        sum_bytes += s->s_bytes;
+        nr_cost++;
+      }
+    }
+  }
+
+  if (n == 0)
+    goto out;
+
+  mean = nr_cost > 0 ? sum_cost / nr_cost : 1;
+
+  for (e = ev; e < ev + n; e++) {
+    if (e->e_weight > 0)
+      continue;
+
+    w = e->e_s->s_bytes;
+    e->e_weight = (w > 0 && sum_bytes > 0) ? w * sum_cost / sum_bytes : mean;
+  }
+
+  qsort(ev, n, sizeof(ev[0]), &sched_ent_cmp);
+
+  memset(load, 0, sizeof(load));
+  for (e = ev; e < ev + n; e++)
+    sched_hit(load, period, e->e_offset, e->e_s->s_interval, e->e_weight);
+  peak0 = sched_peak(load);
+
+  memset(load, 0, sizeof(load));
+  for (e = ev; e < ev + n; e++) {
+    e->e_offset = sched_place(load, period, e);
+    sched_hit(load, period, e->e_offset, e->e_s->s_interval, e->e_weight);
+  }
+  peak1 = sched_peak(load);
+
+  PERF_INC(sched_run);
+
+  TRACE("%zu servers, period %f, peak %f usec, new peak %f usec\n",
+        n, period, peak0 * 1e6, peak1 * 1e6);
+
+  if (!(peak1 < (1 - SCHED_GAIN) * peak0))
+    goto out;
+
+  for (e = ev; e < ev + n; e++) {
+    s = e->e_s;
+    if (fabs(s->s_offset - e->e_offset) < period / SCHED_SLOTS / 2)
+      continue;
+
+    TRACE("serv `%s', offset %f -> %f, weight %f usec\n",
+          s->s_x.x_name, s->s_offset, e->e_offset, e->e_weight * 1e6);
+
+    s->s_offset = e->e_offset;
+    PERF_INC(sched_move);
+  }
+
+ out:
+  free(ev);
+}
+
+static void sched_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  sched_run(EV_A);
+}
+
+void sched_init(EV_P)
+{
+  sched_run(EV_A);
+
+  ev_timer_init(&sched_w, &sched_cb, SCHED_PERIOD, SCHED_PERIOD);
+  ev_timer_start(EV_A_ &sched_w);
+}
@@ -0,0 +1,14 @@
+#ifndef _SERV_SCHED_H_
+#define _SERV_SCHED_H_
+#include <stddef.h>
+#include <ev.h>
+
+struct serv_node;
+
+/* Fold one report of bytes that took sec to ingest into s's weight. */
+void sched_report(struct serv_node *s, size_t bytes, double sec);
+
+/* Schedule all servers now and then every SCHED_PERIOD seconds. */
+void sched_init(EV_P);
+
+#endif
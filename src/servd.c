@@ -4,24 +4,39 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <malloc.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <ev.h>
 #include "xltop.h"
 #include "hash.h"
 #include "list.h"
+#include "lstats.h"
 #include "n_buf.h"
 #include "string1.h"
 #include "trace.h"
 #include "curl_x.h"
 #include "pidfile.h"
+#include "spool.h"
 
 #define NR_LXT_HINT 16
 #define NR_NID_HINT 4096
+#define NR_JOB_HINT 256
 #define LXT_STATS_BUF_SIZE 4096
+#define LXT_DENTS_BUF_SIZE 65536
+#define LXT_JOB_BUF_SIZE 65536
+#define NID_FD_RESERVE 64 /* Left for curl, pidfile, directories. */
+#define NID_STALE_GENS 3 /* Failed collections before a NID is dropped. */
+#define MAX_REPORTS 8
+#define TARGET_TOP 16 /* NIDs (or jobs) reported per target. */
+#define SPOOL_SIZE (64 << 20)
 
 #define P_FMT PRI_STATS_FMT("%"PRId64)
 #define P_ARG PRI_STATS_ARG
@@ -31,13 +46,6 @@
 
 typedef int64_t lc_t; /* _s64 in Lustre source. */
 
-/* TODO Remove stale entries from l_hash_table. */
-
-static inline lc_t strtolc(const char *s)
-{
-  return strtoll(s, NULL, 10);
-}
-
 static char host_name[HOST_NAME_MAX + 1];
 static char *serv_name; /* Should be host_name. */
 
@@ -57,33 +65,98 @@ static inline int debug_nid(const char *nid)
 static size_t nr_nid_hint = NR_NID_HINT;
 static struct hash_table nid_hash_table;
 
+/* With -j, targets that have a job_stats file are reported by jobid
+   from it (into job_hash_table) instead of by NID. */
+static int want_job_stats;
+static struct hash_table job_hash_table;
+static size_t nr_job;
+
 static LIST_HEAD(lxt_list);
 static struct hash_table lxt_hash_table;
+static size_t target_top = TARGET_TOP;
 
+/* In an lxt's l_hash_table, ns_fd is the stats file held open
+   across intervals and ns_fd_link is on the lxt's l_fd_list in least
+   recently read order.  Unused in nid_hash_table.  Entries in the job
+   tables hold a jobid in ns_nid. */
 struct nid_stats {
   struct hlist_node ns_hash_node;
+  struct list_head ns_fd_link;
+  int ns_fd;
   lc_t ns_stats[NR_STATS];
   double ns_time;
+  unsigned long ns_scan;
+  unsigned long ns_gen; /* l_gen of the last good read, in l_hash_table. */
   char ns_nid[];
 };
 
+static size_t nid_fd_max = 1024 - NID_FD_RESERVE;
+static size_t nr_nid_fd;
+
 #define LXT_TYPE_MDS 0
 #define LXT_TYPE_MDT 1
 #define LXT_TYPE_OST 2
-static const char *top_dir_path[] = {
-  [LXT_TYPE_MDS] = "/proc/fs/lustre/mds",
-  [LXT_TYPE_MDT] = "/proc/fs/lustre/mdt",
-  [LXT_TYPE_OST] = "/proc/fs/lustre/obdfilter",
+#define NR_LXT_TYPES 3
+static const char *top_dir_name[NR_LXT_TYPES] = {
+  [LXT_TYPE_MDS] = "mds",
+  [LXT_TYPE_MDT] = "mdt",
+  [LXT_TYPE_OST] = "obdfilter",
+};
+
+/* Under lustre_root, which --root changes (e.g. to a tree made by
+   fake_lustre). */
+static const char *lustre_root = "/proc/fs/lustre";
+static char *top_dir_path[NR_LXT_TYPES];
+
+/* Change in a NID's counters since the last collection, recorded by
+   a worker and merged into nid_hash_table on the main thread. */
+struct lxt_delta {
+  struct nid_stats *d_ts;
+  lc_t d_stats[NR_STATS];
 };
 
 struct lxt {
   struct hash_table l_hash_table;
   struct hlist_node l_hash_node;
   struct list_head l_link;
-  unsigned int l_type:1;
+  struct lxt_delta *l_delta;
+  size_t l_nr_delta, l_delta_size;
+  struct list_head l_fd_list;
+  int l_dir_fd; /* O_DIRECTORY fd of the exports directory. */
+  unsigned long l_scan;
+  unsigned long l_gen; /* Collections by NID. */
+  size_t l_nr_nid; /* In l_hash_table. */
+  struct timespec l_dir_mtime;
+  nlink_t l_dir_nlink;
+  struct hash_table l_job_table;
+  int l_job_fd;
+  unsigned long l_job_scan;
+  double l_job_time; /* Of the last full read of job_stats. */
+  size_t l_nr_open, l_read_bytes; /* This collection, for serv_status. */
+  size_t l_nr_syscall; /* Of open, read, seek, stat and getdents. */
+  unsigned int l_type:1, l_jobs:1; /* l_delta is by jobid. */
   char l_name[];
 };
 
+/* Collection is split into one job per target, run by nr_threads
+   threads (including the main thread). */
+struct collect_job {
+  struct lxt *j_lxt;
+  int j_rc;
+  char j_path[PATH_MAX];
+  char j_job_path[PATH_MAX];
+};
+
+static size_t nr_threads = 1;
+static pthread_mutex_t collect_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t collect_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t collect_done_cond = PTHREAD_COND_INITIALIZER;
+static struct collect_job *collect_job;
+static size_t collect_nr_job, collect_job_size, collect_next, collect_nr_done;
+static unsigned long collect_gen;
+static double collect_now;
+static size_t collect_nr_syscall; /* Of the last collect_all(). */
+
 static struct nid_stats *
 nid_stats_lookup(struct hash_table *t, const char *nid)
 {
@@ -100,6 +173,8 @@ nid_stats_lookup(struct hash_table *t, const char *nid)
     goto out;
 
   memset(ns, 0, sizeof(*ns));
+  INIT_LIST_HEAD(&ns->ns_fd_link);
+  ns->ns_fd = -1;
   strcpy(ns->ns_nid, nid);
   hlist_add_head(&ns->ns_hash_node, head);
 
@@ -107,69 +182,93 @@ nid_stats_lookup(struct hash_table *t, const char *nid)
   return ns;
 }
 
+static void nid_stats_close(struct nid_stats *ns)
+{
+  if (ns->ns_fd < 0)
+    return;
+
+  close(ns->ns_fd);
+  ns->ns_fd = -1;
+  list_del_init(&ns->ns_fd_link);
+  __sync_fetch_and_sub(&nr_nid_fd, 1);
+}
+
 static void nid_stats_delete(struct nid_stats *ns)
 {
   TRACE("deleting nid_stats `%s'\n", ns->ns_nid);
 
+  nid_stats_close(ns);
   hlist_del(&ns->ns_hash_node);
   free(ns);
 }
 
-/* Assumes we're already in the target directory. */
-static int nid_stats_read(const char *nid, lc_t *stats)
+/* Open NID/stats under l's exports directory unless ts already holds
+   it.  Past nid_fd_max the target's least recently read fd is closed
+   first, so the total can overshoot by at most one fd per target. */
+static int nid_stats_open(struct lxt *l, const char *exp_dir_path,
+                          struct nid_stats *ts)
 {
-  char buf[LXT_STATS_BUF_SIZE];
-  struct n_buf nb = {
-    .nb_buf = buf,
-    .nb_size = sizeof(buf),
-  };
   char path[256];
-  int rc = -1, fd = -1, err = 0, eof = 0;
-
-  memset(stats, 0, NR_STATS * sizeof(*stats));
 
-  snprintf(path, sizeof(path), "%s/stats", nid);
-  fd = open(path, O_RDONLY);
-  if (fd < 0) {
-    ERROR("cannot open %s: %m\n", path);
-    goto err;
+  if (!(ts->ns_fd < 0)) {
+    list_move_tail(&ts->ns_fd_link, &l->l_fd_list);
+    return 0;
   }
 
-  n_buf_fill(&nb, fd, &err, &eof);
-  if (err != 0) {
-    ERROR("error reading from `%s': %m\n", path);
-    goto err;
+  if (nr_nid_fd >= nid_fd_max && !list_empty(&l->l_fd_list))
+    nid_stats_close(list_entry(l->l_fd_list.next, struct nid_stats,
+                               ns_fd_link));
+
+  snprintf(path, sizeof(path), "%s/stats", ts->ns_nid);
+  ts->ns_fd = openat(l->l_dir_fd, path, O_RDONLY|O_CLOEXEC);
+  l->l_nr_open++;
+  l->l_nr_syscall++;
+  if (ts->ns_fd < 0) {
+    ERROR("cannot open %s/%s: %m\n", exp_dir_path, path);
+    return -1;
   }
 
-  char *msg;
-  size_t msg_len;
+  __sync_fetch_and_add(&nr_nid_fd, 1);
+  list_add_tail(&ts->ns_fd_link, &l->l_fd_list);
 
-  while (n_buf_get_msg(&nb, &msg, &msg_len) == 0) {
-    char *ctr, *req, *ign, *unit, *min, *max, *sum;
-    int n = split(&msg, &ctr, &req, &ign, &unit, &min, &max, &sum,
-                  (char **) NULL);
+  return 0;
+}
 
-    if (n < 4 || strcmp(ctr, "ping") == 0)
-      continue;
+/* Procfs seq files are regenerated by a read from offset 0, so the
+   fd from nid_stats_open() is reread with a single pread() per
+   interval.  nb is the calling thread's scratch buffer. */
+static int nid_stats_read(struct lxt *l, const char *exp_dir_path,
+                          struct nid_stats *ts, lc_t *stats,
+                          struct n_buf *nb)
+{
+  const char *nid = ts->ns_nid;
+  ssize_t nr;
+  int rc = -1;
 
-    if (strcmp(unit, "[reqs]") == 0)
-      stats[STAT_NR_REQS] += strtolc(req);
+  memset(stats, 0, NR_STATS * sizeof(*stats));
+  n_buf_clear(nb);
 
-    if (n < 7 || strcmp(unit, "[bytes]") != 0)
-      continue;
+  if (nid_stats_open(l, exp_dir_path, ts) < 0)
+    goto err;
 
-    if (strcmp(ctr, "write_bytes") == 0)
-      stats[STAT_WR_BYTES] += strtolc(sum);
-    else if (strcmp(ctr, "read_bytes") == 0)
-      stats[STAT_RD_BYTES] += strtolc(sum);
+  do {
+    nr = pread(ts->ns_fd, nb->nb_buf, nb->nb_size, 0);
+    l->l_nr_syscall++;
+  } while (nr < 0 && errno == EINTR);
+
+  if (nr < 0) {
+    ERROR("error reading from `%s/%s/stats': %m\n", exp_dir_path, nid);
+    nid_stats_close(ts);
+    goto err;
   }
 
+  nb->nb_end = nr;
+  l->l_read_bytes += nr;
+  lstats_parse(stats, nb->nb_buf, nb->nb_end);
+
   rc = 0;
  err:
 
-  if (!(fd < 0))
-    close(fd);
-
   return rc;
 }
 
@@ -192,6 +291,22 @@ static void lxt_delete(struct lxt *l)
       nid_stats_delete(ns);
   free(t->t_table);
 
+  t = &l->l_job_table;
+  if (t->t_table != NULL) {
+    for (i = 0; i < (1ULL << t->t_shift); i++)
+      hlist_for_each_entry_safe(ns, node, tmp, t->t_table + i, ns_hash_node)
+        nid_stats_delete(ns);
+    free(t->t_table);
+  }
+
+  free(l->l_delta);
+
+  if (!(l->l_dir_fd < 0))
+    close(l->l_dir_fd);
+
+  if (!(l->l_job_fd < 0))
+    close(l->l_job_fd);
+
   hlist_del(&l->l_hash_node);
   list_del(&l->l_link);
   free(l);
@@ -215,6 +330,9 @@ struct lxt *lxt_lookup(const char *name, int type)
 
   memset(l, 0, sizeof(*l));
   strcpy(l->l_name, name);
+  INIT_LIST_HEAD(&l->l_fd_list);
+  l->l_dir_fd = -1;
+  l->l_job_fd = -1;
 
   size_t hint = MAX(serv_status.ss_nr_nid, nr_nid_hint);
 
@@ -241,24 +359,44 @@ struct lxt *lxt_lookup(const char *name, int type)
   return NULL;
 }
 
-static void lxt_collect_nid(struct lxt *l, const char *nid, double now)
+static struct lxt_delta *lxt_delta_add(struct lxt *l, struct nid_stats *ts)
 {
-  struct nid_stats *ts, *ns;
+  struct lxt_delta *d;
+
+  if (l->l_nr_delta == l->l_delta_size) {
+    size_t size = MAX(2 * l->l_delta_size, (size_t) 64);
+
+    d = realloc(l->l_delta, size * sizeof(*d));
+    if (d == NULL)
+      return NULL;
+
+    l->l_delta = d;
+    l->l_delta_size = size;
+  }
+
+  d = &l->l_delta[l->l_nr_delta++];
+  d->d_ts = ts;
+
+  return d;
+}
+
+/* Runs on a worker thread; touches only l and nb. */
+static void lxt_collect_nid(struct lxt *l, const char *exp_dir_path,
+                            struct nid_stats *ts, double now,
+                            struct n_buf *nb)
+{
+  const char *nid = ts->ns_nid;
+  struct lxt_delta *d;
   lc_t stats[NR_STATS];
   int i;
 
-  if (debug_nid(nid)) {
-    char cwd[256];
-    getcwd(cwd, sizeof(cwd));
-    TRACE("nid `%s' now %f, cwd `%s'\n", nid, now, cwd);
-  }
+  if (debug_nid(nid))
+    TRACE("nid `%s' now %f, dir `%s'\n", nid, now, exp_dir_path);
 
-  if (nid_stats_read(nid, stats) < 0)
+  if (nid_stats_read(l, exp_dir_path, ts, stats, nb) < 0)
     return;
 
-  ts = nid_stats_lookup(&l->l_hash_table, nid);
-  if (ts == NULL)
-    return;
+  ts->ns_gen = l->l_gen;
 
   if (debug_nid(nid))
     TRACE("ts time %f\n"
@@ -270,66 +408,462 @@ static void lxt_collect_nid(struct lxt *l, const char *nid, double now)
   if (ts->ns_time == 0)
     goto out;
 
-  ns = nid_stats_lookup(&nid_hash_table, nid);
-  if (ns == NULL)
+  d = lxt_delta_add(l, ts);
+  if (d == NULL)
     goto out;
 
-  if (ns->ns_time == 0)
-    serv_status.ss_nr_nid++;
+  for (i = 0; i < NR_STATS; i++)
+    d->d_stats[i] = stats[i] - ts->ns_stats[i];
 
-  if (debug_nid(nid))
-    TRACE("ns time %f, old stats "P_FMT"\n",
-          ns->ns_time, P_ARG(ns->ns_stats));
+ out:
+  memcpy(ts->ns_stats, stats, sizeof(stats));
+  ts->ns_time = now;
+}
+
+/* Main thread: fold the deltas from l into nid_hash_table (or
+   job_hash_table), the totals over targets.  l_delta itself is kept
+   for the per target part of print_stats(). */
+static void lxt_merge(struct lxt *l, double now)
+{
+  struct hash_table *t = l->l_jobs ? &job_hash_table : &nid_hash_table;
+  size_t *nr = l->l_jobs ? &nr_job : &serv_status.ss_nr_nid;
+  struct lxt_delta *d;
+  struct nid_stats *ns;
+  const char *nid;
+  int i;
+
+  for (d = l->l_delta; d < l->l_delta + l->l_nr_delta; d++) {
+    nid = d->d_ts->ns_nid;
+
+    ns = nid_stats_lookup(t, nid);
+    if (ns == NULL)
+      continue;
+
+    if (ns->ns_time == 0)
+      (*nr)++;
+
+    if (debug_nid(nid))
+      TRACE("ns time %f, old stats "P_FMT"\n",
+            ns->ns_time, P_ARG(ns->ns_stats));
+
+    if (ns->ns_time != now) {
+      ns->ns_time = now;
+      memset(ns->ns_stats, 0, sizeof(ns->ns_stats));
+  }
+
+    for (i = 0; i < NR_STATS; i++)
+      ns->ns_stats[i] += d->d_stats[i];
+
+    if (debug_nid(nid))
+      TRACE("ns time %f, new stats "P_FMT"\n",
+            ns->ns_time, P_ARG(ns->ns_stats));
+  }
+}
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/* Re-enumerate the NIDs under l's exports directory, adding new ones
+   to l_hash_table and dropping those that went away. */
+static int lxt_scan(struct lxt *l, const char *exp_dir_path)
+{
+  char buf[LXT_DENTS_BUF_SIZE];
+  struct hash_table *t = &l->l_hash_table;
+  struct hlist_node *node, *tmp;
+  struct linux_dirent64 *de;
+  struct nid_stats *ts;
+  long i, n;
+
+  TRACE("scanning `%s'\n", exp_dir_path);
+
+  l->l_nr_syscall++;
+  if (lseek(l->l_dir_fd, 0, SEEK_SET) < 0)
+    goto err;
+
+  l->l_scan++;
+
+  while ((n = syscall(SYS_getdents64, l->l_dir_fd, buf, sizeof(buf))) > 0) {
+    l->l_nr_syscall++;
+    for (i = 0; i < n; i += de->d_reclen) {
+      de = (struct linux_dirent64 *) (buf + i);
+
+      if (de->d_type != DT_DIR || de->d_name[0] == '.')
+        continue;
+
+      ts = nid_stats_lookup(t, de->d_name);
+      if (ts == NULL)
+        continue;
+
+      if (ts->ns_scan == 0) {
+        ts->ns_gen = l->l_gen;
+        l->l_nr_nid++;
+      }
+
+      ts->ns_scan = l->l_scan;
+    }
+  }
+
+  l->l_nr_syscall++;
+  if (n < 0)
+    goto err;
 
-  if (ns->ns_time != now) {
-    ns->ns_time = now;
-    memset(ns->ns_stats, 0, sizeof(ns->ns_stats));
+  for (i = 0; i < (1L << t->t_shift); i++) {
+    hlist_for_each_entry_safe(ts, node, tmp, t->t_table + i, ns_hash_node) {
+      if (ts->ns_scan != l->l_scan) {
+        nid_stats_delete(ts);
+        l->l_nr_nid--;
+      }
+    }
   }
 
+  return 0;
+
+ err:
+  ERROR("cannot read directory `%s': %m\n", exp_dir_path);
+
+  return -1;
+}
+
+struct lxt_job_pass {
+  struct lxt *jp_lxt;
+  double jp_now;
+};
+
+/* Runs on a worker thread, called by the job_stats parser once per
+   job.  Jobs that show up after a target's first read are reported in
+   full, so short jobs count from the interval they are first seen
+   in; counters that went backwards belong to a job whose entry
+   Lustre expired and recreated. */
+static void lxt_collect_job(void *data, const char *job_id,
+                            const int64_t *stats)
+{
+  struct lxt_job_pass *jp = data;
+  struct lxt *l = jp->jp_lxt;
+  struct nid_stats *ts;
+  struct lxt_delta *d;
+  int i, reset = 0;
+
+  ts = nid_stats_lookup(&l->l_job_table, job_id);
+  if (ts == NULL)
+    return;
+
+  ts->ns_scan = l->l_job_scan;
+
+  if (ts->ns_time == 0 && l->l_job_time == 0)
+    goto out;
+
+  d = lxt_delta_add(l, ts);
+  if (d == NULL)
+    goto out;
+
   for (i = 0; i < NR_STATS; i++)
-    ns->ns_stats[i] += stats[i] - ts->ns_stats[i];
+    if (stats[i] < ts->ns_stats[i])
+      reset = 1;
 
-  if (debug_nid(nid))
-    TRACE("ns time %f, new stats "P_FMT"\n",
-          ns->ns_time, P_ARG(ns->ns_stats));
+  for (i = 0; i < NR_STATS; i++)
+    d->d_stats[i] = stats[i] - (reset ? 0 : ts->ns_stats[i]);
 
  out:
-  memcpy(ts->ns_stats, stats, sizeof(stats));
-  ts->ns_time = now;
+  memcpy(ts->ns_stats, stats, sizeof(ts->ns_stats));
+  ts->ns_time = jp->jp_now;
 }
 
-static int lxt_collect(struct lxt *l, const char *exp_dir_path, double now)
+/* Read l's job_stats file through the streaming parser, which may be
+   large on busy targets.  Fails quietly if there isn't one. */
+static int lxt_collect_jobs(struct lxt *l, const char *job_path, double now)
 {
-  DIR *exp_dir = NULL;
-  struct dirent *de;
-  int rc = -1;
+  char buf[LXT_JOB_BUF_SIZE];
+  struct lxt_job_pass jp = { .jp_lxt = l, .jp_now = now };
+  struct lstats_job_parser p;
+  struct hash_table *t = &l->l_job_table;
+  struct hlist_node *node, *tmp;
+  struct nid_stats *ts;
+  size_t i, nr_delta = l->l_nr_delta;
+  ssize_t nr;
+
+  if (t->t_table == NULL && hash_table_init(t, NR_JOB_HINT) < 0)
+    return -1;
+
+  if (l->l_job_fd < 0) {
+    l->l_job_fd = open(job_path, O_RDONLY|O_CLOEXEC);
+    l->l_nr_open++;
+    l->l_nr_syscall++;
+    if (l->l_job_fd < 0) {
+      if (errno != ENOENT)
+        ERROR("cannot open `%s': %m\n", job_path);
+      return -1;
+    }
+  }
 
-  if (chdir(exp_dir_path) < 0) {
-    ERROR("cannot chdir to `%s': %m\n", exp_dir_path);
+  l->l_nr_syscall++;
+  if (lseek(l->l_job_fd, 0, SEEK_SET) < 0)
     goto err;
+
+  l->l_job_scan++;
+  lstats_job_init(&p, &lxt_collect_job, &jp);
+
+  while ((nr = read(l->l_job_fd, buf, sizeof(buf))) != 0) {
+    l->l_nr_syscall++;
+    if (nr < 0 && errno == EINTR)
+      continue;
+
+    if (nr < 0)
+      goto err;
+
+    l->l_read_bytes += nr;
+    lstats_job_feed(&p, buf, nr);
   }
 
-  exp_dir = opendir(".");
-  if (exp_dir == NULL) {
-    ERROR("cannot open `%s': %m\n", ".");
+  l->l_nr_syscall++; /* The read() at EOF. */
+  lstats_job_end(&p);
+
+  for (i = 0; i < (1ULL << t->t_shift); i++)
+    hlist_for_each_entry_safe(ts, node, tmp, t->t_table + i, ns_hash_node)
+      if (ts->ns_scan != l->l_job_scan)
+        nid_stats_delete(ts);
+
+  l->l_job_time = now;
+
+  return 0;
+
+ err:
+  ERROR("error reading from `%s': %m\n", job_path);
+  l->l_nr_delta = nr_delta;
+  close(l->l_job_fd);
+  l->l_job_fd = -1;
+
+  return -1;
+}
+
+/* Make the next read of each entry of t only set its baseline. */
+static void stats_table_forget(struct hash_table *t)
+{
+  struct hlist_node *node;
+  struct nid_stats *ts;
+  size_t i;
+
+  if (t->t_table == NULL)
+    return;
+
+  for (i = 0; i < (1ULL << t->t_shift); i++)
+    hlist_for_each_entry(ts, node, t->t_table + i, ns_hash_node)
+      ts->ns_time = 0;
+}
+
+/* Rescans only when the directory's mtime or link count changed.  A
+   target switching between job and NID collection (job_stats could
+   not be read) forgets the baselines of the mode it leaves, which
+   would be stale when it comes back. */
+static int lxt_collect(struct lxt *l, const char *exp_dir_path,
+                       const char *job_path, double now, struct n_buf *nb)
+{
+  struct hash_table *t = &l->l_hash_table;
+  struct hlist_node *node, *tmp;
+  struct nid_stats *ts;
+  struct stat st;
+  size_t i, len;
+  int was_jobs = l->l_jobs;
+
+  l->l_nr_delta = 0;
+  l->l_nr_open = 0;
+  l->l_read_bytes = 0;
+  l->l_nr_syscall = 0;
+  l->l_jobs = want_job_stats && lxt_collect_jobs(l, job_path, now) == 0;
+
+  if (l->l_jobs && !was_jobs)
+    stats_table_forget(&l->l_hash_table);
+
+  if (!l->l_jobs && was_jobs) {
+    stats_table_forget(&l->l_job_table);
+    l->l_job_time = 0;
+  }
+
+  if (l->l_jobs)
+    return 0;
+
+  if (l->l_dir_fd < 0) {
+    l->l_dir_fd = open(exp_dir_path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    l->l_nr_open++;
+    l->l_nr_syscall++;
+    if (l->l_dir_fd < 0) {
+      ERROR("cannot open `%s': %m\n", exp_dir_path);
+      return -1;
+    }
+    l->l_dir_nlink = 0;
+  }
+
+  l->l_nr_syscall++;
+  if (fstat(l->l_dir_fd, &st) < 0) {
+    ERROR("cannot stat `%s': %m\n", exp_dir_path);
     goto err;
   }
 
-  while ((de = readdir(exp_dir)) != NULL)
-    if (de->d_type == DT_DIR && de->d_name[0] != '.')
-      lxt_collect_nid(l, de->d_name, now);
+  if (st.st_nlink != l->l_dir_nlink ||
+      st.st_mtim.tv_sec != l->l_dir_mtime.tv_sec ||
+      st.st_mtim.tv_nsec != l->l_dir_mtime.tv_nsec) {
+    if (lxt_scan(l, exp_dir_path) < 0)
+      goto err;
 
-  rc = 0;
+    l->l_dir_mtime = st.st_mtim;
+    l->l_dir_nlink = st.st_nlink;
+  }
+
+  /* A NID whose stats file could not be read for NID_STALE_GENS
+     collections in a row is dropped here, since the directory scan
+     only runs when the directory changes. */
+  l->l_gen++;
+
+  for (i = 0; i < (1ULL << t->t_shift); i++) {
+    hlist_for_each_entry_safe(ts, node, tmp, t->t_table + i, ns_hash_node) {
+      lxt_collect_nid(l, exp_dir_path, ts, now, nb);
+
+      if (l->l_gen - ts->ns_gen >= NID_STALE_GENS) {
+        TRACE("dropping stale nid `%s' from `%s'\n", ts->ns_nid, l->l_name);
+        nid_stats_delete(ts);
+        l->l_nr_nid--;
+      }
+    }
+  }
+
+  /* Keep the load between 1/8 and 1 as clients come and go. */
+  len = 1ULL << t->t_shift;
+  if ((l->l_nr_nid > len || l->l_nr_nid < len / 8) &&
+      str_table_resize(t, l->l_nr_nid, struct nid_stats, ns_hash_node,
+                       ns_nid) < 0)
+    ERROR("cannot resize nid table of `%s': %m\n", l->l_name);
+
+  return 0;
 
  err:
-  if (exp_dir != NULL)
-    closedir(exp_dir);
+  /* Reopen next time in case the target was remounted. */
+  close(l->l_dir_fd);
+  l->l_dir_fd = -1;
 
-  return rc;
+  return -1;
+}
+
+/* Called with collect_mutex held; runs jobs until none are left. */
+static void collect_jobs(struct n_buf *nb)
+{
+  struct collect_job *j;
+
+  while (collect_next < collect_nr_job) {
+    j = &collect_job[collect_next++];
+
+    pthread_mutex_unlock(&collect_mutex);
+    j->j_rc = lxt_collect(j->j_lxt, j->j_path, j->j_job_path, collect_now,
+                          nb);
+    pthread_mutex_lock(&collect_mutex);
+
+    if (++collect_nr_done == collect_nr_job)
+      pthread_cond_signal(&collect_done_cond);
+  }
+}
+
+static void *collect_thread(void *arg)
+{
+  char buf[LXT_STATS_BUF_SIZE];
+  struct n_buf nb = {
+    .nb_buf = buf,
+    .nb_size = sizeof(buf),
+  };
+  unsigned long gen = 0;
+
+  pthread_mutex_lock(&collect_mutex);
+  while (1) {
+    while (gen == collect_gen)
+      pthread_cond_wait(&collect_work_cond, &collect_mutex);
+
+    gen = collect_gen;
+    collect_jobs(&nb);
+  }
+
+  return NULL;
+}
+
+/* Raise the soft RLIMIT_NOFILE to the hard limit and size the stats
+   fd cache from it. */
+static void nid_fd_init(void)
+{
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+    return;
+
+  if (rl.rlim_cur < rl.rlim_max) {
+    struct rlimit want = { .rlim_cur = rl.rlim_max, .rlim_max = rl.rlim_max };
+
+    if (setrlimit(RLIMIT_NOFILE, &want) == 0)
+      rl = want;
+  }
+
+  if (rl.rlim_cur > NID_FD_RESERVE)
+    nid_fd_max = MIN(rl.rlim_cur, (rlim_t) INT_MAX) - NID_FD_RESERVE;
+  else
+    nid_fd_max = 0;
+
+  TRACE("nid_fd_max %zu\n", nid_fd_max);
+}
+
+/* Workers block all signals so that libev sees them on the main
+   thread. */
+static int collect_pool_init(void)
+{
+  sigset_t set, old_set;
+  pthread_t tid;
+  size_t i;
+  int err = 0;
+
+  sigfillset(&set);
+  pthread_sigmask(SIG_SETMASK, &set, &old_set);
+
+  for (i = 1; i < nr_threads && err == 0; i++) {
+    err = pthread_create(&tid, NULL, &collect_thread, NULL);
+    if (err == 0)
+      pthread_detach(tid);
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+
+  return 0;
+}
+
+static struct collect_job *collect_job_add(void)
+{
+  if (collect_nr_job == collect_job_size) {
+    size_t size = MAX(2 * collect_job_size, (size_t) 64);
+    struct collect_job *j;
+
+    j = realloc(collect_job, size * sizeof(*j));
+    if (j == NULL)
+      return NULL;
+
+    collect_job = j;
+    collect_job_size = size;
+  }
+
+  return &collect_job[collect_nr_job++];
 }
 
 static void collect_all(double now)
 {
+  static char buf[LXT_STATS_BUF_SIZE];
+  static struct n_buf nb = {
+    .nb_buf = buf,
+    .nb_size = sizeof(buf),
+  };
+  double t0 = ev_time();
+  struct collect_job *j;
   struct lxt *l, *l_tmp;
   LIST_HEAD(tmp_list);
   size_t i;
@@ -338,40 +872,73 @@ static void collect_all(double now)
 
   ASSERT(list_empty(&lxt_list));
 
-  for (i = 0; i < sizeof(top_dir_path) / sizeof(top_dir_path[0]); i++) {
+  collect_nr_job = 0;
+
+  for (i = 0; i < NR_LXT_TYPES; i++) {
     DIR *top_dir = NULL;
 
     top_dir = opendir(top_dir_path[i]);
     if (top_dir == NULL) {
       ERROR("cannot open `%s': %m\n", top_dir_path[i]);
-      goto next;
+      continue;
     }
 
     struct dirent *de;
     while ((de = readdir(top_dir)) != NULL) {
-      char exp_dir_path[256];
-
       if (de->d_type != DT_DIR || de->d_name[0] == '.')
         continue;
 
       TRACE("de_name `%s'\n", de->d_name);
 
-      snprintf(exp_dir_path, sizeof(exp_dir_path), "%s/%s/exports",
-               top_dir_path[i], de->d_name);
-
       l = lxt_lookup(de->d_name, i);
       if (l == NULL)
         continue;
 
-      if (lxt_collect(l, exp_dir_path, now) == 0)
-        list_move(&l->l_link, &lxt_list);
+      j = collect_job_add();
+      if (j == NULL)
+        continue;
+
+      j->j_lxt = l;
+      j->j_rc = -1;
+      if (snprintf(j->j_path, sizeof(j->j_path), "%s/%s/exports",
+                   top_dir_path[i], de->d_name) >= sizeof(j->j_path) ||
+          snprintf(j->j_job_path, sizeof(j->j_job_path), "%s/%s/job_stats",
+                   top_dir_path[i], de->d_name) >= sizeof(j->j_job_path)) {
+        ERROR("path of target `%s' too long\n", de->d_name);
+        collect_nr_job--;
+        continue;
+      }
     }
 
-  next:
-    if (top_dir != NULL)
-      closedir(top_dir);
+    closedir(top_dir);
+  }
 
-    chdir("/");
+  /* Workers only touch their own lxt's l_hash_table and l_delta. */
+  pthread_mutex_lock(&collect_mutex);
+  collect_now = now;
+  collect_next = 0;
+  collect_nr_done = 0;
+  if (collect_nr_job > 0) {
+    collect_gen++;
+    pthread_cond_broadcast(&collect_work_cond);
+    collect_jobs(&nb);
+    while (collect_nr_done < collect_nr_job)
+      pthread_cond_wait(&collect_done_cond, &collect_mutex);
+  }
+  pthread_mutex_unlock(&collect_mutex);
+
+  serv_status.ss_nr_open = 0;
+  serv_status.ss_read_bytes = 0;
+  collect_nr_syscall = 0;
+
+  for (i = 0; i < collect_nr_job; i++) {
+    j = &collect_job[i];
+    serv_status.ss_nr_open += j->j_lxt->l_nr_open;
+    serv_status.ss_read_bytes += j->j_lxt->l_read_bytes;
+    collect_nr_syscall += j->j_lxt->l_nr_syscall;
+    lxt_merge(j->j_lxt, now);
+    if (j->j_rc == 0)
+      list_move(&j->j_lxt->l_link, &lxt_list);
   }
 
   /* Kill all lxt's we didn't just see. */
@@ -379,6 +946,11 @@ static void collect_all(double now)
     lxt_delete(l);
 
   ASSERT(list_empty(&tmp_list));
+
+  serv_status.ss_collect_time = ev_time() - t0;
+  TRACE("collected %zu targets in %f s, %zu opens, %zu bytes\n",
+        collect_nr_job, serv_status.ss_collect_time,
+        serv_status.ss_nr_open, serv_status.ss_read_bytes);
 }
 
 static inline int stats_are_zero(lc_t *s)
@@ -390,21 +962,15 @@ static inline int stats_are_zero(lc_t *s)
   return 1;
 }
 
-static int print_stats(char **buf, size_t *len, double now)
+/* Print the entries of t updated at now, prefixed by prefix, and
+   drop the rest. */
+static void print_stats_table(FILE *file, struct hash_table *t,
+                              const char *prefix, size_t *nr, double now)
 {
-  struct hash_table *t = &nid_hash_table;
   struct hlist_node *node, *tmp;
   struct nid_stats *ns;
-  FILE *file = NULL;
-  int rc = -1;
-
-  file = open_memstream(buf, len);
-  if (file == NULL) {
-    ERROR("cannot open memory stream: %m\n");
-    goto out;
-  }
-
   size_t i;
+
   for (i = 0; i < (1ULL << t->t_shift); i++) {
     hlist_for_each_entry_safe(ns, node, tmp, t->t_table + i, ns_hash_node) {
 
@@ -414,18 +980,100 @@ static int print_stats(char **buf, size_t *len, double now)
 
       if (ns->ns_time != now) {
         nid_stats_delete(ns);
-        serv_status.ss_nr_nid--;
+        (*nr)--;
         continue;
       }
 
       if (stats_are_zero(ns->ns_stats))
         continue;
 
-      fprintf(file, "%s "P_FMT"\n", ns->ns_nid, P_ARG(ns->ns_stats));
+      fprintf(file, "%s%s "P_FMT"\n",
+              prefix, ns->ns_nid, P_ARG(ns->ns_stats));
     }
   }
+}
+
+/* Most bytes first, then most requests. */
+static int lxt_delta_cmp(const void *p0, const void *p1)
+{
+  const lc_t *s0 = ((const struct lxt_delta *) p0)->d_stats;
+  const lc_t *s1 = ((const struct lxt_delta *) p1)->d_stats;
+  lc_t b0 = s0[STAT_WR_BYTES] + s0[STAT_RD_BYTES];
+  lc_t b1 = s1[STAT_WR_BYTES] + s1[STAT_RD_BYTES];
+
+  if (b0 != b1)
+    return b0 < b1 ? 1 : -1;
 
-  TRACE("nr_nid %zu\n", serv_status.ss_nr_nid);
+  if (s0[STAT_NR_REQS] != s1[STAT_NR_REQS])
+    return s0[STAT_NR_REQS] < s1[STAT_NR_REQS] ? 1 : -1;
+
+  return 0;
+}
+
+/* l's target line, carrying the deltas of all but its top target_top
+   NIDs (or jobs), which follow it. */
+static void print_target(FILE *file, struct lxt *l)
+{
+  const char *prefix = l->l_jobs ? XLTOP_JOB_PREFIX : "";
+  lc_t rest[NR_STATS] = { 0 };
+  struct lxt_delta *d;
+  size_t i, n;
+
+  if (l->l_nr_delta == 0)
+    return;
+
+  qsort(l->l_delta, l->l_nr_delta, sizeof(l->l_delta[0]), &lxt_delta_cmp);
+
+  n = MIN(l->l_nr_delta, target_top);
+  for (d = l->l_delta + n; d < l->l_delta + l->l_nr_delta; d++)
+    for (i = 0; i < NR_STATS; i++)
+      rest[i] += d->d_stats[i];
+
+  while (n > 0 && stats_are_zero(l->l_delta[n - 1].d_stats))
+    n--;
+
+  if (n == 0 && stats_are_zero(rest))
+    return;
+
+  if (stats_are_zero(rest))
+    fprintf(file, XLTOP_TARGET_PREFIX"%s\n", l->l_name);
+  else
+    fprintf(file, XLTOP_TARGET_PREFIX"%s "P_FMT"\n", l->l_name, P_ARG(rest));
+
+  for (d = l->l_delta; d < l->l_delta + n; d++)
+    fprintf(file, "%s%s "P_FMT"\n",
+            prefix, d->d_ts->ns_nid, P_ARG(d->d_stats));
+}
+
+/* Totals over targets by NID (and jobid) go first, then each
+   target's line and top NIDs.  The master counts lines under a target
+   only against the target, so the two parts don't add.  With
+   with_status the report starts with the serv_status line, as sent to
+   /serv/NAME/_report. */
+static int print_stats(char **buf, size_t *len, double now, int with_status)
+{
+  struct lxt *l;
+  FILE *file = NULL;
+  int rc = -1;
+
+  file = open_memstream(buf, len);
+  if (file == NULL) {
+    ERROR("cannot open memory stream: %m\n");
+    goto out;
+  }
+
+  if (with_status)
+    fprintf(file, PRI_SERV_STATUS_FMT"\n", PRI_SERV_STATUS_ARG(serv_status));
+
+  print_stats_table(file, &nid_hash_table, "", &serv_status.ss_nr_nid, now);
+
+  if (want_job_stats)
+    print_stats_table(file, &job_hash_table, XLTOP_JOB_PREFIX, &nr_job, now);
+
+  list_for_each_entry(l, &lxt_list, l_link)
+    print_target(file, l);
+
+  TRACE("nr_nid %zu, nr_job %zu\n", serv_status.ss_nr_nid, nr_job);
 
   if (ferror(file)) {
     ERROR("error writing to memory stream: %m\n");
@@ -443,20 +1091,45 @@ static int print_stats(char **buf, size_t *len, double now)
   return rc;
 }
 
-static int send_serv_status(double now, double *interval, double *offset)
+/* Set when the master answered a _report with 404 (it predates
+   _report); status and stats then go out in separate PUTs. */
+static int report_split;
+
+/* The master answers status with the interval and offset it wants. */
+static void clock_set(struct curl_x_req *xr)
+{
+  struct ev_loop *loop = xr->xr_cx->cx_loop;
+  struct ev_periodic *w = &clock_w;
+  double c_interval, c_offset;
+  char *msg;
+  size_t msg_len;
+
+  if (n_buf_get_msg(&xr->xr_nb[1], &msg, &msg_len) < 0)
+    return;
+
+  if (sscanf(msg, "%lf %lf", &c_interval, &c_offset) != 2)
+    return;
+
+  if (w->interval != c_interval || w->offset != c_offset) {
+    TRACE("setting interval to %f, offset %f\n", c_interval, c_offset);
+    w->interval = c_interval;
+    w->offset = c_offset;
+    curl_x.cx_timeout_ms = c_interval * 1000;
+    ev_periodic_again(EV_A_ w);
+  }
+}
+
+static void send_serv_status_cb(struct curl_x_req *xr, int rc)
 {
-  char path[1024], status_buf[1024];
-  struct n_buf nb[2] = {
-    {
-      .nb_buf = status_buf,
-      .nb_size = sizeof(status_buf),
-    }
-  };
+  if (rc < 0)
+    serv_status.ss_nr_upload_fail++;
+  else
+    clock_set(xr);
+}
 
+static void serv_status_update(double now)
+{
   struct sysinfo si;
-  int rc = -1;
-
-  snprintf(path, sizeof(path), "/serv/%s/_status", serv_name);
 
   if (sysinfo(&si) < 0) {
     ERROR("cannot get current sysinfo: %m\n");
@@ -477,59 +1150,236 @@ static int send_serv_status(double now, double *interval, double *offset)
   serv_status.ss_free_swap  = si.freeswap  * si.mem_unit;
 
   serv_status.ss_nr_task = si.procs;
+  serv_status.ss_interval = clock_w.interval;
+}
 
-  n_buf_printf(&nb[0], PRI_SERV_STATUS_FMT"\n", PRI_SERV_STATUS_ARG(serv_status));
+static void send_serv_status(double now)
+{
+  char path[1024];
+  N_BUF(nb);
 
-  if (curl_x_put(&curl_x, path, NULL, nb) < 0) {
-    ERROR("cannot PUT `%s'\n", path);
-    goto out;
+  snprintf(path, sizeof(path), "/serv/%s/_status", serv_name);
+
+  serv_status_update(now);
+
+  if (n_buf_init(&nb, 1024) < 0)
+    OOM();
+
+  n_buf_printf(&nb, PRI_SERV_STATUS_FMT"\n", PRI_SERV_STATUS_ARG(serv_status));
+
+  if (curl_x_put_async(&curl_x, path, NULL, &nb,
+                       &send_serv_status_cb, NULL) < 0) {
+    ERROR("cannot PUT `%s': %m\n", path);
+    serv_status.ss_nr_upload_fail++;
   }
 
-  char *msg;
-  size_t msg_len;
+  n_buf_destroy(&nb);
+}
+
+/* Stats reports the master did not take are kept in the spool (if
+   enabled with --spool) and replayed oldest first, one at a time, with
+   their original time once a report gets through.  Only reports that
+   failed in transport or with a server error are kept; those the
+   master refused are dropped, as they would be refused again. */
+static struct spool spool = { .sp_fd = -1 };
+static int spool_replaying;
+
+struct report {
+  uint64_t r_seq; /* In the spool, of a replay. */
+  double r_time;
+  double r_start; /* When the PUT was started, for ss_upload_time. */
+  unsigned int r_replay:1;
+  unsigned int r_combined:1; /* To _report, starting with the status. */
+};
+
+static void send_stats_cb(struct curl_x_req *xr, int rc);
+
+static int send_report(struct report *rp, struct n_buf *nb)
+{
+  char path[1024], query[64];
+
+  snprintf(path, sizeof(path), "/serv/%s%s", serv_name,
+           rp->r_combined ? "/_report" : "");
+  snprintf(query, sizeof(query), "time=%.3f", rp->r_time);
+  rp->r_start = ev_time();
+
+  if (curl_x_put_async(&curl_x, path, rp->r_replay ? query : NULL, nb,
+                       &send_stats_cb, rp) < 0) {
+    ERROR("cannot PUT `%s': %m\n", path);
+    serv_status.ss_nr_upload_fail++;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* The spool holds stats only, since replays go to /serv/NAME; a
+   combined report's status line is left out. */
+static void spool_report(const struct report *rp, const struct n_buf *nb)
+{
+  const char *buf = nb->nb_buf + nb->nb_start, *eol;
+  size_t len = n_buf_length(nb);
+
+  if (spool.sp_hdr == NULL)
+    return;
+
+  if (rp->r_combined) {
+    eol = memchr(buf, '\n', len);
+    len -= eol != NULL ? eol + 1 - buf : len;
+    buf = eol != NULL ? eol + 1 : buf;
+  }
+
+  if (spool_append(&spool, rp->r_time, buf, len) < 0)
+    ERROR("cannot spool report: %m\n");
+  else
+    TRACE("spooled report time %f, %zu reports\n", rp->r_time,
+          spool_length(&spool));
+}
+
+static void spool_replay(void)
+{
+  struct report *rp = NULL;
+  const char *buf;
+  size_t len;
+  N_BUF(nb);
 
-  if (n_buf_get_msg(&nb[1], &msg, &msg_len) < 0)
+  if (spool_replaying || spool.sp_hdr == NULL || spool_is_empty(&spool))
+    return;
+
+  rp = malloc(sizeof(*rp));
+  if (rp == NULL)
     goto out;
 
-  if (sscanf(msg, "%lf %lf", interval, offset) != 2)
+  rp->r_replay = 1;
+  rp->r_combined = 0;
+  if (spool_peek(&spool, &rp->r_seq, &rp->r_time, &buf, &len) < 0)
     goto out;
 
-  rc = 0;
+  if (n_buf_init(&nb, len) < 0)
+    goto out;
+
+  memcpy(nb.nb_buf, buf, len);
+  nb.nb_end = len;
+
+  TRACE("replaying report time %f, %zu reports\n", rp->r_time,
+        spool_length(&spool));
+
+  if (send_report(rp, &nb) < 0)
+    goto out;
+
+  spool_replaying = 1;
+  rp = NULL;
 
  out:
-  n_buf_destroy(&nb[1]);
+  free(rp);
+  n_buf_destroy(&nb);
+}
 
-  return rc;
+/* The master answered rp with a client error other than a timeout or
+   throttling.  A combined report refused with 404 by a master that
+   predates _report is not, its stats go out again alone. */
+static int report_refused(const struct report *rp, long code)
+{
+  if (rp->r_combined && code == 404)
+    return 0;
+
+  return code >= 400 && code < 500 && code != 408 && code != 429;
+}
+
+static void send_stats_cb(struct curl_x_req *xr, int rc)
+{
+  struct report *rp = xr->xr_data;
+  struct n_buf *nb = &xr->xr_nb[0];
+  int refused = rc < 0 && report_refused(rp, xr->xr_code);
+  N_BUF(z);
+
+  if (rp->r_combined && rc == 0)
+    clock_set(xr);
+
+  if (rp->r_combined && xr->xr_code == 404 && !report_split) {
+    ERROR("master does not take reports at `%s', "
+          "sending status and stats separately\n", xr->xr_url);
+    report_split = 1;
+  }
+
+  if (rc < 0) {
+    serv_status.ss_nr_upload_fail++;
+  } else if (!rp->r_replay) {
+    /* As sent, so after compression. */
+    serv_status.ss_upload_time = ev_time() - rp->r_start;
+    serv_status.ss_upload_bytes = nb->nb_end;
+  }
+
+  if (refused)
+    ERROR("master refused %sreport time %f with %ld, dropping\n",
+          rp->r_replay ? "spooled " : "", rp->r_time, xr->xr_code);
+
+  if (rp->r_replay) {
+    spool_replaying = 0;
+    if (rc == 0 || refused)
+      spool_pop(&spool, rp->r_seq);
+  } else if (rc < 0 && !refused) {
+    /* Recover the report as we built it. */
+    nb->nb_start = 0;
+    if (xr->xr_gzip) {
+      if (n_buf_inflate(&z, nb->nb_buf, nb->nb_end, SPOOL_SIZE) < 0)
+        ERROR("cannot decompress report: %m\n");
+      nb = &z;
+    }
+
+    spool_report(rp, nb);
+  }
+
+  if (rc == 0 || refused)
+    spool_replay();
+
+  n_buf_destroy(&z);
+  free(rp);
 }
 
 static void send_stats(double now)
 {
-  char path[1024], *stats_buf = NULL;
+  char *stats_buf = NULL;
   size_t stats_len = 0;
-  struct n_buf nb[2] = { };
+  struct report *rp = NULL;
+  N_BUF(nb);
 
-  snprintf(path, sizeof(path), "/serv/%s", serv_name);
+  if (!report_split)
+    serv_status_update(now);
 
-  if (print_stats(&stats_buf, &stats_len, now) < 0)
+  if (print_stats(&stats_buf, &stats_len, now, !report_split) < 0)
     goto out;
 
-  nb[0].nb_buf = stats_buf;
-  nb[0].nb_size = stats_len;
-  nb[0].nb_end = stats_len;
+  nb.nb_buf = stats_buf;
+  nb.nb_size = stats_len;
+  nb.nb_end = stats_len;
 
-  if (curl_x_put(&curl_x, path, NULL, nb) < 0) {
-    ERROR("cannot PUT `%s'\n", path);
+  rp = malloc(sizeof(*rp));
+  if (rp == NULL)
+    goto out;
+
+  rp->r_time = now;
+  rp->r_replay = 0;
+  rp->r_combined = !report_split;
+
+  if (send_report(rp, &nb) < 0) {
+    spool_report(rp, &nb);
     goto out;
   }
 
+  rp = NULL;
+
  out:
-  n_buf_destroy(&nb[1]);
+  free(rp);
+  n_buf_destroy(&nb);
 }
 
+/* Reports are sent asynchronously, so a slow master delays neither
+   the next collection nor the timer; at most MAX_REPORTS PUTs are in
+   flight. */
 static void clock_cb(EV_P_ ev_periodic *w, int revents)
 {
   double now = ev_now(EV_A);
-  double c_interval, c_offset;
 
   TRACE("begin now %f\n", now);
 
@@ -537,17 +1387,57 @@ static void clock_cb(EV_P_ ev_periodic *w, int revents)
 
   send_stats(now);
 
-  if (send_serv_status(now, &c_interval, &c_offset) < 0)
-    return;
+  if (report_split)
+    send_serv_status(now);
 
-  if (w->interval != c_interval || w->offset != c_offset) {
-    TRACE("setting interval to %f, offset %f\n", c_interval, c_offset);
-    w->interval = c_interval;
-    w->offset = c_offset;
-    ev_periodic_again(EV_A_ w);
+  TRACE("end\n\n\n\n");
+}
+
+static double tv_sec(const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* With --bench, collect and build reports nr_pass times without a
+   master, sleeping interval seconds in between if it is positive, and
+   print what each pass cost.  Run against a tree from fake_lustre. */
+static void bench(size_t nr_pass, double interval)
+{
+  struct rusage ru0, ru1;
+  char *buf;
+  size_t i, len;
+  double t0, t1;
+
+  for (i = 0; i < nr_pass; i++) {
+    if (i > 0 && interval > 0)
+      usleep(interval * 1000000);
+
+    buf = NULL;
+    len = 0;
+    getrusage(RUSAGE_SELF, &ru0);
+    t0 = ev_time();
+
+    collect_all(t0);
+    if (print_stats(&buf, &len, t0, 0) < 0)
+      FATAL("cannot print stats\n");
+
+    t1 = ev_time();
+    getrusage(RUSAGE_SELF, &ru1);
+    free(buf);
+
+    printf("pass %zu: %zu targets, %zu nids, %zu jobs, "
+           "%.6f s (collect %.6f s), %.6f user, %.6f sys, "
+           "%zu syscalls, %zu opens, %zu bytes read, %zu bytes report\n",
+           i, collect_nr_job, serv_status.ss_nr_nid, nr_job,
+           t1 - t0, serv_status.ss_collect_time,
+           tv_sec(&ru1.ru_utime) - tv_sec(&ru0.ru_utime),
+           tv_sec(&ru1.ru_stime) - tv_sec(&ru0.ru_stime),
+           collect_nr_syscall, serv_status.ss_nr_open,
+           serv_status.ss_read_bytes, len);
   }
 
-  TRACE("end\n\n\n\n");
+  getrusage(RUSAGE_SELF, &ru1);
+  printf("max rss %ld KB, %zu stats fds\n", ru1.ru_maxrss, nr_nid_fd);
 }
 
 static void sigterm_cb(EV_P_ ev_signal *w, int revents)
@@ -561,17 +1451,26 @@ static void print_help(void)
 
   printf("Usage: %s [OPTION]... [EXPRESSION...]\n"
 	 "\nOPTIONS:\n"
+	 " -b, --bench=N               time N collections without a master and exit\n"
 	 " -c, --config=DIR_OR_FILE    read configuration from DIR_OR_FILE\n"
 	 " -d, --daemon                detach and run in the background\n"
 	 " -h, --help                  display this help and exit\n"
 	 " -i, --interval=SECONDS      set connection interval\n"
+	 " -j, --job-stats             report by jobid from target job_stats files\n"
 	 " -n, --nr-nids=N             expect N client NIDs per target\n"
+	 " -z, --compress              gzip stats sent to master\n"
 	 " -m, --master=HOST-OR-ADDR   connect to master on HOST-OR-ADDR (default %s)\n"
 	 " -P, --pidfile=PATH          write PID to PATH\n"
+	 " -r, --root=DIR              read Lustre stats under DIR (default %s)\n"
 	 " -p, --port=PORT             connect to master at PORT (default %s)\n"
+	 " -S, --spool=PATH            keep reports the master missed in PATH\n"
+	 " -B, --spool-size=BYTES      limit spool to BYTES (default 64MB)\n"
+	 " -T, --target-top=N          report the top N NIDs of each target (default %d)\n"
+	 " -t, --threads=N             collect targets using N threads (default 1)\n"
 	 " -v, --version               display version information and exit\n"
 	 "\nReport %s bugs to <%s>.\n"
-	 , p, str_or(XLTOP_MASTER, "NONE"), XLTOP_PORT, p, PACKAGE_BUGREPORT);
+	 , p, str_or(XLTOP_MASTER, "NONE"), lustre_root, XLTOP_PORT, TARGET_TOP, p,
+	 PACKAGE_BUGREPORT);
 }
 
 static void print_version(void)
@@ -588,24 +1487,48 @@ int main(int argc, char *argv[])
   int pidfile_fd = -1;
   const char *pidfile_path = NULL;
   int want_daemon = 0;
+  int want_compress = 0;
+  const char *spool_path = NULL;
+  size_t spool_size = SPOOL_SIZE;
+  size_t bench_nr_pass = 0;
+  int interval_set = 0;
+  size_t i;
 
   struct option opts[] = {
+    { "bench",       1, NULL, 'b' },
     { "config",      1, NULL, 'c' },
     { "daemon",      0, NULL, 'd' },
     { "help",        0, NULL, 'h' },
     { "interval",    1, NULL, 'i' },
+    { "job-stats",   0, NULL, 'j' },
     { "nr-nids",     1, NULL, 'n' },
     { "master",      1, NULL, 'm' },
     { "pidfile",     1, NULL, 'P' },
     { "port",        1, NULL, 'p' },
+    { "root",        1, NULL, 'r' },
     { "server-name", 1, NULL, 's' },
+    { "spool",       1, NULL, 'S' },
+    { "spool-size",  1, NULL, 'B' },
+    { "target-top",  1, NULL, 'T' },
+    { "threads",     1, NULL, 't' },
     { "version",     0, NULL, 'v' },
+    { "compress",    0, NULL, 'z' },
     { NULL,          0, NULL,  0  },
   };
 
   int c;
-  while ((c = getopt_long(argc, argv, "c:dhi:n:m:P:p:s:v", opts, 0)) > 0) {
+  while ((c = getopt_long(argc, argv, "b:B:c:dhi:jn:m:P:p:r:s:S:T:t:vz", opts, 0)) > 0) {
     switch (c) {
+    case 'b':
+      bench_nr_pass = strtoul(optarg, NULL, 0);
+      if (bench_nr_pass == 0)
+        FATAL("invalid number of passes `%s'\n", optarg);
+      break;
+    case 'B':
+      spool_size = strtoul(optarg, NULL, 0);
+      if (spool_size == 0)
+        FATAL("invalid spool size `%s'\n", optarg);
+      break;
     case 'c':
       conf_arg = optarg;
       break;
@@ -619,6 +1542,10 @@ int main(int argc, char *argv[])
       interval = strtod(optarg, NULL);
       if (interval <= 0)
         FATAL("invalid interval `%s'\n", optarg);
+      interval_set = 1;
+      break;
+    case 'j':
+      want_job_stats = 1;
       break;
     case 'n':
       nr_nid_hint = strtoul(optarg, NULL, 0);
@@ -632,12 +1559,29 @@ int main(int argc, char *argv[])
     case 'p':
       m_port = optarg;
       break;
+    case 'r':
+      lustre_root = optarg;
+      break;
     case 's':
       serv_name = optarg;
       break;
+    case 'S':
+      spool_path = optarg;
+      break;
+    case 'T':
+      target_top = strtoul(optarg, NULL, 0);
+      break;
+    case 't':
+      nr_threads = strtoul(optarg, NULL, 0);
+      if (nr_threads == 0)
+        FATAL("invalid number of threads `%s'\n", optarg);
+      break;
     case 'v':
       print_version();
       exit(EXIT_SUCCESS);
+    case 'z':
+      want_compress = 1;
+      break;
     case '?':
       FATAL("Try `%s --help' for more information.\n", program_invocation_short_name);
     }
@@ -650,12 +1594,37 @@ int main(int argc, char *argv[])
     FATAL("invalid offset %f, must be nonnegative\n", offset);
   offset = fmod(offset, interval);
 
+  for (i = 0; i < NR_LXT_TYPES; i++) {
+    top_dir_path[i] = strf("%s/%s", lustre_root, top_dir_name[i]);
+    if (top_dir_path[i] == NULL)
+      OOM();
+  }
+
   if (serv_name == NULL) {
     if (gethostname(host_name, sizeof(host_name)) < 0)
       FATAL("cannot get host name: %m\n");
     serv_name = host_name;
   }
 
+  if (hash_table_init(&nid_hash_table, nr_nid_hint) < 0)
+    FATAL("cannot initialize nid hash: %m\n");
+
+  if (want_job_stats && hash_table_init(&job_hash_table, NR_JOB_HINT) < 0)
+    FATAL("cannot initialize job hash: %m\n");
+
+  if (hash_table_init(&lxt_hash_table, NR_LXT_HINT) < 0)
+    FATAL("cannot initialize target hash: %m\n");
+
+  if (bench_nr_pass > 0) {
+    nid_fd_init();
+
+    if (collect_pool_init() < 0)
+      FATAL("cannot start collection threads: %m\n");
+
+    bench(bench_nr_pass, interval_set ? interval : 0);
+    exit(EXIT_SUCCESS);
+  }
+
   if (!str_is_set(m_host))
     FATAL("no host or address specified for master\n");
 
@@ -669,11 +1638,10 @@ int main(int argc, char *argv[])
   if (curl_x_init(&curl_x, m_host, m_port) < 0)
     FATAL("cannot initialize curl handle: %m\n");
 
-  if (hash_table_init(&nid_hash_table, nr_nid_hint) < 0)
-    FATAL("cannot initialize nid hash: %m\n");
+  curl_x.cx_put_gzip = want_compress;
 
-  if (hash_table_init(&lxt_hash_table, NR_LXT_HINT) < 0)
-    FATAL("cannot initialize target hash: %m\n");
+  if (spool_path != NULL && spool_open(&spool, spool_path, spool_size) < 0)
+    FATAL("cannot open spool `%s'\n", spool_path);
 
   if (want_daemon && daemon(0, 0) < 0)
     FATAL("cannot daemonize: %m\n");
@@ -686,6 +1654,16 @@ int main(int argc, char *argv[])
 
   signal(SIGPIPE, SIG_IGN);
 
+  nid_fd_init();
+
+  if (curl_x_async_init(EV_DEFAULT_ &curl_x, MAX_REPORTS) < 0)
+    FATAL("cannot initialize curl multi handle: %m\n");
+
+  curl_x.cx_timeout_ms = interval * 1000;
+
+  if (collect_pool_init() < 0)
+    FATAL("cannot start collection threads: %m\n");
+
   static struct ev_signal sigterm_w;
   ev_signal_init(&sigterm_w, &sigterm_cb, SIGTERM);
   ev_signal_start(EV_DEFAULT_ &sigterm_w);
@@ -0,0 +1,522 @@
+#include "stddef1.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <ev.h>
+#include "clus.h"
+#include "host.h"
+#include "job.h"
+#include "snap.h"
+#include "string1.h"
+#include "trace.h"
+#include "x_node.h"
+
+/* Snapshot of the master's state, so that a restarted master has its
+   nodes and rates back at once rather than after a window of reports.
+
+   The file is a header, then h_nr_x node records in depth first order
+   (so a parent always precedes its children), each followed by its
+   name and, for jobs, owner and title, then h_nr_k k records naming
+   their pair by node record index, each followed by its rates over the
+   h_windows extra windows.  It is written in host byte order
+   and layout, for the same master to read back.  Clusters pulled from
+   peers are left out, they are pulled again.  Servers are only those
+   of the config, so their targets are dropped if a server is gone. */
+
+#define SNAP_MAGIC "XLTOPSNP"
+#define SNAP_VERSION 2 /* 1 had no extra windows. */
+#define SNAP_NONE UINT32_MAX
+
+struct snap_hdr {
+  char h_magic[8];
+  uint32_t h_version, h_nr_stats;
+  double h_time, h_tick, h_window;
+  uint64_t h_nr_x, h_nr_k;
+};
+
+/* After the header, since version 2. */
+struct snap_windows {
+  uint32_t sw_nr, sw_pad;
+  double sw_window[K_WINDOWS_MAX];
+};
+
+struct snap_x {
+  uint32_t sx_parent;
+  uint16_t sx_type, sx_len[3]; /* Name, owner, title. */
+  double sx_start;
+};
+
+struct snap_k {
+  uint32_t sk_x[2];
+  double sk_t;
+  double sk_pending[NR_STATS], sk_rate[NR_STATS], sk_sum[NR_STATS];
+};
+
+static char *snap_path;
+static struct ev_timer snap_w;
+static struct ev_child snap_child_w;
+
+/* While saving, x_snap holds the node's record index, or -1 if it
+   was left out. */
+
+static void snap_skip(struct x_node *x)
+{
+  struct x_node *c;
+
+  x->x_snap = -1;
+  x_for_each_child(c, x)
+    snap_skip(c);
+}
+
+static int snap_put_x(FILE *f, struct x_node *x, uint32_t parent,
+                      uint64_t *nr_x)
+{
+  const char *str[3] = { x->x_name, "", "" };
+  struct snap_x sx;
+  struct x_node *c;
+  uint32_t id;
+  size_t i;
+
+  if (x_is_type(x, X_CLUS) &&
+      container_of(x, struct clus_node, c_x)->c_peer != NULL) {
+    snap_skip(x);
+    return 0;
+  }
+
+  memset(&sx, 0, sizeof(sx));
+  sx.sx_parent = parent;
+  sx.sx_type = x->x_type->x_type;
+
+  if (x_is_job(x)) {
+    struct job_node *j = container_of(x, struct job_node, j_x);
+
+    str[1] = j->j_owner != NULL ? j->j_owner : "";
+    str[2] = j->j_title != NULL ? j->j_title : "";
+    sx.sx_start = j->j_start_time;
+  }
+
+  for (i = 0; i < 3; i++) {
+    size_t len = strlen(str[i]);
+
+    if (len > UINT16_MAX) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    sx.sx_len[i] = len;
+  }
+
+  if (*nr_x >= SNAP_NONE) {
+    errno = EOVERFLOW;
+    return -1;
+  }
+
+  id = (*nr_x)++;
+  x->x_snap = id;
+
+  if (fwrite(&sx, sizeof(sx), 1, f) != 1)
+    return -1;
+
+  for (i = 0; i < 3; i++)
+    if (sx.sx_len[i] > 0 && fwrite(str[i], sx.sx_len[i], 1, f) != 1)
+      return -1;
+
+  x_for_each_child(c, x)
+    if (snap_put_x(f, c, id, nr_x) < 0)
+      return -1;
+
+  return 0;
+}
+
+static int snap_put_k(FILE *f, uint64_t *nr_k)
+{
+  struct hash_table *t = &k_hash_table;
+  struct hlist_node *n;
+  struct k_node *k;
+  struct snap_k sk;
+  size_t i;
+
+  for (i = 0; i < (1ULL << t->t_shift); i++) {
+    hlist_for_each_entry(k, n, t->t_table + i, k_hash_node) {
+      if (k->k_x[0]->x_snap < 0 || k->k_x[1]->x_snap < 0)
+        continue;
+
+      memset(&sk, 0, sizeof(sk));
+      sk.sk_x[0] = k->k_x[0]->x_snap;
+      sk.sk_x[1] = k->k_x[1]->x_snap;
+      sk.sk_t = k->k_t;
+      memcpy(sk.sk_pending, k->k_pending, sizeof(sk.sk_pending));
+      memcpy(sk.sk_rate, k->k_rate, sizeof(sk.sk_rate));
+      memcpy(sk.sk_sum, k->k_sum, sizeof(sk.sk_sum));
+
+      if (fwrite(&sk, sizeof(sk), 1, f) != 1 ||
+          fwrite(k->k_wrate, sizeof(k->k_wrate[0]), nr_k_windows, f) !=
+          nr_k_windows)
+        return -1;
+
+      (*nr_k)++;
+    }
+  }
+
+  return 0;
+}
+
+int snap_save(const char *path)
+{
+  struct snap_hdr h;
+  struct snap_windows sw;
+  char *tmp = NULL;
+  FILE *f = NULL;
+  int rc = -1;
+
+  tmp = strf("%s.tmp", path);
+  if (tmp == NULL)
+    goto out;
+
+  f = fopen(tmp, "w");
+  if (f == NULL) {
+    ERROR("cannot open `%s': %m\n", tmp);
+    goto out;
+  }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.h_magic, SNAP_MAGIC, sizeof(h.h_magic));
+  h.h_version = SNAP_VERSION;
+  h.h_nr_stats = NR_STATS;
+  h.h_time = ev_time();
+  h.h_tick = k_tick;
+  h.h_window = k_window;
+
+  memset(&sw, 0, sizeof(sw));
+  sw.sw_nr = nr_k_windows;
+  memcpy(sw.sw_window, k_windows, sizeof(sw.sw_window));
+
+  if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+      fwrite(&sw, sizeof(sw), 1, f) != 1 ||
+      snap_put_x(f, x_all[0], SNAP_NONE, &h.h_nr_x) < 0 ||
+      snap_put_x(f, x_all[1], SNAP_NONE, &h.h_nr_x) < 0 ||
+      snap_put_k(f, &h.h_nr_k) < 0 ||
+      fseek(f, 0, SEEK_SET) < 0 ||
+      fwrite(&h, sizeof(h), 1, f) != 1 ||
+      fflush(f) != 0 ||
+      fsync(fileno(f)) < 0) {
+    ERROR("cannot write `%s': %m\n", tmp);
+    goto out;
+  }
+
+  if (fclose(f) != 0) {
+    f = NULL;
+    ERROR("cannot write `%s': %m\n", tmp);
+    goto out;
+  }
+  f = NULL;
+
+  if (rename(tmp, path) < 0) {
+    ERROR("cannot rename `%s' to `%s': %m\n", tmp, path);
+    goto out;
+  }
+
+  TRACE("saved %llu nodes, %llu pairs to `%s'\n",
+        (unsigned long long) h.h_nr_x, (unsigned long long) h.h_nr_k, path);
+
+  rc = 0;
+
+ out:
+  if (f != NULL)
+    fclose(f);
+
+  if (rc < 0 && tmp != NULL)
+    unlink(tmp);
+
+  free(tmp);
+
+  return rc;
+}
+
+static struct x_node *snap_get_x(EV_P_ const struct snap_x *sx,
+                                 struct x_node *p, char *str[3])
+{
+  struct job_node *j;
+  struct clus_node *c;
+  struct x_node *x;
+  char start[64];
+
+  switch (sx->sx_type) {
+  case X_HOST:
+    /* Hosts of the lnet files start out in their idle job. */
+    x = x_host_lookup(str[0], p, L_CREATE);
+    if (x != NULL)
+      x_set_parent(x, p);
+    return x;
+  case X_JOB:
+    snprintf(start, sizeof(start), "%.0f", sx->sx_start);
+    j = job_lookup(str[0], p, str[1], str[2], start);
+    if (j == NULL)
+      return NULL;
+    job_touch(EV_A_ j);
+    return &j->j_x;
+  case X_CLUS:
+    c = clus_lookup(str[0], L_CREATE);
+    return c != NULL ? &c->c_x : NULL;
+  case X_TARGET:
+  case X_FS:
+    return x_lookup(sx->sx_type, str[0], p, L_CREATE);
+  case X_SERV:
+    return x_lookup(X_SERV, str[0], NULL, 0);
+  default:
+    return NULL;
+  }
+}
+
+int snap_load(EV_P_ const char *path)
+{
+  struct snap_hdr h;
+  struct snap_windows sw;
+  struct x_node **xv = NULL;
+  char *buf = NULL, *str[3];
+  char *m = MAP_FAILED, *p, *end;
+  size_t size = 0, nr_x = 0, nr_k = 0, sk_size, j;
+  int w_map[K_WINDOWS_MAX];
+  uint64_t i;
+  struct stat st;
+  int fd = -1, rc = -1;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      ERROR("cannot open `%s': %m\n", path);
+      goto out;
+    }
+    TRACE("no snapshot `%s'\n", path);
+    rc = 0;
+    goto out;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    ERROR("cannot stat `%s': %m\n", path);
+    goto out;
+  }
+
+  size = st.st_size;
+  if (size < sizeof(h))
+    goto bad;
+
+  m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (m == MAP_FAILED) {
+    ERROR("cannot map `%s': %m\n", path);
+    goto out;
+  }
+
+  p = m;
+  end = m + size;
+
+  memcpy(&h, p, sizeof(h));
+  p += sizeof(h);
+
+  if (memcmp(h.h_magic, SNAP_MAGIC, sizeof(h.h_magic)) != 0 ||
+      h.h_version < 1 || h.h_version > SNAP_VERSION ||
+      h.h_nr_stats != NR_STATS)
+    goto bad;
+
+  memset(&sw, 0, sizeof(sw));
+  if (h.h_version >= 2) {
+    if (end - p < sizeof(sw))
+      goto bad;
+
+    memcpy(&sw, p, sizeof(sw));
+    p += sizeof(sw);
+
+    if (sw.sw_nr > K_WINDOWS_MAX)
+      goto bad;
+  }
+
+  /* Windows not in the snapshot start from the k_window rate. */
+  for (j = 0; j < nr_k_windows; j++) {
+    w_map[j] = -1;
+    for (i = 0; i < sw.sw_nr; i++)
+      if (sw.sw_window[i] == k_windows[j])
+        w_map[j] = i;
+  }
+
+  sk_size = sizeof(struct snap_k) + sw.sw_nr * sizeof(double[NR_STATS]);
+
+  if (h.h_nr_x > (end - p) / sizeof(struct snap_x) ||
+      h.h_nr_k > (end - p) / sk_size)
+    goto bad;
+
+  xv = calloc(h.h_nr_x + 1, sizeof(xv[0]));
+  buf = malloc(3 * (UINT16_MAX + 1));
+  if (xv == NULL || buf == NULL)
+    OOM();
+
+  for (i = 0; i < 3; i++)
+    str[i] = buf + i * (UINT16_MAX + 1);
+
+  for (i = 0; i < h.h_nr_x; i++) {
+    struct snap_x sx;
+    struct x_node *x1 = NULL;
+
+    if (end - p < sizeof(sx))
+      goto bad;
+
+    memcpy(&sx, p, sizeof(sx));
+    p += sizeof(sx);
+
+    if (sx.sx_type >= NR_X_TYPES)
+      goto bad;
+
+    for (j = 0; j < 3; j++) {
+      if (end - p < sx.sx_len[j])
+        goto bad;
+      memcpy(str[j], p, sx.sx_len[j]);
+      str[j][sx.sx_len[j]] = 0;
+      p += sx.sx_len[j];
+    }
+
+    if (sx.sx_type == X_U || sx.sx_type == X_V) {
+      if (sx.sx_parent != SNAP_NONE)
+        goto bad;
+      xv[i] = x_all[x_types[sx.sx_type].x_which];
+      nr_x++;
+      continue;
+    }
+
+    if (sx.sx_parent >= i)
+      goto bad;
+
+    x1 = xv[sx.sx_parent];
+    if (x1 == NULL || x_which(x1) != x_types[sx.sx_type].x_which)
+      continue;
+
+    xv[i] = snap_get_x(EV_A_ &sx, x1, str);
+    if (xv[i] != NULL)
+      nr_x++;
+  }
+
+  for (i = 0; i < h.h_nr_k; i++) {
+    struct snap_k sk;
+    double wr[K_WINDOWS_MAX][NR_STATS];
+    struct k_node *k;
+
+    if (end - p < sk_size)
+      goto bad;
+
+    memcpy(&sk, p, sizeof(sk));
+    p += sizeof(sk);
+
+    memcpy(wr, p, sw.sw_nr * sizeof(wr[0]));
+    p += sw.sw_nr * sizeof(wr[0]);
+
+    if (sk.sk_x[0] >= h.h_nr_x || sk.sk_x[1] >= h.h_nr_x)
+      goto bad;
+
+    if (xv[sk.sk_x[0]] == NULL || xv[sk.sk_x[1]] == NULL)
+      continue;
+
+    k = k_lookup(xv[sk.sk_x[0]], xv[sk.sk_x[1]], L_CREATE);
+    if (k == NULL)
+      continue;
+
+    k->k_t = sk.sk_t;
+    k->k_modified = sk.sk_t;
+    memcpy(k->k_pending, sk.sk_pending, sizeof(k->k_pending));
+    memcpy(k->k_rate, sk.sk_rate, sizeof(k->k_rate));
+    memcpy(k->k_sum, sk.sk_sum, sizeof(k->k_sum));
+
+    for (j = 0; j < nr_k_windows; j++)
+      memcpy(k->k_wrate[j], w_map[j] < 0 ? sk.sk_rate : wr[w_map[j]],
+             sizeof(k->k_wrate[j]));
+
+    nr_k++;
+  }
+
+  TRACE("loaded %zu of %llu nodes, %zu of %llu pairs from `%s', %.0f seconds old\n",
+        nr_x, (unsigned long long) h.h_nr_x,
+        nr_k, (unsigned long long) h.h_nr_k,
+        path, ev_now(EV_A) - h.h_time);
+
+  rc = 0;
+  goto out;
+
+ bad:
+  ERROR("invalid snapshot `%s'\n", path);
+
+ out:
+  free(buf);
+  free(xv);
+
+  if (m != MAP_FAILED)
+    munmap(m, size);
+
+  if (fd >= 0)
+    close(fd);
+
+  return rc;
+}
+
+static void snap_child_cb(EV_P_ struct ev_child *w, int revents)
+{
+  ev_child_stop(EV_A_ w);
+  w->pid = 0;
+
+  if (!(WIFEXITED(w->rstatus) && WEXITSTATUS(w->rstatus) == 0))
+    ERROR("snapshot child failed with status %d\n", w->rstatus);
+}
+
+static void snap_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+  pid_t pid;
+
+  if (ev_is_active(&snap_child_w)) {
+    TRACE("snapshot child %d still running\n", (int) snap_child_w.pid);
+    return;
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    ERROR("cannot fork snapshot child: %m\n");
+    return;
+  }
+
+  if (pid == 0)
+    _exit(snap_save(snap_path) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+  ev_child_set(&snap_child_w, pid, 0);
+  ev_child_start(EV_A_ &snap_child_w);
+}
+
+void snap_init(EV_P_ const char *path, double interval)
+{
+  snap_path = strdup(path);
+  if (snap_path == NULL)
+    OOM();
+
+  ev_child_init(&snap_child_w, &snap_child_cb, 0, 0);
+
+  ev_timer_init(&snap_w, &snap_timer_cb, interval, interval);
+  ev_timer_start(EV_A_ &snap_w);
+}
+
+void snap_fini(EV_P)
+{
+  int status;
+
+  if (snap_path == NULL)
+    return;
+
+  ev_timer_stop(EV_A_ &snap_w);
+
+  if (ev_is_active(&snap_child_w)) {
+    ev_child_stop(EV_A_ &snap_child_w);
+    waitpid(snap_child_w.pid, &status, 0);
+  }
+
+  snap_save(snap_path);
+}
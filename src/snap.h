@@ -0,0 +1,18 @@
+#ifndef _SNAP_H_
+#define _SNAP_H_
+#include <ev.h>
+
+/* Recreate the nodes and k stats saved in path.  A missing file is
+   not an error. */
+int snap_load(EV_P_ const char *path);
+
+/* Write the snapshot to path now, in the foreground. */
+int snap_save(const char *path);
+
+/* Save to path every interval seconds from a forked child. */
+void snap_init(EV_P_ const char *path, double interval);
+
+/* Wait for any child and save one last time. */
+void snap_fini(EV_P);
+
+#endif
@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "spool.h"
+#include "trace.h"
+
+#define SPOOL_MAGIC 0x50534c58 /* "XLSP" */
+#define SPOOL_VERSION 2
+
+/* Records live in sp_data[sh_start, sh_end), each one a spool_rec
+   padded to 8 bytes.  Appends that would run past sh_size first move
+   the live records to the front of the data area. */
+struct spool_header {
+  uint32_t sh_magic, sh_version;
+  uint64_t sh_size; /* Of the data area. */
+  uint64_t sh_start, sh_end;
+  uint64_t sh_nr_rec, sh_nr_drop;
+  uint64_t sh_seq; /* Of the record at sh_start. */
+};
+
+struct spool_rec {
+  uint32_t sr_len; /* Of sr_data. */
+  uint32_t sr_pad;
+  double sr_time;
+  char sr_data[];
+};
+
+static inline size_t spool_rec_size(size_t len)
+{
+  return (sizeof(struct spool_rec) + len + 7) & ~(size_t) 7;
+}
+
+static int spool_header_ok(const struct spool_header *sh, size_t map_size)
+{
+  return sh->sh_magic == SPOOL_MAGIC &&
+    sh->sh_version == SPOOL_VERSION &&
+    sh->sh_size == map_size - sizeof(*sh) &&
+    sh->sh_start <= sh->sh_end &&
+    sh->sh_end <= sh->sh_size;
+}
+
+/* An existing valid spool keeps its size; otherwise the file is
+   (re)initialized to hold size bytes of records. */
+int spool_open(struct spool *sp, const char *path, size_t size)
+{
+  struct spool_header *sh;
+  struct stat st;
+  void *map;
+
+  memset(sp, 0, sizeof(*sp));
+
+  sp->sp_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR);
+  if (sp->sp_fd < 0) {
+    ERROR("cannot open spool `%s': %m\n", path);
+    goto err;
+  }
+
+  if (fstat(sp->sp_fd, &st) < 0) {
+    ERROR("cannot stat spool `%s': %m\n", path);
+    goto err;
+  }
+
+  sp->sp_map_size = sizeof(*sh) + size;
+  if ((size_t) st.st_size > sizeof(*sh))
+    sp->sp_map_size = st.st_size;
+
+  if ((size_t) st.st_size != sp->sp_map_size &&
+      ftruncate(sp->sp_fd, sp->sp_map_size) < 0) {
+    ERROR("cannot resize spool `%s': %m\n", path);
+    goto err;
+  }
+
+  map = mmap(NULL, sp->sp_map_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+             sp->sp_fd, 0);
+  if (map == MAP_FAILED) {
+    ERROR("cannot map spool `%s': %m\n", path);
+    goto err;
+  }
+
+  sp->sp_hdr = sh = map;
+  sp->sp_data = (char *) (sh + 1);
+
+  if (!spool_header_ok(sh, sp->sp_map_size)) {
+    if (sh->sh_magic != 0)
+      ERROR("spool `%s' is invalid, reinitializing\n", path);
+
+    memset(sh, 0, sizeof(*sh));
+    sh->sh_magic = SPOOL_MAGIC;
+    sh->sh_version = SPOOL_VERSION;
+    sh->sh_size = sp->sp_map_size - sizeof(*sh);
+  }
+
+  TRACE("spool `%s', size %"PRIu64", %"PRIu64" records, %"PRIu64" bytes\n",
+        path, sh->sh_size, sh->sh_nr_rec, sh->sh_end - sh->sh_start);
+
+  return 0;
+
+ err:
+  spool_close(sp);
+
+  return -1;
+}
+
+void spool_close(struct spool *sp)
+{
+  if (sp->sp_hdr != NULL)
+    munmap(sp->sp_hdr, sp->sp_map_size);
+
+  if (!(sp->sp_fd < 0))
+    close(sp->sp_fd);
+
+  memset(sp, 0, sizeof(*sp));
+  sp->sp_fd = -1;
+}
+
+int spool_is_empty(const struct spool *sp)
+{
+  return sp->sp_hdr == NULL || sp->sp_hdr->sh_start == sp->sp_hdr->sh_end;
+}
+
+size_t spool_length(const struct spool *sp)
+{
+  return sp->sp_hdr != NULL ? sp->sp_hdr->sh_nr_rec : 0;
+}
+
+/* Oldest record, or NULL (after emptying the spool) if the record at
+   sh_start does not fit. */
+static struct spool_rec *spool_first(struct spool *sp)
+{
+  struct spool_header *sh = sp->sp_hdr;
+  struct spool_rec *sr;
+
+  if (sh->sh_end - sh->sh_start < sizeof(*sr))
+    goto bad;
+
+  sr = (struct spool_rec *) (sp->sp_data + sh->sh_start);
+  if (spool_rec_size(sr->sr_len) > sh->sh_end - sh->sh_start)
+    goto bad;
+
+  return sr;
+
+ bad:
+  ERROR("spool corrupt, discarding %"PRIu64" records\n", sh->sh_nr_rec);
+  sh->sh_nr_drop += sh->sh_nr_rec;
+  sh->sh_seq += sh->sh_nr_rec;
+  sh->sh_start = sh->sh_end = sh->sh_nr_rec = 0;
+
+  return NULL;
+}
+
+static void spool_sync(struct spool *sp)
+{
+  msync(sp->sp_hdr, sp->sp_map_size, MS_ASYNC);
+}
+
+int spool_append(struct spool *sp, double time, const void *buf, size_t len)
+{
+  struct spool_header *sh = sp->sp_hdr;
+  size_t n = spool_rec_size(len);
+  struct spool_rec *sr;
+
+  if (sh == NULL || n > sh->sh_size || len > UINT32_MAX) {
+    errno = EFBIG;
+    return -1;
+  }
+
+  while (sh->sh_end + n > sh->sh_size) {
+    if (sh->sh_start > 0) {
+      memmove(sp->sp_data, sp->sp_data + sh->sh_start,
+              sh->sh_end - sh->sh_start);
+      sh->sh_end -= sh->sh_start;
+      sh->sh_start = 0;
+      continue;
+    }
+
+    /* Full: drop the oldest report. */
+    sr = spool_first(sp);
+    if (sr == NULL)
+      continue;
+
+    sh->sh_start += spool_rec_size(sr->sr_len);
+    sh->sh_nr_rec--;
+    sh->sh_nr_drop++;
+    sh->sh_seq++;
+  }
+
+  sr = (struct spool_rec *) (sp->sp_data + sh->sh_end);
+  sr->sr_len = len;
+  sr->sr_pad = 0;
+  sr->sr_time = time;
+  memcpy(sr->sr_data, buf, len);
+
+  sh->sh_end += n;
+  sh->sh_nr_rec++;
+  spool_sync(sp);
+
+  return 0;
+}
+
+int spool_peek(struct spool *sp, uint64_t *seq, double *time,
+               const char **buf, size_t *len)
+{
+  struct spool_rec *sr;
+
+  if (spool_is_empty(sp) || (sr = spool_first(sp)) == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  *seq = sp->sp_hdr->sh_seq;
+  *time = sr->sr_time;
+  *buf = sr->sr_data;
+  *len = sr->sr_len;
+
+  return 0;
+}
+
+void spool_pop(struct spool *sp, uint64_t seq)
+{
+  struct spool_header *sh = sp->sp_hdr;
+  struct spool_rec *sr;
+
+  if (spool_is_empty(sp) || sh->sh_seq != seq ||
+      (sr = spool_first(sp)) == NULL)
+    return;
+
+  sh->sh_start += spool_rec_size(sr->sr_len);
+  sh->sh_nr_rec--;
+  sh->sh_seq++;
+
+  if (sh->sh_start == sh->sh_end)
+    sh->sh_start = sh->sh_end = 0;
+
+  spool_sync(sp);
+}
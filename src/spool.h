@@ -0,0 +1,36 @@
+#ifndef _SPOOL_H_
+#define _SPOOL_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bounded FIFO of timestamped reports in a memory mapped file, used by
+   xltop-servd to keep reports the master did not accept.  When full
+   the oldest reports are dropped. */
+
+struct spool_header;
+
+struct spool {
+  int sp_fd;
+  size_t sp_map_size;
+  struct spool_header *sp_hdr;
+  char *sp_data;
+};
+
+int spool_open(struct spool *sp, const char *path, size_t size);
+void spool_close(struct spool *sp);
+
+int spool_is_empty(const struct spool *sp);
+size_t spool_length(const struct spool *sp);
+
+int spool_append(struct spool *sp, double time, const void *buf, size_t len);
+
+/* Oldest report and its sequence number; buf points into the map and
+   stays valid until the next spool_append() or spool_pop(). */
+int spool_peek(struct spool *sp, uint64_t *seq, double *time,
+               const char **buf, size_t *len);
+
+/* Drop the oldest report if it is still seq (spool_append() may have
+   dropped it to make room). */
+void spool_pop(struct spool *sp, uint64_t seq);
+
+#endif
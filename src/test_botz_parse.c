@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "botz.h"
+#include "botz_parse.h"
+
+/* Requests as sent by xltop-servd and xltop. */
+const char *good_list[] = {
+  "PUT /serv/oss1.ranger.tacc.utexas.edu HTTP/1.1\r\n"
+  "Host: master:9901\r\n"
+  "Accept: */*\r\n"
+  "Content-Length: 1234\r\n"
+  "Expect: 100-continue\r\n"
+  "\r\n",
+  "GET /top?x0=u%3AALL&d0=2&x1=v%3AALL&d1=1&limit=4096&sort=r0 HTTP/1.1\r\n"
+  "Host: master:9901\r\n"
+  "Accept: */*\r\n"
+  "\r\n",
+  "GET /_info HTTP/1.0\n"
+  "CONNECTION:  Close \n"
+  "\n",
+  "DELETE /x? HTTP/1.1\r\n\r\n",
+  "PUT /serv/oss1 HTTP/1.1\r\n"
+  "Accept-Encoding: deflate, gzip;q=0, br\r\n"
+  "Content-Encoding: gzip\r\n"
+  "Content-Length: 20\r\n"
+  "\r\n",
+};
+
+const char *bad_list[] = {
+  "GET\r\n\r\n",
+  "GET /x\r\n\r\n",
+  "GET /x HTTP/1.1 y\r\n\r\n",
+  "HEAD /x HTTP/1.1\r\n\r\n",
+  "FROB /x HTTP/1.1\r\n\r\n",
+  "PUT /x HTTP/1.1\r\nContent-Length: 12x\r\n\r\n",
+  "PUT /x HTTP/1.1\r\nContent-Encoding: compress\r\n\r\n",
+};
+
+static int test(const char *str, int want)
+{
+  struct botz_head h;
+  size_t len = strlen(str), scan = 0, end = 0, i;
+  int rc;
+
+  /* Feed one byte at a time to exercise resumed scans. */
+  for (i = 1; i <= len && end == 0; i++)
+    end = botz_head_end(str, i, &scan);
+
+  if (end != len) {
+    printf("FAIL end %zu, len %zu\n", end, len);
+    return -1;
+  }
+
+  rc = botz_head_parse(&h, str, end);
+  printf("%s rc %d, status %d, method %d, path `%.*s', query `%.*s', "
+         "body_len %zu, close %u, expect_100 %u, accept %d, encoding %d\n",
+         (rc == 0) == want ? "PASS" : "FAIL", rc, h.h_status, h.h_method,
+         (int) h.h_path_len, h.h_path != NULL ? h.h_path : "",
+         (int) h.h_query_len, h.h_query != NULL ? h.h_query : "",
+         h.h_body_len, h.h_close, h.h_expect_100, h.h_accept_encoding,
+         h.h_content_encoding);
+
+  return (rc == 0) == want ? 0 : -1;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+  long i, n = argc > 1 ? strtol(argv[1], NULL, 0) : 1000000;
+  int status = 0;
+  size_t j;
+
+  for (j = 0; j < sizeof(good_list) / sizeof(good_list[0]); j++)
+    if (test(good_list[j], 1) < 0)
+      status = 1;
+
+  for (j = 0; j < sizeof(bad_list) / sizeof(bad_list[0]); j++)
+    if (test(bad_list[j], 0) < 0)
+      status = 1;
+
+  for (j = 0; j < 2; j++) {
+    const char *str = good_list[j];
+    size_t len = strlen(str), sum = 0;
+    struct botz_head h;
+    double t0 = now(), t1;
+
+    for (i = 0; i < n; i++) {
+      size_t scan = 0, end = botz_head_end(str, len, &scan);
+      botz_head_parse(&h, str, end);
+      sum += h.h_path_len;
+    }
+
+    t1 = now();
+    printf("%s: %ld parses in %f s, %.0f/s (%zu)\n",
+           j == 0 ? "servd PUT" : "xltop GET", n, t1 - t0, n / (t1 - t0),
+           sum);
+  }
+
+  return status;
+}
@@ -0,0 +1,206 @@
+#include "stddef1.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "string1.h"
+#include "xltop.h"
+#include "lstats.h"
+
+/* exports/NID/stats as seen on OSS and MDS nodes. */
+const char *sample_list[] = {
+  /* 1.8 OST. */
+  "snapshot_time             1336062282.482425 secs.usecs\n"
+  "read_bytes                1029 samples [bytes] 4096 1048576 1045893120\n"
+  "write_bytes               9822 samples [bytes] 16 1048576 10212335616\n"
+  "get_info                  18 samples [reqs]\n"
+  "set_info_async            2 samples [reqs]\n"
+  "connect                   1 samples [reqs]\n"
+  "statfs                    4391 samples [reqs]\n"
+  "ping                      6027 samples [reqs]\n",
+  /* 1.8 MDT. */
+  "snapshot_time             1336062282.519832 secs.usecs\n"
+  "open                      21813 samples [reqs]\n"
+  "close                     21813 samples [reqs]\n"
+  "mknod                     12 samples [reqs]\n"
+  "unlink                    7 samples [reqs]\n"
+  "getattr                   1210 samples [reqs]\n"
+  "setattr                   40 samples [reqs]\n"
+  "statfs                    3 samples [reqs]\n",
+  /* 2.x OST, with usecs units. */
+  "snapshot_time             1589301640.421375466 secs.nsecs\n"
+  "read_bytes                4 samples [bytes] 4096 1048576 1052672 "
+  "1099528404992\n"
+  "write_bytes               2321 samples [bytes] 1 4194304 9730785280 "
+  "40818686980096\n"
+  "read                      4 samples [usecs] 21 409 878 211766\n"
+  "write                     2321 samples [usecs] 7 187520 4312313 "
+  "212334561127\n"
+  "setattr                   1 samples [usecs] 62 62 62 3844\n"
+  "punch                     2 samples [usecs] 17 24 41 865\n"
+  "sync                      13 samples [usecs] 127 4209 17022 43191094\n"
+  "ping                      38 samples [usecs] 0 5 61 185\n",
+  /* Odd spacing, no trailing newline. */
+  "read_bytes 3 samples [bytes] 1 2 7\n"
+  "\n"
+  "  write_bytes\t5 samples [bytes] 1 2\n"
+  "foo 9 samples [reqs]",
+};
+
+/* Target job_stats, OST then MDT. */
+const char *job_sample =
+  "job_stats:\n"
+  "- job_id:          cp.0\n"
+  "  snapshot_time:   1336062282\n"
+  "  read_bytes:      { samples:           4, unit: bytes, min:    4096, "
+  "max:    4096, sum:           16384 }\n"
+  "  write_bytes:     { samples:           1, unit: bytes, min:    4096, "
+  "max:    4096, sum:            4096 }\n"
+  "  getattr:         { samples:           2, unit:  reqs }\n"
+  "  setattr:         { samples:           0, unit:  reqs }\n"
+  "- job_id:          \"1234\"\n"
+  "  snapshot_time:   1336062290\n"
+  "  write_bytes:     { samples: 3, unit: bytes, min: 1, max: 8, sum: 12, "
+  "sumsq: 70 }\n"
+  "  write:           { samples: 3, unit: usecs, min: 7, max: 90, sum: 120 }\n"
+  "  punch:           { samples: 1, unit: reqs }\n"
+  "- job_id:          has space\n"
+  "  getattr:         { samples: 5, unit: reqs }\n"
+  "- job_id:          mdt.0\n"
+  "  open:            { samples: 21813, unit:  reqs }\n"
+  "  close:           { samples: 21813, unit:  reqs }\n"
+  "  ping:            { samples: 9, unit:  reqs }\n"
+  "  mknod:           { samples: 12, unit:  reqs }";
+
+struct job_want {
+  const char *id;
+  int64_t stats[NR_STATS];
+};
+
+const struct job_want job_want_list[] = {
+  { "cp.0", { 4096, 16384, 2 } },
+  { "1234", { 12, 0, 1 } },
+  { "mdt.0", { 0, 0, 43638 } },
+};
+
+#define NR_JOB_WANT (sizeof(job_want_list) / sizeof(job_want_list[0]))
+
+static size_t nr_job_got, nr_job_bad;
+
+static void job_cb(void *data, const char *id, const int64_t *stats)
+{
+  const struct job_want *w = &job_want_list[nr_job_got++];
+
+  if (!(nr_job_got <= NR_JOB_WANT && strcmp(w->id, id) == 0 &&
+        memcmp(w->stats, stats, sizeof(w->stats)) == 0))
+    nr_job_bad++;
+}
+
+/* Feed job_sample in pieces of chunk bytes. */
+static int test_job(size_t chunk)
+{
+  struct lstats_job_parser p;
+  size_t len = strlen(job_sample), i;
+
+  nr_job_got = nr_job_bad = 0;
+  lstats_job_init(&p, &job_cb, NULL);
+
+  for (i = 0; i < len; i += chunk)
+    lstats_job_feed(&p, job_sample + i, MIN(chunk, len - i));
+
+  lstats_job_end(&p);
+
+  return nr_job_got == NR_JOB_WANT && nr_job_bad == 0 ? 0 : -1;
+}
+
+/* servd's parser before lstats. */
+static void ref_parse(int64_t *stats, const char *str)
+{
+  char *buf = strdup(str), *line = buf, *msg;
+
+  while ((msg = strsep(&line, "\n")) != NULL) {
+    char *ctr, *req, *ign, *unit, *min, *max, *sum;
+    int n = split(&msg, &ctr, &req, &ign, &unit, &min, &max, &sum,
+                  (char **) NULL);
+
+    if (n < 4 || strcmp(ctr, "ping") == 0)
+      continue;
+
+    if (strcmp(unit, "[reqs]") == 0)
+      stats[STAT_NR_REQS] += strtoll(req, NULL, 10);
+
+    if (n < 7 || strcmp(unit, "[bytes]") != 0)
+      continue;
+
+    if (strcmp(ctr, "write_bytes") == 0)
+      stats[STAT_WR_BYTES] += strtoll(sum, NULL, 10);
+    else if (strcmp(ctr, "read_bytes") == 0)
+      stats[STAT_RD_BYTES] += strtoll(sum, NULL, 10);
+  }
+
+  free(buf);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+  long i, n = argc > 1 ? strtol(argv[1], NULL, 0) : 1000000;
+  int status = 0, job_status = 0;
+  size_t j;
+
+  for (j = 0; j < sizeof(sample_list) / sizeof(sample_list[0]); j++) {
+    const char *str = sample_list[j];
+    int64_t want[NR_STATS] = { 0 }, got[NR_STATS] = { 0 };
+
+    ref_parse(want, str);
+    lstats_parse(got, str, strlen(str));
+
+    if (memcmp(want, got, sizeof(want)) != 0)
+      status = 1;
+
+    printf("%s sample %zu: "PRI_STATS_FMT("%"PRId64)", want "
+           PRI_STATS_FMT("%"PRId64)"\n",
+           memcmp(want, got, sizeof(want)) == 0 ? "PASS" : "FAIL", j,
+           PRI_STATS_ARG(got), PRI_STATS_ARG(want));
+  }
+
+  for (j = 1; j <= strlen(job_sample); j++) {
+    if (test_job(j) < 0) {
+      printf("FAIL job_stats in pieces of %zu, %zu jobs, %zu bad\n",
+             j, nr_job_got, nr_job_bad);
+      job_status = status = 1;
+    }
+  }
+
+  printf("%s job_stats\n", job_status == 0 ? "PASS" : "FAIL");
+
+  for (j = 0; j < 2; j++) {
+    const char *str = sample_list[0];
+    size_t len = strlen(str);
+    int64_t stats[NR_STATS] = { 0 };
+    double t0 = now(), t1;
+
+    for (i = 0; i < n; i++) {
+      if (j == 0)
+        ref_parse(stats, str);
+      else
+        lstats_parse(stats, str, len);
+    }
+
+    t1 = now();
+    printf("%s: %ld parses in %f s, %.0f/s (%"PRId64")\n",
+           j == 0 ? "split" : "lstats", n, t1 - t0, n / (t1 - t0),
+           stats[STAT_WR_BYTES]);
+  }
+
+  return status;
+}
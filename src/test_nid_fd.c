@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Compare xltop-servd's old per-interval open/read/close of each
+   exports/NID/stats file against holding the fds and rereading with
+   pread().  Runs against DIR/TARGET/exports/NID/stats if DIR is given
+   (e.g. /proc/fs/lustre/obdfilter), otherwise builds a fake tree of
+   NR_TARGET x NR_NID files under /tmp. */
+
+#define STATS \
+  "snapshot_time             1336062282.482425 secs.usecs\n" \
+  "read_bytes                1029 samples [bytes] 4096 1048576 1045893120\n" \
+  "write_bytes               9822 samples [bytes] 16 1048576 10212335616\n" \
+  "get_info                  18 samples [reqs]\n" \
+  "set_info_async            2 samples [reqs]\n" \
+  "connect                   1 samples [reqs]\n" \
+  "statfs                    4391 samples [reqs]\n" \
+  "ping                      6027 samples [reqs]\n"
+
+static char **path_list;
+static size_t nr_path;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_path(const char *path)
+{
+  path_list = realloc(path_list, (nr_path + 1) * sizeof(path_list[0]));
+  path_list[nr_path++] = strdup(path);
+}
+
+static void make_tree(char *top, size_t nr_target, size_t nr_nid)
+{
+  char path[4096];
+  size_t i, j;
+  FILE *f;
+
+  if (mkdtemp(top) == NULL) {
+    perror(top);
+    exit(1);
+  }
+
+  for (i = 0; i < nr_target; i++) {
+    snprintf(path, sizeof(path), "%s/scratch-OST%04zx", top, i);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/scratch-OST%04zx/exports", top, i);
+    mkdir(path, 0755);
+
+    for (j = 0; j < nr_nid; j++) {
+      snprintf(path, sizeof(path), "%s/scratch-OST%04zx/exports/"
+               "10.%zu.%zu.%zu@o2ib", top, i, j >> 16, (j >> 8) & 0xff,
+               j & 0xff);
+      mkdir(path, 0755);
+      strcat(path, "/stats");
+
+      f = fopen(path, "w");
+      if (f == NULL) {
+        perror(path);
+        exit(1);
+      }
+      fputs(STATS, f);
+      fclose(f);
+      add_path(path);
+    }
+  }
+}
+
+/* Old servd: open, read until EOF, close. */
+static size_t pass_open(char *buf, size_t size, size_t *nr_sys)
+{
+  size_t i, sum = 0;
+  ssize_t n;
+  int fd;
+
+  for (i = 0; i < nr_path; i++) {
+    fd = open(path_list[i], O_RDONLY);
+    (*nr_sys)++;
+    if (fd < 0)
+      continue;
+
+    while ((n = read(fd, buf, size)) > 0) {
+      (*nr_sys)++;
+      sum += n;
+    }
+    (*nr_sys)++;
+
+    close(fd);
+    (*nr_sys)++;
+  }
+
+  return sum;
+}
+
+/* New servd: one pread() from offset 0 on a held fd. */
+static size_t pass_pread(int *fd, char *buf, size_t size, size_t *nr_sys)
+{
+  size_t i, sum = 0;
+  ssize_t n;
+
+  for (i = 0; i < nr_path; i++) {
+    if (fd[i] < 0) {
+      fd[i] = open(path_list[i], O_RDONLY);
+      (*nr_sys)++;
+      if (fd[i] < 0)
+        continue;
+    }
+
+    n = pread(fd[i], buf, size, 0);
+    (*nr_sys)++;
+    if (n > 0)
+      sum += n;
+  }
+
+  return sum;
+}
+
+int main(int argc, char *argv[])
+{
+  char top[] = "/tmp/test_nid_fd.XXXXXX", buf[4096], cmd[4096];
+  size_t nr_target = 8, nr_nid = 2048, nr_pass = 10, i, sum, nr_sys;
+  int *fd, fake = argc < 2;
+  double t0, t1;
+
+  if (fake) {
+    make_tree(top, nr_target, nr_nid);
+  } else {
+    FILE *p;
+
+    snprintf(cmd, sizeof(cmd), "ls -d %s/*/exports/*/stats", argv[1]);
+    p = popen(cmd, "r");
+    while (p != NULL && fgets(buf, sizeof(buf), p) != NULL) {
+      buf[strcspn(buf, "\n")] = 0;
+      add_path(buf);
+    }
+    if (p != NULL)
+      pclose(p);
+  }
+
+  fd = malloc(nr_path * sizeof(fd[0]));
+  for (i = 0; i < nr_path; i++)
+    fd[i] = -1;
+
+  printf("%zu stats files, %zu passes\n", nr_path, nr_pass);
+
+  nr_sys = 0;
+  sum = 0;
+  t0 = now();
+  for (i = 0; i < nr_pass; i++)
+    sum += pass_open(buf, sizeof(buf), &nr_sys);
+  t1 = now();
+  printf("open/read/close: %f s/pass, %.1f syscalls/file (%zu)\n",
+         (t1 - t0) / nr_pass, (double) nr_sys / (nr_pass * nr_path), sum);
+
+  /* Warm pass opens the fds, as servd's first interval does. */
+  nr_sys = 0;
+  pass_pread(fd, buf, sizeof(buf), &nr_sys);
+
+  nr_sys = 0;
+  sum = 0;
+  t0 = now();
+  for (i = 0; i < nr_pass; i++)
+    sum += pass_pread(fd, buf, sizeof(buf), &nr_sys);
+  t1 = now();
+  printf("held fd pread:   %f s/pass, %.1f syscalls/file (%zu)\n",
+         (t1 - t0) / nr_pass, (double) nr_sys / (nr_pass * nr_path), sum);
+
+  if (fake) {
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", top);
+    if (system(cmd) != 0)
+      fprintf(stderr, "cannot remove `%s'\n", top);
+  }
+
+  return 0;
+}
@@ -10,6 +10,7 @@
 #include "trace.h"
 #include "query.h"
 #include "job.h"
+#include "perf.h"
 
 #define TOP_LIMIT_MAX ((size_t) 4096)
 
@@ -19,35 +20,20 @@ int q_x_parse(struct query *q, char *s)
   return 0;
 }
 
-static inline void k_top_spec_init(struct k_top *t)
-{
-  size_t i, n = 0;
-
-  memset(t, 0, sizeof(*t));
-
-  for (i = 0; i < NR_STATS && n < T_SPEC_LEN; i++)
-    t->t_spec[n++] = offsetof(struct k_node, k_rate[i]);
-
-  for (i = 0; i < NR_STATS && n < T_SPEC_LEN; i++)
-    t->t_spec[n++] = offsetof(struct k_node, k_sum[i]);
-
-  for (i = 0; i < NR_STATS && n < T_SPEC_LEN; i++)
-    t->t_spec[n++] = offsetof(struct k_node, k_pending[i]);
-
-  if (n < T_SPEC_LEN)
-    t->t_spec[n++] = offsetof(struct k_node, k_t);
-}
-
 int q_k_top_parse(struct query *q, char *s)
 {
   struct k_top *t = q->q_u.u_void_p;
   size_t n = 0;
 
   while (n < T_SPEC_LEN && s != NULL) {
-    char *u = strsep(&s, ",");
-    size_t i = atoi(u + 1);
+    char *u = strsep(&s, ","), *e;
+    size_t i = strtoul(u + 1, &e, 10), j = 0;
+
+    /* rI.J: rate over k_windows[J - 1]. */
+    if (*e == '.')
+      j = strtoul(e + 1, NULL, 10);
 
-    if (!(i < NR_STATS))
+    if (!(i < NR_STATS) || j > nr_k_windows || (j > 0 && *u != 'r'))
       return -1;
 
     switch (*u) {
@@ -55,7 +41,10 @@ int q_k_top_parse(struct query *q, char *s)
       t->t_spec[n++] = offsetof(struct k_node, k_pending[i]);
       break;
     case 'r':
-      t->t_spec[n++] = offsetof(struct k_node, k_rate[i]);
+      if (j == 0)
+        t->t_spec[n++] = offsetof(struct k_node, k_rate[i]);
+      else
+        t->t_spec[n++] = offsetof(struct k_node, k_wrate[j - 1][i]);
       break;
     case 's':
       t->t_spec[n++] = offsetof(struct k_node, k_sum[i]);
@@ -98,7 +87,7 @@ static void top_query_cb(EV_P_ struct botz_response *r,
 {
   struct k_heap *h = &t->t_h;
   k_heap_filt_t *filt = NULL;
-  size_t i;
+  size_t i, j;
 
   memset(h, 0, sizeof(*h));
 
@@ -137,7 +126,14 @@ static void top_query_cb(EV_P_ struct botz_response *r,
 
   for (i = 0; i < h->h_count; i++) {
     struct k_node *k = h->h_k[i];
-    n_buf_printf(&r->r_body, PRI_K_NODE_FMT"\n", PRI_K_NODE_ARG(k));
+    n_buf_printf(&r->r_body, PRI_K_NODE_FMT, PRI_K_NODE_ARG(k));
+
+    /* Rates over k_windows[], in order (see _windows). */
+    for (j = 0; j < nr_k_windows; j++)
+      n_buf_printf(&r->r_body, " "PRI_STATS_FMT("%f"),
+                   PRI_STATS_ARG(k->k_wrate[j]));
+
+    n_buf_printf(&r->r_body, "\n");
   }
 
  out:
@@ -149,6 +145,7 @@ static void top_get_cb(EV_P_ struct botz_entry *e,
                              struct botz_response *r)
 {
   struct k_top top;
+  double t0 = perf_now();
 
   k_top_spec_init(&top);
 
@@ -165,10 +162,13 @@ static void top_get_cb(EV_P_ struct botz_entry *e,
 
   if (QUERY_PARSE(TOP_QUERY, top_query, q->q_query) < 0) {
     r->r_status = BOTZ_BAD_REQUEST;
-    return;
+    goto out;
   }
 
   top_query_cb(EV_A_ r, QUERY_VALUES(TOP_QUERY, top_query));
+
+ out:
+  perf_hist_add(PERF_H_top, t0);
 }
 
 const struct botz_entry_ops top_entry_ops = {
@@ -176,3 +176,23 @@ const struct botz_entry_ops top_entry_ops = {
     [BOTZ_GET] = &top_get_cb,
   }
 };
+
+/* One line per window: "J SECONDS", J as in sort key rI.J.  Window 0
+   is k_window (k_rate). */
+static void windows_get_cb(EV_P_ struct botz_entry *e,
+                           struct botz_request *q,
+                           struct botz_response *r)
+{
+  size_t j;
+
+  n_buf_printf(&r->r_body, "0 %f\n", k_window);
+
+  for (j = 0; j < nr_k_windows; j++)
+    n_buf_printf(&r->r_body, "%zu %f\n", j + 1, k_windows[j]);
+}
+
+const struct botz_entry_ops windows_entry_ops = {
+  .o_method = {
+    [BOTZ_GET] = &windows_get_cb,
+  }
+};
@@ -1,5 +1,6 @@
 #include <math.h>
 #include <string.h>
+#include "perf.h"
 #include "trace.h"
 #include "x_node.h"
 #include "sub.h"
@@ -8,6 +9,15 @@ size_t nr_k;
 struct hash_table k_hash_table;
 
 double k_tick = K_TICK, k_window = K_WINDOW;
+size_t nr_k_windows;
+double k_windows[K_WINDOWS_MAX];
+double x_clock;
+
+/* Per window (k_window first, then k_windows[]): a = -k_tick / window
+   and expm1(a), so k_freshen() needs exp() only for missed ticks. */
+static struct k_factor {
+  double f_a, f_expm1;
+} k_factor[1 + K_WINDOWS_MAX];
 
 /* TODO Move default hints to a header. */
 
@@ -38,6 +48,12 @@ struct x_type x_types[] = {
     .x_type = X_U,
     .x_which = 0,
   },
+  [X_TARGET] = {
+    .x_type_name = "target",
+    .x_nr_hint = 1024,
+    .x_type = X_TARGET,
+    .x_which = 1,
+  },
   [X_SERV] = {
     .x_type_name = "serv",
     .x_nr_hint = 128,
@@ -138,6 +154,7 @@ void x_destroy(EV_P_ struct x_node *x)
     sub_cancel(EV_A_ s);
 
   hlist_del(&x->x_hash_node);
+  free(x->x_label);
 
   x->x_type->x_nr--;
   memset(x, 0, sizeof(*x));
@@ -211,7 +228,7 @@ int x_types_init(void)
   size_t k_nr_hint;
 
   TRACE("sizeof(struct x_node) %zu\n", sizeof(struct x_node));
-  TRACE("sizeof(struct k_node) %zu\n", sizeof(struct k_node));
+  TRACE("sizeof(struct k_node) %zu\n", K_NODE_SIZE);
 
   for (i = 0; i < NR_X_TYPES; i++) {
     if (hash_table_init(&x_types[i].x_hash_table, x_types[i].x_nr_hint) < 0)
@@ -238,21 +255,39 @@ int x_types_init(void)
   return 0;
 }
 
-void x_update(EV_P_ struct x_node *x0, struct x_node *x1, double *d)
+void x_update(EV_P_ struct x_node *x0, struct x_node *x1, double *d, double t)
 {
   struct x_node *i0, *i1;
   struct k_node *k;
 
+  PERF_INC(x_update);
+
   for (i0 = x0; i0 != NULL; i0 = i0->x_parent) {
     for (i1 = x1; i1 != NULL; i1 = i1->x_parent) {
       k = k_lookup(i0, i1, L_CREATE);
 
       if (k != NULL)
-        k_update(EV_A_ k, x0, x1, d);
+        k_update(EV_A_ k, x0, x1, d, t);
     }
   }
 }
 
+void x_update_leaf(EV_P_ struct x_node *x0, struct x_node *x1, double *d,
+                   double t)
+{
+  struct x_node *i0;
+  struct k_node *k;
+
+  PERF_INC(x_update);
+
+  for (i0 = x0; i0 != NULL; i0 = i0->x_parent) {
+    k = k_lookup(i0, x1, L_CREATE);
+
+    if (k != NULL)
+      k_update(EV_A_ k, x0, x1, d, t);
+  }
+}
+
 struct k_node *k_lookup(struct x_node *x0, struct x_node *x1, int flags)
 {
   struct hash_table *t = &k_hash_table;
@@ -262,10 +297,14 @@ struct k_node *k_lookup(struct x_node *x0, struct x_node *x1, int flags)
   struct k_node *k;
 
   hlist_for_each_entry(k, node, head, k_hash_node) {
-    if (k->k_x[0] == x0 && k->k_x[1] == x1)
+    if (k->k_x[0] == x0 && k->k_x[1] == x1) {
+      PERF_INC(k_lookup_hit);
       return k;
+    }
   }
 
+  PERF_INC(k_lookup_miss);
+
   if (!(flags & L_CREATE))
     return NULL;
 
@@ -274,17 +313,18 @@ struct k_node *k_lookup(struct x_node *x0, struct x_node *x1, int flags)
     return NULL;
   }
 
-  k = malloc(sizeof(*k));
+  k = malloc(K_NODE_SIZE);
   if (k == NULL)
     return NULL;
 
   /* k_init() */
-  memset(k, 0, sizeof(*k));
+  memset(k, 0, K_NODE_SIZE);
   hlist_add_head(&k->k_hash_node, head);
   k->k_x[0] = x0;
   k->k_x[1] = x1;
   INIT_LIST_HEAD(&k->k_sub_list);
   nr_k++;
+  PERF_INC(k_create);
 
   return k;
 }
@@ -314,49 +354,110 @@ void k_destroy(EV_P_ struct x_node *x0, struct x_node *x1, int which)
   }
 }
 
+int k_windows_init(const double *w, size_t n)
+{
+  size_t j;
+
+  if (n > K_WINDOWS_MAX || nr_k > 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (j = 0; j < n; j++) {
+    if (!(w[j] > 0)) {
+      errno = EINVAL;
+      return -1;
+    }
+    k_windows[j] = w[j];
+  }
+
+  nr_k_windows = n;
+
+  for (j = 0; j <= nr_k_windows; j++) {
+    k_factor[j].f_a = -k_tick / (j == 0 ? k_window : k_windows[j - 1]);
+    k_factor[j].f_expm1 = expm1(k_factor[j].f_a);
+  }
+
+  return 0;
+}
+
 void k_freshen(struct k_node *k, double now)
 {
+  double e[1 + K_WINDOWS_MAX];
+  size_t i, j;
+
+  PERF_INC(k_freshen);
+
   if (k->k_t <= 0)
     k->k_t = now;
 
   double n = floor((now - k->k_t) / k_tick); /* # ticks. */
+  if (!(n > 0))
+    return;
 
-  k->k_t += fmax(n, 0) * k_tick;
+  k->k_t += n * k_tick;
+
+  /* Decay for missed intervals. */
+  if (n > 1)
+    for (j = 0; j <= nr_k_windows; j++)
+      e[j] = exp((n - 1) * k_factor[j].f_a);
 
-  size_t i;
   for (i = 0; i < NR_STATS; i++) {
-    if (n > 0) {
-      /* Apply pending. */
-      double r = k->k_pending[i] / k_tick;
-      k->k_pending[i] = 0;
+    /* Apply pending. */
+    double r = k->k_pending[i] / k_tick;
+    k->k_pending[i] = 0;
+
+    for (j = 0; j <= nr_k_windows; j++) {
+      double *a = j == 0 ? &k->k_rate[i] : &k->k_wrate[j - 1][i];
 
       /* TODO (n > K_TICKS_HUGE || k_rate < K_RATE_EPS) */
-      if (k->k_rate[i] <= 0)
-        k->k_rate[i] = r;
+      if (*a <= 0)
+        *a = r;
       else
-        k->k_rate[i] += (k->k_rate[i] - r) * expm1(-k_tick / k_window);
-    }
+        *a += (*a - r) * k_factor[j].f_expm1;
 
-
-    if (n > 1)
-      /* Decay rate for missed intervals. */
-      k->k_rate[i] *= exp((n - 1) * (-k_tick / k_window));
+      if (n > 1)
+        *a *= e[j];
+    }
   }
 }
 
-void k_update(EV_P_ struct k_node *k, struct x_node *x0, struct x_node *x1, double *d)
+void k_update(EV_P_ struct k_node *k, struct x_node *x0, struct x_node *x1,
+              double *d, double t)
 {
-  double now = ev_now(EV_A);
+  double now = x_now(EV_A);
+  double w[1 + K_WINDOWS_MAX];
+  size_t i, j;
 
-  TRACE("%s %s, k_t %f, now %f, d "PRI_STATS_FMT("%f")"\n",
-        k->k_x[0]->x_name, k->k_x[1]->x_name, k->k_t, now, PRI_STATS_ARG(d));
+  TRACE("%s %s, k_t %f, now %f, t %f, d "PRI_STATS_FMT("%f")"\n",
+        k->k_x[0]->x_name, k->k_x[1]->x_name, k->k_t, now, t,
+        PRI_STATS_ARG(d));
 
   k_freshen(k, now);
 
-  size_t i;
+  /* A late delta (replayed from a servd spool) belongs to a tick that
+     was already folded into k_rate, followed by m more folds.  Since
+     the average is linear in its samples, add what it would have
+     contributed: weight (1 - e^-a) e^-(m a), a = k_tick / window. */
+  if (t < k->k_t) {
+    double m = ceil((k->k_t - t) / k_tick) - 1;
+
+    for (j = 0; j <= nr_k_windows; j++)
+      w[j] = -k_factor[j].f_expm1 * exp(m * k_factor[j].f_a) / k_tick;
+  }
+
   for (i = 0; i < NR_STATS; i++) {
+    if (d[i] != 0)
+      k->k_modified = now;
+
     k->k_sum[i] += d[i];
-    k->k_pending[i] += d[i];
+    if (t < k->k_t) {
+      k->k_rate[i] += w[0] * d[i];
+      for (j = 1; j <= nr_k_windows; j++)
+        k->k_wrate[j - 1][i] += w[j] * d[i];
+    } else {
+      k->k_pending[i] += d[i];
+    }
     /* TRACE("now %8.3f, t %8.3f, p %12f, A %12f %12e\n", now, t, p, A, A); */
   }
 
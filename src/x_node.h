@@ -11,6 +11,7 @@ enum {
   X_JOB,
   X_CLUS,
   X_U,
+  X_TARGET,
   X_SERV,
   X_FS,
   X_V,
@@ -25,6 +26,24 @@ enum {
 
 extern double k_tick, k_window;
 
+/* Extra EWMA windows.  Each costs NR_STATS doubles (24 bytes) per
+   k_node, in k_wrate[] after the fixed part of struct k_node. */
+extern size_t nr_k_windows;
+extern double k_windows[K_WINDOWS_MAX];
+
+/* Set the extra windows and precompute the decay factors for k_tick,
+   k_window, and w.  Call before any k_node is created. */
+int k_windows_init(const double *w, size_t n);
+
+/* Replaces ev_now() on the ingest path when nonzero, for replay of a
+   journal (see journal.c). */
+extern double x_clock;
+
+static inline double x_now(EV_P)
+{
+  return x_clock > 0 ? x_clock : ev_now(EV_A);
+}
+
 struct x_type {
   struct hash_table x_hash_table;
   const char *x_type_name;
@@ -41,6 +60,8 @@ struct x_node {
   struct list_head x_sub_list;
   size_t x_hash;
   struct hlist_node x_hash_node;
+  char *x_label; /* Cached metrics label, see metrics.c. */
+  double x_snap; /* Record index while saving, see snap.c. */
   char x_name[];
 };
 
@@ -52,11 +73,16 @@ struct k_node {
   struct x_node *k_x[2];
   struct list_head k_sub_list;
   double k_t; /* Timestamp. */
+  double k_modified; /* Of the last nonzero delta. */
   double k_pending[NR_STATS];
   double k_rate[NR_STATS]; /* EWMA bytes (or reqs) per second. */
   double k_sum[NR_STATS];
+  double k_wrate[][NR_STATS]; /* Rates over k_windows[]. */
 };
 
+#define K_NODE_SIZE \
+  (sizeof(struct k_node) + nr_k_windows * sizeof(double[NR_STATS]))
+
 extern size_t nr_k;
 extern struct hash_table k_hash_table;
 
@@ -76,7 +102,12 @@ struct x_node *x_lookup_hash(int type, const char *name, size_t *hash_ref,
 /* No create. */
 struct x_node *x_lookup_str(const char *str);
 
-void x_update(EV_P_ struct x_node *x0, struct x_node *x1, double *d);
+/* d was measured at time t (normally ev_now()). */
+void x_update(EV_P_ struct x_node *x0, struct x_node *x1, double *d, double t);
+
+/* x_update() of the pairs with x1 itself but none of its ancestors. */
+void x_update_leaf(EV_P_ struct x_node *x0, struct x_node *x1, double *d,
+                   double t);
 
 void x_destroy(EV_P_ struct x_node *x);
 
@@ -97,6 +128,7 @@ static inline const char *x_type_name(int type)
   case X_JOB:   return "job";
   case X_CLUS:  return "clus";
   case X_U:     return "u";
+  case X_TARGET: return "target";
   case X_SERV:  return "serv";
   case X_FS:    return "fs";
   case X_V:     return "v";
@@ -114,6 +146,8 @@ static inline int x_str_type(const char *s)
     return X_CLUS;
   else if (strcmp(s, "u") == 0)
     return X_U;
+  else if (strcmp(s, "target") == 0)
+    return X_TARGET;
   else if (strcmp(s, "serv") == 0)
     return X_SERV;
   else if (strcmp(s, "fs") == 0)
@@ -134,7 +168,8 @@ struct k_node *k_lookup(struct x_node *x0, struct x_node *x1, int flags);
 
 void k_freshen(struct k_node *k, double now);
 
-void k_update(EV_P_ struct k_node *k, struct x_node *x0, struct x_node *x1, double *d);
+void k_update(EV_P_ struct k_node *k, struct x_node *x0, struct x_node *x1,
+              double *d, double t);
 
 void k_destroy(EV_P_ struct x_node *x0, struct x_node *x1, int which);
 
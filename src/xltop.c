@@ -55,6 +55,7 @@ struct xl_fs {
   size_t f_nr_mds, f_nr_mdt, f_max_mds_task;
   size_t f_nr_oss, f_nr_ost, f_max_oss_task;
   size_t f_nr_nid;
+  size_t f_nr_late; /* Servers whose collect and upload overran. */
   char f_name[];
 };
 
@@ -65,6 +66,7 @@ struct xl_k {
   double k_pending[NR_STATS];
   double k_rate[NR_STATS]; /* EWMA bytes (or reqs) per second. */
   double k_sum[NR_STATS];
+  double k_wrate[K_WINDOWS_MAX][NR_STATS]; /* Over xl_window[1...]. */
 };
 
 struct xl_col {
@@ -89,7 +91,7 @@ static double status_bar_time;
 
 static int scroll_start, scroll_delta;
 
-static struct xl_col top_col[24];
+static struct xl_col top_col[9 + 3 * K_WINDOWS_MAX];
 static struct xl_k *top_k;
 static size_t top_k_limit = 4096;
 static size_t top_k_length;
@@ -98,6 +100,10 @@ static double top_interval = 10;
 static struct ev_timer top_timer_w;
 static N_BUF(top_nb);
 
+/* Rate windows of the master, xl_window[0] being that of k_rate. */
+static double xl_window[1 + K_WINDOWS_MAX];
+static size_t xl_nr_windows;
+
 static const char *clus_default = XLTOP_CLUS;
 static const char *domain_default = XLTOP_DOMAIN;
 
@@ -171,6 +177,7 @@ static int xl_sep(char *s, int *type, char **name)
   case 'j': i_type = X_JOB; break;
   case 'c': i_type = X_CLUS; break;
   case 'u': i_type = X_U; break;
+  case 't': i_type = X_TARGET; break;
   case 's': i_type = X_SERV; break;
   case 'f': i_type = X_FS; break;
   case 'v': i_type = X_V; break;
@@ -419,8 +426,8 @@ static int xl_fs_msg_cb(struct xl_fs *f, char *msg, size_t msg_len)
   if (split(&msg, &s_serv, (char **) NULL) != 1 || msg == NULL)
     return 0;
 
-  if (sscanf(msg, SCN_SERV_STATUS_FMT, SCN_SERV_STATUS_ARG(ss)) !=
-      NR_SCN_SERV_STATUS_ARGS)
+  if (sscanf(msg, SCN_SERV_STATUS_FMT, SCN_SERV_STATUS_ARG(ss)) <
+      NR_SCN_SERV_STATUS_MIN_ARGS)
     return 0;
 
   TRACE("serv `%s', status "PRI_SERV_STATUS_FMT"\n",
@@ -443,6 +450,11 @@ static int xl_fs_msg_cb(struct xl_fs *f, char *msg, size_t msg_len)
   f->f_nr_ost += ss.ss_nr_ost;
   f->f_nr_nid = MAX(f->f_nr_nid, ss.ss_nr_nid);
 
+  /* Zero from servds that predate the interval field. */
+  if (ss.ss_interval > 0 &&
+      ss.ss_collect_time + ss.ss_upload_time > ss.ss_interval)
+    f->f_nr_late++;
+
   return 0;
 }
 
@@ -466,6 +478,7 @@ static void xl_fs_cb(EV_P_ struct ev_periodic *w, int revents)
   f->f_nr_ost = 0;
   f->f_max_oss_task = 0;
   f->f_nr_nid = 0;
+  f->f_nr_late = 0;
 
   curl_x_get_iter(&curl_x, status_path, NULL, (msg_cb_t *) &xl_fs_msg_cb, f);
 
@@ -519,9 +532,53 @@ static int xl_fs_init(EV_P)
   return rc;
 }
 
+/* Older masters have no _windows and send no extra rates. */
+static void xl_windows_init(void)
+{
+  N_BUF(nb);
+  char *m;
+  size_t m_len, j;
+  double w;
+
+  if (curl_x_get(&curl_x, "_windows", NULL, &nb) < 0)
+    goto out;
+
+  while (n_buf_get_msg(&nb, &m, &m_len) == 0) {
+    if (sscanf(m, "%zu %lf", &j, &w) != 2 || j > K_WINDOWS_MAX || w <= 0)
+      continue;
+
+    xl_window[j] = w;
+    if (j > xl_nr_windows)
+      xl_nr_windows = j;
+  }
+
+ out:
+  n_buf_destroy(&nb);
+}
+
+/* Index into xl_window[] of the window of s seconds (or minutes or
+   hours with suffix m or h), or -1. */
+static int xl_window_lookup(const char *s)
+{
+  char *end;
+  double w = strtod(s, &end);
+  size_t j;
+
+  if (*end == 'm')
+    w *= 60;
+  else if (*end == 'h')
+    w *= 3600;
+
+  for (j = 0; j <= xl_nr_windows; j++)
+    if (xl_window[j] > 0 && fabs(xl_window[j] - w) < 0.5)
+      return j;
+
+  return -1;
+}
+
 static void top_msg_cb(char *msg, size_t msg_len)
 {
-  int i;
+  int i, j, n = 0;
   char *s[2];
   struct xl_k *k = &top_k[top_k_length];
 
@@ -532,10 +589,15 @@ static void top_msg_cb(char *msg, size_t msg_len)
     if (xl_sep(s[i], &k->k_type[i], &k->k_x[i]) < 0 || k->k_x[i] == NULL)
       return;
 
-  if (sscanf(msg, "%lf "SCN_K_STATS_FMT, &k->k_t, SCN_K_STATS_ARG(k)) !=
-      1 + NR_K_STATS)
+  if (sscanf(msg, "%lf "SCN_K_STATS_FMT"%n",
+             &k->k_t, SCN_K_STATS_ARG(k), &n) != 1 + NR_K_STATS)
     return;
 
+  msg += n;
+  for (j = 0; j < xl_nr_windows; j++)
+    for (i = 0; i < NR_STATS; i++)
+      k->k_wrate[j][i] = strtod(msg, &msg);
+
   TRACE("%s %s "PRI_STATS_FMT("%f")"\n",
         k->k_x[0], k->k_x[1], PRI_STATS_ARG(k->k_rate));
 
@@ -710,6 +772,7 @@ void c_print(int y, int x, struct xl_col *c, struct xl_k *k)
 #define COL_JOB   COL_X("JOB",   0, (show_full_names ? 15 : 8))
 #define COL_CLUS  COL_X("CLUS",  0, 15)
 #define COL_U     COL_X("ALL",     0,  5)
+#define COL_TARGET COL_X("TARGET", 1, 15)
 #define COL_SERV  COL_X("SERV",  1, (show_full_names ? 15 : 8))
 #define COL_FS    COL_X("FS",    1, 15)
 #define COL_V     COL_X("ALL",     1,  5)
@@ -731,6 +794,17 @@ void c_print(int y, int x, struct xl_col *c, struct xl_k *k)
 #define COL_RD_MB_RATE COL_MB_RATE("RD_MB/S", k_rate[STAT_RD_BYTES])
 #define COL_REQS_RATE  COL_D("REQS/S", k_rate[STAT_NR_REQS], 10, 1, 3)
 
+/* Rate over xl_window[j], j > 0, given as w. */
+static struct xl_col col_wrate(const char *name, const char *w, int j,
+                               int stat, size_t scale)
+{
+  char *s = strf("%s@%s", name, w);
+  if (s == NULL)
+    OOM();
+
+  return COL_D(s, k_wrate[j - 1][stat], MAX(10, (int) strlen(s)), scale, 3);
+}
+
 #define COL_WR_MB_SUM COL_MB_SUM("WR_MB", k_sum[STAT_WR_BYTES])
 #define COL_RD_MB_SUM COL_MB_SUM("RD_MB", k_sum[STAT_RD_BYTES])
 #define COL_REQS_SUM  COL_D("REQS", k_sum[STAT_NR_REQS], 10, 1, 0)
@@ -839,10 +913,11 @@ static void screen_refresh_cb(EV_P_ int LINES, int COLS)
   if (!show_fs_status)
     goto skip_fs_status;
 
-  mvprintw(line, 0, "%-15s  %6s %6s %6s %6s %6s    %6s %6s %6s %6s %6s    %6s",
+  mvprintw(line, 0,
+           "%-15s  %6s %6s %6s %6s %6s    %6s %6s %6s %6s %6s    %6s %6s",
            "FILESYSTEM",
            "MDS/T", "LOAD1", "LOAD5", "LOAD15", "TASKS",
-           "OSS/T", "LOAD1", "LOAD5", "LOAD15", "TASKS", "NIDS");
+           "OSS/T", "LOAD1", "LOAD5", "LOAD15", "TASKS", "NIDS", "LATE");
   mvchgat(line, 0, -1, A_STANDOUT, fs_color_pair, NULL);
   line++;
 
@@ -853,13 +928,13 @@ static void screen_refresh_cb(EV_P_ int LINES, int COLS)
     snprintf(o_buf, sizeof(o_buf), "%zu/%zu", f->f_nr_oss, f->f_nr_ost);
 
     mvprintw(line++, 0,
-             "%-15s  %6s %6.2f %6.2f %6.2f %6zu    %6s %6.2f %6.2f %6.2f %6zu    %6zu",
+             "%-15s  %6s %6.2f %6.2f %6.2f %6zu    %6s %6.2f %6.2f %6.2f %6zu    %6zu %6zu",
              f->f_name,
              m_buf, f->f_mds_load[0], f->f_mds_load[1], f->f_mds_load[2],
              f->f_max_mds_task,
              o_buf, f->f_oss_load[0], f->f_oss_load[1], f->f_oss_load[2],
              f->f_max_oss_task,
-             f->f_nr_nid);
+             f->f_nr_nid, f->f_nr_late);
   }
 
  skip_fs_status:
@@ -953,8 +1028,9 @@ static char *parse_sort_key(const char *key, int want_sums)
   char *k = NULL;
 
   while (pos != NULL) {
-    char *s = strsep(&pos, ",");
+    char *s = strsep(&pos, ","), *at;
     int is_rate = (strchr(s, '/') != NULL) || !want_sums;
+    int stat, j = 0;
 
     while (isspace(*s))
       s++;
@@ -962,6 +1038,15 @@ static char *parse_sort_key(const char *key, int want_sums)
     if (*s == 0)
       continue;
 
+    at = strchr(s, '@');
+    if (at != NULL) {
+      *at = 0;
+      j = xl_window_lookup(at + 1);
+      if (j < 0)
+        FATAL("unknown window `%s'\n", at + 1);
+      is_rate = 1;
+    }
+
 #define K_ADD(fmt,args...) do {                 \
     if (k == NULL) {                            \
       k = strf(fmt, ##args);                    \
@@ -973,11 +1058,16 @@ static char *parse_sort_key(const char *key, int want_sums)
   } while (0)
 
     if (tolower(*s) == 'w')
-      K_ADD("%c%d", is_rate ? 'r' : 's', STAT_WR_BYTES);
+      stat = STAT_WR_BYTES;
     else if (strchr(s, 'q') != NULL || strchr(s, 'Q') != NULL)
-      K_ADD("%c%d", is_rate ? 'r' : 's', STAT_NR_REQS);
+      stat = STAT_NR_REQS;
     else
-      K_ADD("%c%d", is_rate ? 'r' : 's', STAT_RD_BYTES);
+      stat = STAT_RD_BYTES;
+
+    if (j > 0)
+      K_ADD("r%d.%d", stat, j);
+    else
+      K_ADD("%c%d", is_rate ? 'r' : 's', stat);
 
 #undef K_ADD
 
@@ -996,7 +1086,8 @@ static void print_help(void)
 
   printf("Usage: %s [OPTION]... [EXPRESSION...]\n"
 	 "Expression may be one of:\n"
-	 " owner=OWNER, clus[=CLUS], job[=JOB], host[=HOST], fs[=FS], serv[=SERV]\n"
+	 " owner=OWNER, clus[=CLUS], job[=JOB], host[=HOST], fs[=FS], serv[=SERV],\n"
+	 " target[=TARGET]\n"
 	 "Types may be given by their first character; use 'u' and 'v' for the universes.\n"
 	 "\nOPTIONS:\n"
 	 " -c, --config=DIR_OR_FILE    read configuration from DIR_OR_FILE\n"
@@ -1010,10 +1101,13 @@ static void print_help(void)
 	 " -s, --sum                   show sums rather than rates\n"
 	 " -u, --ubuntu                look snazzy on my terminal (terrible on xterms)\n"
 	 " -v, --version               display version information and exit\n"
+	 " -w, --window=W1[,W2...]     also show rates over the master's windows W1,...\n"
 	 "\nSORTING:\n"
 	 " Sort keys are case insensitive.  Keys containing 'W' select bytes written\n"
 	 " (as a rate or sum according to use of -s, --show-sum).  Similarly keys\n"
 	 " containing 'R' and 'Q' are interpreted as bytes read and requests.\n"
+	 " A key ending in @SECONDS (or @MINUTESm, @HOURSh) selects the rate over\n"
+	 " that window, if the master keeps one (see windows in xltop-master.conf).\n"
 	 "\nEXAMPLES:\n"
 	 " %s job serv (or %s j s) # Show traffic between jobs and servers\n"
 	 " %s h=i101-101.ranger.tacc.utexas.edu # Show i101-101 to each filesystem\n"
@@ -1036,7 +1130,7 @@ int main(int argc, char *argv[])
 {
   const char *conf_arg = NULL;
   const char *m_host = XLTOP_MASTER, *m_port = XLTOP_PORT;
-  char *sort_key = NULL;
+  char *sort_key = NULL, *show_windows = NULL;
   int want_sum = 0;
 
   struct option opts[] = {
@@ -1051,11 +1145,12 @@ int main(int argc, char *argv[])
     { "sum",         0, NULL, 's' },
     { "ubuntu",      0, NULL, 'u' },
     { "version",     0, NULL, 'v' },
+    { "window",      1, NULL, 'w' },
     { NULL,          0, NULL,  0  },
   };
 
   int opt;
-  while ((opt = getopt_long(argc, argv, "c:fhi:k:l:m:p:suv", opts, 0)) > 0) {
+  while ((opt = getopt_long(argc, argv, "c:fhi:k:l:m:p:suvw:", opts, 0)) > 0) {
     switch (opt) {
     case 'c':
       conf_arg = optarg;
@@ -1093,6 +1188,9 @@ int main(int argc, char *argv[])
     case 'v':
       print_version();
       exit(EXIT_SUCCESS);
+    case 'w':
+      show_windows = optarg;
+      break;
     case '?':
       FATAL("Try `%s --help' for more information.\n", program_invocation_short_name);
     }
@@ -1120,6 +1218,8 @@ int main(int argc, char *argv[])
   if (curl_x_init(&curl_x, m_host, m_port) < 0)
     FATAL("cannot initialize curl handle: %m\n");
 
+  xl_windows_init();
+
   if (sort_key != NULL)
     sort_key = parse_sort_key(sort_key, want_sum);
 
@@ -1144,6 +1244,7 @@ int main(int argc, char *argv[])
     case 'j': ti = X_JOB; break;
     case 'c': ti = X_CLUS; break;
     case 'u': ti = X_U; break;
+    case 't': ti = X_TARGET; break;
     case 's': ti = X_SERV; break;
     case 'f': ti = X_FS; break;
     case 'v': ti = X_V; break;
@@ -1172,7 +1273,7 @@ int main(int argc, char *argv[])
     }
   }
 
-  for (i = X_V; i >= X_SERV; i--) {
+  for (i = X_V; i >= X_TARGET; i--) {
     if (t_set[i])
       c[1] = i;
     if (x_set[i] != NULL) {
@@ -1223,19 +1324,36 @@ int main(int argc, char *argv[])
 
   top_col[0] = c[0] == X_HOST ? COL_HOST : c[0] == X_JOB ? COL_JOB :
     c[0] == X_CLUS ? COL_CLUS: COL_U;
-  top_col[1] = c[1] == X_SERV ? COL_SERV : c[1] == X_FS ? COL_FS : COL_V;
+  top_col[1] = c[1] == X_TARGET ? COL_TARGET : c[1] == X_SERV ? COL_SERV :
+    c[1] == X_FS ? COL_FS : COL_V;
   top_col[2] = want_sum ? COL_WR_MB_SUM : COL_WR_MB_RATE;
   top_col[3] = want_sum ? COL_RD_MB_SUM : COL_RD_MB_RATE;
   top_col[4] = want_sum ? COL_REQS_SUM : COL_REQS_RATE;
+  i = 5;
+
+  while (show_windows != NULL) {
+    char *w = strsep(&show_windows, ",");
+    int j = xl_window_lookup(w);
+
+    if (j < 0)
+      FATAL("unknown window `%s'\n", w);
+
+    if (j == 0 || i + 3 > 5 + 3 * K_WINDOWS_MAX)
+      continue;
+
+    top_col[i++] = col_wrate("WR_MB/S", w, j, STAT_WR_BYTES, 1048576);
+    top_col[i++] = col_wrate("RD_MB/S", w, j, STAT_RD_BYTES, 1048576);
+    top_col[i++] = col_wrate("REQS/S", w, j, STAT_NR_REQS, 1);
+  }
 
   if (c[0] == X_HOST) {
-    top_col[5] = COL_JOBID;
-    top_col[6] = COL_OWNER;
-    top_col[7] = COL_TITLE;
+    top_col[i++] = COL_JOBID;
+    top_col[i++] = COL_OWNER;
+    top_col[i++] = COL_TITLE;
   } else if (c[0] == X_JOB) {
-    top_col[5] = COL_OWNER;
-    top_col[6] = COL_TITLE;
-    top_col[7] = COL_NR_HOSTS;
+    top_col[i++] = COL_OWNER;
+    top_col[i++] = COL_TITLE;
+    top_col[i++] = COL_NR_HOSTS;
     /* TODO Run time. */
   }
 
@@ -8,6 +8,19 @@
 #define STAT_NR_REQS  2
 #define NR_STATS 3 /* MOVEME */
 
+/* Extra rate windows served by the master, see k_windows. */
+#define K_WINDOWS_MAX 8
+
+/* servd report lines for jobs from job_stats rather than NIDs. */
+#define XLTOP_JOB_PREFIX "job:"
+
+/* servd report line naming the target of the lines that follow. */
+#define XLTOP_TARGET_PREFIX "target:"
+
+/* xltop-relay batch line "serv:NAME TIME HAS_STATUS" starting the
+   lines of one server. */
+#define XLTOP_SERV_PREFIX "serv:"
+
 #define PRI_STATS_FMT(s) s" "s" "s
 #define PRI_STATS_ARG(v) (v)[0], (v)[1], (v)[2]
 
@@ -42,26 +55,43 @@ struct serv_status {
   size_t ss_total_swap, ss_free_swap;
   size_t ss_nr_task;
   size_t ss_nr_mdt, ss_nr_ost, ss_nr_nid;
+  double ss_collect_time;
+  /* servd's own cost: files opened and bytes read by the last
+     collection, time and size of the last stats upload, failed PUTs
+     since start, and the interval servd is running at. */
+  size_t ss_nr_open, ss_read_bytes;
+  double ss_upload_time;
+  size_t ss_upload_bytes, ss_nr_upload_fail;
+  double ss_interval;
 };
 
 #define PRI_SERV_STATUS_FMT \
-  "%.0f %.0f %.2f %.2f %.2f %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu"
+  "%.0f %.0f %.2f %.2f %.2f %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu %.6f " \
+  "%zu %zu %.6f %zu %zu %f"
 
 #define PRI_SERV_STATUS_ARG(s) \
   (s).ss_time, (s).ss_uptime, (s).ss_load[0], (s).ss_load[1], (s).ss_load[2], \
   (s).ss_total_ram, (s).ss_free_ram, (s).ss_shared_ram, (s).ss_buffer_ram, \
   (s).ss_total_swap, (s).ss_free_swap, (s).ss_nr_task, \
-  (s).ss_nr_mdt, (s).ss_nr_ost, (s).ss_nr_nid
+  (s).ss_nr_mdt, (s).ss_nr_ost, (s).ss_nr_nid, (s).ss_collect_time, \
+  (s).ss_nr_open, (s).ss_read_bytes, (s).ss_upload_time, \
+  (s).ss_upload_bytes, (s).ss_nr_upload_fail, (s).ss_interval
 
 #define SCN_SERV_STATUS_FMT \
-  "%lf %lf %lf %lf %lf %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu"
+  "%lf %lf %lf %lf %lf %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu %lf " \
+  "%zu %zu %lf %zu %zu %lf"
 
 #define SCN_SERV_STATUS_ARG(s) \
   &(s).ss_time, &(s).ss_uptime, &(s).ss_load[0], &(s).ss_load[1], \
   &(s).ss_load[2], &(s).ss_total_ram, &(s).ss_free_ram, &(s).ss_shared_ram, \
   &(s).ss_buffer_ram, &(s).ss_total_swap, &(s).ss_free_swap, &(s).ss_nr_task, \
-  &(s).ss_nr_mdt, &(s).ss_nr_ost, &(s).ss_nr_nid
+  &(s).ss_nr_mdt, &(s).ss_nr_ost, &(s).ss_nr_nid, &(s).ss_collect_time, \
+  &(s).ss_nr_open, &(s).ss_read_bytes, &(s).ss_upload_time, \
+  &(s).ss_upload_bytes, &(s).ss_nr_upload_fail, &(s).ss_interval
+
+#define NR_SCN_SERV_STATUS_ARGS 22
 
-#define NR_SCN_SERV_STATUS_ARGS 15
+/* Older servds stop after ss_nr_nid; trailing fields stay zero. */
+#define NR_SCN_SERV_STATUS_MIN_ARGS 15
 
 #endif